@@ -0,0 +1,415 @@
+/*
+ * @file
+ * @brief frequency-domain acoustic echo canceller for the capture path
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AEC_NEON 1
+#endif
+#include "aec.h"
+#include "echo_ref.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define AEC_DBGON 1
+#if AEC_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+#define AEC_TAIL_MS		128
+#define AEC_MU			0.25f	/* NLMS step */
+#define AEC_PXX_SMOOTH		0.1f
+/* per-bin power regularization, white noise around -60 dBFS */
+#define AEC_POWER_FLOOR		(AEC_FFT * 900.0f)
+#define AEC_REF_PEAK_DECAY	0.99f	/* per block, about 0.8 s to -20 dB */
+#define AEC_GEIGEL		0.5f	/* mic peak over reference peak for double talk */
+#define AEC_DT_HOLD		8	/* blocks adaptation stays off after double talk */
+#define AEC_DIVERGE_BLOCKS	8
+
+METRIC_COUNTER_DEFINE(m_blocks, "xiuxiu_aec_blocks_total",
+		"Capture blocks run through the echo canceller with playback reference");
+METRIC_COUNTER_DEFINE(m_resets, "xiuxiu_aec_resets_total",
+		"Echo canceller filters cleared after diverging");
+METRIC_GAUGE_DEFINE(m_erle, "xiuxiu_aec_erle_db",
+		"Smoothed echo return loss enhancement while playing, in dB");
+METRIC_HISTOGRAM_DEFINE(m_block_time, "xiuxiu_aec_block_seconds",
+		"Time to cancel echo from one capture block", metric_buckets_fast);
+
+#if defined(__SSE2__)
+/* y += x * w */
+static void cmac(float *yr, float *yi, const float *xr, const float *xi,
+		const float *wr, const float *wi, unsigned int n)
+{
+	__m128 a, b, c, d;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a = _mm_loadu_ps(xr + i);
+		b = _mm_loadu_ps(xi + i);
+		c = _mm_loadu_ps(wr + i);
+		d = _mm_loadu_ps(wi + i);
+		_mm_storeu_ps(yr + i, _mm_add_ps(_mm_loadu_ps(yr + i),
+				_mm_sub_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, d))));
+		_mm_storeu_ps(yi + i, _mm_add_ps(_mm_loadu_ps(yi + i),
+				_mm_add_ps(_mm_mul_ps(a, d), _mm_mul_ps(b, c))));
+	}
+	for (; i < n; i++) {
+		yr[i] += xr[i] * wr[i] - xi[i] * wi[i];
+		yi[i] += xr[i] * wi[i] + xi[i] * wr[i];
+	}
+}
+
+/* w += conj(x) * g */
+static void cmac_conj(float *wr, float *wi, const float *xr, const float *xi,
+		const float *gr, const float *gi, unsigned int n)
+{
+	__m128 a, b, c, d;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a = _mm_loadu_ps(xr + i);
+		b = _mm_loadu_ps(xi + i);
+		c = _mm_loadu_ps(gr + i);
+		d = _mm_loadu_ps(gi + i);
+		_mm_storeu_ps(wr + i, _mm_add_ps(_mm_loadu_ps(wr + i),
+				_mm_add_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, d))));
+		_mm_storeu_ps(wi + i, _mm_add_ps(_mm_loadu_ps(wi + i),
+				_mm_sub_ps(_mm_mul_ps(a, d), _mm_mul_ps(b, c))));
+	}
+	for (; i < n; i++) {
+		wr[i] += xr[i] * gr[i] + xi[i] * gi[i];
+		wi[i] += xr[i] * gi[i] - xi[i] * gr[i];
+	}
+}
+#elif defined(AEC_NEON)
+static void cmac(float *yr, float *yi, const float *xr, const float *xi,
+		const float *wr, const float *wi, unsigned int n)
+{
+	float32x4_t a, b, c, d;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a = vld1q_f32(xr + i);
+		b = vld1q_f32(xi + i);
+		c = vld1q_f32(wr + i);
+		d = vld1q_f32(wi + i);
+		vst1q_f32(yr + i, vmlsq_f32(vmlaq_f32(vld1q_f32(yr + i), a, c), b, d));
+		vst1q_f32(yi + i, vmlaq_f32(vmlaq_f32(vld1q_f32(yi + i), a, d), b, c));
+	}
+	for (; i < n; i++) {
+		yr[i] += xr[i] * wr[i] - xi[i] * wi[i];
+		yi[i] += xr[i] * wi[i] + xi[i] * wr[i];
+	}
+}
+
+static void cmac_conj(float *wr, float *wi, const float *xr, const float *xi,
+		const float *gr, const float *gi, unsigned int n)
+{
+	float32x4_t a, b, c, d;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a = vld1q_f32(xr + i);
+		b = vld1q_f32(xi + i);
+		c = vld1q_f32(gr + i);
+		d = vld1q_f32(gi + i);
+		vst1q_f32(wr + i, vmlaq_f32(vmlaq_f32(vld1q_f32(wr + i), a, c), b, d));
+		vst1q_f32(wi + i, vmlsq_f32(vmlaq_f32(vld1q_f32(wi + i), a, d), b, c));
+	}
+	for (; i < n; i++) {
+		wr[i] += xr[i] * gr[i] + xi[i] * gi[i];
+		wi[i] += xr[i] * gi[i] - xi[i] * gr[i];
+	}
+}
+#else
+static void cmac(float *yr, float *yi, const float *xr, const float *xi,
+		const float *wr, const float *wi, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		yr[i] += xr[i] * wr[i] - xi[i] * wi[i];
+		yi[i] += xr[i] * wi[i] + xi[i] * wr[i];
+	}
+}
+
+static void cmac_conj(float *wr, float *wi, const float *xr, const float *xi,
+		const float *gr, const float *gi, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		wr[i] += xr[i] * gr[i] + xi[i] * gi[i];
+		wi[i] += xr[i] * gi[i] - xi[i] * gr[i];
+	}
+}
+#endif
+
+/* in-place radix-2 complex FFT of AEC_FFT points, the inverse scaled */
+static void fft(struct aec *a, float *re, float *im, int inverse)
+{
+	unsigned int i, j, k, l, len, half, step;
+	float wr, wi, tr, ti;
+
+	for (i = 0; i < AEC_FFT; i++) {
+		j = a->rev[i];
+		if (j > i) {
+			tr = re[i]; re[i] = re[j]; re[j] = tr;
+			ti = im[i]; im[i] = im[j]; im[j] = ti;
+		}
+	}
+	for (len = 2; len <= AEC_FFT; len <<= 1) {
+		half = len / 2;
+		step = AEC_FFT / len;
+		for (i = 0; i < AEC_FFT; i += len) {
+			for (j = 0; j < half; j++) {
+				wr = a->cos_t[j * step];
+				wi = inverse ? a->sin_t[j * step] : -a->sin_t[j * step];
+				k = i + j;
+				l = k + half;
+				tr = re[l] * wr - im[l] * wi;
+				ti = re[l] * wi + im[l] * wr;
+				re[l] = re[k] - tr;
+				im[l] = im[k] - ti;
+				re[k] += tr;
+				im[k] += ti;
+			}
+		}
+	}
+	if (inverse)
+		for (i = 0; i < AEC_FFT; i++)
+			re[i] *= 1.0f / AEC_FFT;
+}
+
+/* real time signal in a->re to its AEC_BINS half spectrum */
+static void fft_real(struct aec *a, float *bins_re, float *bins_im)
+{
+	memset(a->im, 0, sizeof(a->im));
+	fft(a, a->re, a->im, 0);
+	memcpy(bins_re, a->re, AEC_BINS * sizeof(float));
+	memcpy(bins_im, a->im, AEC_BINS * sizeof(float));
+}
+
+/* half spectrum back to the real signal in a->re */
+static void ifft_real(struct aec *a, const float *bins_re, const float *bins_im)
+{
+	unsigned int k;
+
+	memcpy(a->re, bins_re, AEC_BINS * sizeof(float));
+	memcpy(a->im, bins_im, AEC_BINS * sizeof(float));
+	for (k = AEC_BINS; k < AEC_FFT; k++) {
+		a->re[k] = bins_re[AEC_FFT - k];
+		a->im[k] = -bins_im[AEC_FFT - k];
+	}
+	fft(a, a->re, a->im, 1);
+}
+
+int aec_init(struct aec *a)
+{
+	const char *env = getenv("XIUXIU_AEC_TAIL_MS");
+	unsigned int tail = env && atoi(env) > 0 ? atoi(env) : AEC_TAIL_MS;
+	unsigned int i, j, bits;
+	size_t size;
+
+	memset(a, 0, sizeof(*a));
+	a->parts = (tail * (ECHO_REF_RATE / 1000) + AEC_BLOCK - 1) / AEC_BLOCK;
+	size = (size_t)a->parts * AEC_BINS * sizeof(float);
+	a->w_re = (float *)calloc(1, size);
+	a->w_im = (float *)calloc(1, size);
+	a->x_re = (float *)calloc(1, size);
+	a->x_im = (float *)calloc(1, size);
+	if (!a->w_re || !a->w_im || !a->x_re || !a->x_im) {
+		aec_free(a);
+		return -1;
+	}
+
+	for (i = 0; i < AEC_FFT / 2; i++) {
+		a->cos_t[i] = (float)cos(2 * M_PI * i / AEC_FFT);
+		a->sin_t[i] = (float)sin(2 * M_PI * i / AEC_FFT);
+	}
+	for (bits = 0; (1u << bits) < AEC_FFT; bits++)
+		;
+	for (i = 0; i < AEC_FFT; i++) {
+		for (j = 0, a->rev[i] = 0; j < bits; j++)
+			a->rev[i] |= ((i >> j) & 1) << (bits - 1 - j);
+	}
+	a->idle_blocks = a->parts + 1;
+	dbg("aec: %u partitions, %u ms tail\n", a->parts,
+			a->parts * AEC_BLOCK * 1000 / ECHO_REF_RATE);
+	return 0;
+}
+
+void aec_free(struct aec *a)
+{
+	free(a->w_re);
+	free(a->w_im);
+	free(a->x_re);
+	free(a->x_im);
+	a->w_re = a->w_im = a->x_re = a->x_im = NULL;
+}
+
+static void clear_filter(struct aec *a)
+{
+	size_t size = (size_t)a->parts * AEC_BINS * sizeof(float);
+
+	memset(a->w_re, 0, size);
+	memset(a->w_im, 0, size);
+	a->diverging = 0;
+}
+
+void aec_reset(struct aec *a)
+{
+	size_t size = (size_t)a->parts * AEC_BINS * sizeof(float);
+
+	clear_filter(a);
+	memset(a->x_re, 0, size);
+	memset(a->x_im, 0, size);
+	memset(a->pxx, 0, sizeof(a->pxx));
+	memset(a->ref_prev, 0, sizeof(a->ref_prev));
+	a->ref_peak = 0;
+	a->dt_hold = 0;
+	a->idle_blocks = a->parts + 1;
+	a->pend_len = 0;
+	a->mic_idx = 0;
+	a->erle_db = 0;
+}
+
+/* one block of microphone d against the reference at ring index idx */
+static void process_block(struct aec *a, const int16_t *d, uint64_t idx, int16_t *out)
+{
+	int16_t ref[AEC_BLOCK];
+	float y_re[AEC_BINS], y_im[AEC_BINS], g_re[AEC_BINS], g_im[AEC_BINS];
+	float e[AEC_BLOCK], *xr, *xi, mu, norm, ed = 0, ee = 0, v;
+	int mic_peak = 0, ref_peak = 0;
+	unsigned int i, p, xp;
+	uint64_t t0;
+
+	if (!echo_ref_read(idx, AEC_BLOCK, ref)) {
+		/* the echo of what was played last has died away */
+		if (++a->idle_blocks > a->parts) {
+			memcpy(out, d, AEC_BLOCK * sizeof(int16_t));
+			return;
+		}
+	} else {
+		a->idle_blocks = 0;
+	}
+	t0 = metrics_now_us();
+	metric_inc(&m_blocks);
+
+	/* newest reference spectrum over the last two blocks */
+	for (i = 0; i < AEC_BLOCK; i++) {
+		a->re[i] = a->ref_prev[i];
+		a->re[AEC_BLOCK + i] = a->ref_prev[i] = ref[i];
+		if (abs(ref[i]) > ref_peak)
+			ref_peak = abs(ref[i]);
+	}
+	a->x_head = (a->x_head + a->parts - 1) % a->parts;
+	xr = a->x_re + a->x_head * AEC_BINS;
+	xi = a->x_im + a->x_head * AEC_BINS;
+	fft_real(a, xr, xi);
+	for (i = 0; i < AEC_BINS; i++)
+		a->pxx[i] += AEC_PXX_SMOOTH * (xr[i] * xr[i] + xi[i] * xi[i] - a->pxx[i]);
+
+	/* echo estimate */
+	memset(y_re, 0, sizeof(y_re));
+	memset(y_im, 0, sizeof(y_im));
+	for (p = 0; p < a->parts; p++) {
+		xp = (a->x_head + p) % a->parts;
+		cmac(y_re, y_im, a->x_re + xp * AEC_BINS, a->x_im + xp * AEC_BINS,
+				a->w_re + p * AEC_BINS, a->w_im + p * AEC_BINS, AEC_BINS);
+	}
+	ifft_real(a, y_re, y_im);
+	for (i = 0; i < AEC_BLOCK; i++) {
+		e[i] = d[i] - a->re[AEC_BLOCK + i];
+		ed += (float)d[i] * d[i];
+		ee += e[i] * e[i];
+		if (abs(d[i]) > mic_peak)
+			mic_peak = abs(d[i]);
+		v = e[i];
+		out[i] = v >= 32767.0f ? 32767 : v <= -32768.0f ? -32768 : (int16_t)lrintf(v);
+	}
+
+	/* error spectrum and the normalized step per bin */
+	memset(a->re, 0, AEC_BLOCK * sizeof(float));
+	memcpy(a->re + AEC_BLOCK, e, sizeof(e));
+	fft_real(a, g_re, g_im);
+	/* Geigel: near-end talk when the mic outshouts the recent reference */
+	a->ref_peak = a->ref_peak * AEC_REF_PEAK_DECAY > ref_peak
+		? a->ref_peak * AEC_REF_PEAK_DECAY : ref_peak;
+	if (mic_peak > AEC_GEIGEL * a->ref_peak)
+		a->dt_hold = AEC_DT_HOLD;
+	mu = a->dt_hold ? 0 : AEC_MU;
+	if (a->dt_hold)
+		a->dt_hold--;
+	for (i = 0; i < AEC_BINS; i++) {
+		norm = mu / (a->parts * a->pxx[i] + AEC_POWER_FLOOR);
+		g_re[i] *= norm;
+		g_im[i] *= norm;
+	}
+	for (p = 0; p < a->parts; p++) {
+		xp = (a->x_head + p) % a->parts;
+		cmac_conj(a->w_re + p * AEC_BINS, a->w_im + p * AEC_BINS,
+				a->x_re + xp * AEC_BINS, a->x_im + xp * AEC_BINS,
+				g_re, g_im, AEC_BINS);
+	}
+
+	/* keep one partition a time a linear, not circular, convolution */
+	p = a->constrain++ % a->parts;
+	ifft_real(a, a->w_re + p * AEC_BINS, a->w_im + p * AEC_BINS);
+	memset(a->re + AEC_BLOCK, 0, AEC_BLOCK * sizeof(float));
+	fft_real(a, a->w_re + p * AEC_BINS, a->w_im + p * AEC_BINS);
+
+	if (ed > AEC_POWER_FLOOR && ee > 4 * ed) {
+		if (++a->diverging > AEC_DIVERGE_BLOCKS) {
+			metric_inc(&m_resets);
+			dbg("aec: filter diverged, cleared\n");
+			clear_filter(a);
+		}
+	} else {
+		a->diverging = 0;
+	}
+	if (ed > AEC_POWER_FLOOR && ref_peak) {
+		a->erle_db += 0.05f * (10.0f * log10f(ed / (ee + 1.0f)) - a->erle_db);
+		metric_set(&m_erle, (int64_t)a->erle_db);
+	}
+	metric_observe_us(&m_block_time, metrics_now_us() - t0);
+}
+
+unsigned long aec_process(struct aec *a, const int16_t *in, unsigned long n,
+		uint64_t capture_us, int16_t *out)
+{
+	uint64_t idx = echo_ref_index(capture_us);
+	int64_t drift = (int64_t)(idx - (a->mic_idx + a->pend_len));
+	unsigned long take, count = 0;
+	uint64_t predelay = AEC_PREDELAY_MS * (ECHO_REF_RATE / 1000);
+
+	/* follow the capture clock, but keep blocks contiguous */
+	if (!a->mic_idx || drift < -ECHO_REF_SLACK || drift > ECHO_REF_SLACK)
+		a->mic_idx = idx - a->pend_len;
+
+	while (n) {
+		take = AEC_BLOCK - a->pend_len;
+		if (take > n)
+			take = n;
+		memcpy(a->pend + a->pend_len, in, take * sizeof(int16_t));
+		a->pend_len += take;
+		in += take;
+		n -= take;
+		if (a->pend_len < AEC_BLOCK)
+			break;
+		process_block(a, a->pend, a->mic_idx + predelay, out + count);
+		count += AEC_BLOCK;
+		a->mic_idx += AEC_BLOCK;
+		a->pend_len = 0;
+	}
+	return count;
+}
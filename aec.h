@@ -0,0 +1,79 @@
+/*
+ * @file
+ * @brief frequency-domain acoustic echo canceller for the capture path
+ *
+ * Removes our own playback from the microphone signal before the wake
+ * and recognition engines see it. The echo path is modelled by a
+ * partitioned-block frequency-domain adaptive filter (overlap-save,
+ * AEC_BLOCK samples per block, NLMS step normalized per bin) fed with
+ * the playback reference of echo_ref.h. The reference is read by the
+ * capture time of each block plus AEC_PREDELAY_MS, so the echo path
+ * stays causal despite small timestamp errors, and the filter spans
+ * $XIUXIU_AEC_TAIL_MS (default 128) of echo back from there. Playback
+ * publishes a buffer ahead of the speaker, so that reference exists.
+ *
+ * Adaptation pauses while the microphone is louder than the reference
+ * could explain (Geigel double-talk detection) and the filter is
+ * cleared if it diverges. With nothing played for a whole tail the stage is a copy.
+ *
+ * 16 kHz 16 bit mono only. The spectral loops use SSE or NEON when the
+ * compiler targets them and plain C otherwise.
+ */
+
+#ifndef AEC_H
+#define AEC_H
+
+#include <stdint.h>
+
+#define AEC_BLOCK		128
+#define AEC_FFT			(2 * AEC_BLOCK)
+#define AEC_BINS		(AEC_BLOCK + 1)
+#define AEC_PREDELAY_MS		8
+
+struct aec {
+	unsigned int parts;		/* filter partitions of AEC_BLOCK */
+	float *w_re, *w_im;		/* parts x AEC_BINS filter */
+	float *x_re, *x_im;		/* parts x AEC_BINS reference spectra, a ring */
+	unsigned int x_head;
+	float pxx[AEC_BINS];		/* smoothed reference power per bin */
+	float ref_prev[AEC_BLOCK];	/* previous reference block, overlap-save */
+	float ref_peak;			/* decaying reference peak, for double talk */
+	unsigned int dt_hold;		/* blocks left with adaptation paused */
+	unsigned int idle_blocks;	/* consecutive blocks with silent reference */
+	unsigned int constrain;		/* partition to constrain next */
+	unsigned int diverging;
+
+	/* fft tables and scratch */
+	float cos_t[AEC_FFT / 2], sin_t[AEC_FFT / 2];
+	unsigned short rev[AEC_FFT];
+	float re[AEC_FFT], im[AEC_FFT];
+
+	/* microphone samples waiting for a whole block */
+	int16_t pend[AEC_BLOCK];
+	unsigned int pend_len;
+	uint64_t mic_idx;		/* ring index of pend[0], 0: not anchored */
+	float erle_db;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returns 0, or -1 if out of memory */
+int aec_init(struct aec *a);
+void aec_free(struct aec *a);
+/* forget the filter and the stream position */
+void aec_reset(struct aec *a);
+
+/* cancel echo from n microphone samples whose first was captured at
+ * capture_us (CLOCK_MONOTONIC). Audio is processed in whole blocks, so
+ * out, which needs room for n + AEC_BLOCK samples, receives from
+ * n - AEC_BLOCK + 1 to n + AEC_BLOCK - 1 of them; returns the count. */
+unsigned long aec_process(struct aec *a, const int16_t *in, unsigned long n,
+		uint64_t capture_us, int16_t *out);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
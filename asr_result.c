@@ -0,0 +1,163 @@
+/*
+ * @file
+ * @brief N-best grammar recognition results
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include "asr_result.h"
+
+static int is_element(const xmlNode *node, const char *name)
+{
+	return node->type == XML_ELEMENT_NODE
+		&& strcmp((const char *)node->name, name) == 0;
+}
+
+static const char *text_of(const xmlNode *node)
+{
+	if (node->children && node->children->type == XML_TEXT_NODE
+			&& node->children->content)
+		return (const char *)node->children->content;
+	return "";
+}
+
+static void copy(char *dst, const char *src)
+{
+	snprintf(dst, ASR_SLOT_LEN, "%s", src);
+}
+
+/* the index of name in the '|' separated focus list, -1 if absent */
+static int focus_index(const char *focus, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = focus;
+	int i = 0;
+
+	while (*p) {
+		if (strncmp(p, name, len) == 0 && (p[len] == '|' || p[len] == '\0'))
+			return i;
+		p = strchr(p, '|');
+		if (!p)
+			break;
+		p++;
+		i++;
+	}
+	return -1;
+}
+
+/* the i-th '|' separated number of list, -1 if absent */
+static int list_at(const char *list, int i)
+{
+	const char *p = list;
+
+	while (i-- > 0 && p) {
+		p = strchr(p, '|');
+		if (p)
+			p++;
+	}
+	return p && *p >= '0' && *p <= '9' ? atoi(p) : -1;
+}
+
+/* returns 1 if c->confidence is the mean of the slot scores */
+static int parse_candidate(const xmlNode *result, struct asr_candidate *c,
+		int fallback)
+{
+	const char *focus = "", *scores = "";
+	const xmlNode *node, *obj = NULL;
+	struct asr_slot *s;
+	int sum = 0, scored = 0;
+
+	memset(c, 0, sizeof(*c));
+	for (node = result->children; node; node = node->next) {
+		if (is_element(node, "focus"))
+			focus = text_of(node);
+		else if (is_element(node, "confidence"))
+			scores = text_of(node);
+		else if (is_element(node, "object"))
+			obj = node;
+	}
+	for (node = obj ? obj->children : NULL;
+			node && c->nslots < ASR_MAX_SLOTS; node = node->next) {
+		if (node->type != XML_ELEMENT_NODE)
+			continue;
+		s = &c->slot[c->nslots++];
+		copy(s->name, (const char *)node->name);
+		copy(s->value, text_of(node));
+		s->confidence = list_at(scores, focus_index(focus, s->name));
+		if (s->confidence >= 0) {
+			sum += s->confidence;
+			scored++;
+		}
+	}
+	/* a single score for the whole candidate */
+	if (!scored && list_at(scores, 0) >= 0 && !strchr(scores, '|')) {
+		c->confidence = list_at(scores, 0);
+		return 0;
+	}
+	c->confidence = scored ? sum / scored : fallback;
+	return scored > 0;
+}
+
+int asr_result_parse(const char *xml, struct asr_result *r)
+{
+	xmlDocPtr doc;
+	xmlNode *root, *node;
+	int means[ASR_NBEST_MAX];
+	unsigned int i;
+
+	memset(r, 0, sizeof(*r));
+	r->confidence = -1;
+	if (!xml || !*xml)
+		return -1;
+	doc = xmlReadMemory(xml, strlen(xml), "result.xml", NULL,
+			XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+	if (!doc)
+		return -1;
+	root = xmlDocGetRootElement(doc);
+	if (!root) {
+		xmlFreeDoc(doc);
+		return -1;
+	}
+
+	for (node = root->children; node; node = node->next)
+		if (is_element(node, "confidence"))
+			r->confidence = list_at(text_of(node), 0);
+	for (node = root->children; node && r->count < ASR_NBEST_MAX;
+			node = node->next) {
+		if (!is_element(node, "result"))
+			continue;
+		means[r->count] = parse_candidate(node, &r->c[r->count], r->confidence);
+		if (r->c[r->count].nslots)
+			r->count++;
+	}
+	xmlFreeDoc(doc);
+
+	/* slot means run higher than the top level score the thresholds
+	 * are set on: put them on that scale, the best candidate at it
+	 * and the others in proportion */
+	if (r->count && means[0] && r->confidence >= 0 && r->c[0].confidence > 0) {
+		for (i = 1; i < r->count; i++) {
+			if (!means[i])
+				continue;
+			r->c[i].confidence = r->c[i].confidence * r->confidence
+				/ r->c[0].confidence;
+			if (r->c[i].confidence > 100)
+				r->c[i].confidence = 100;
+		}
+		r->c[0].confidence = r->confidence;
+	}
+	return r->count ? 0 : -2;
+}
+
+const char *asr_slot_value(const struct asr_candidate *c, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < c->nslots; i++)
+		if (strcmp(c->slot[i].name, name) == 0)
+			return c->slot[i].value;
+	return NULL;
+}
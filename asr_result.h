@@ -0,0 +1,69 @@
+/*
+ * @file
+ * @brief N-best grammar recognition results
+ *
+ * With result_type = xml and asr_nbest > 1 the local grammar engine
+ * answers with one <result> per candidate, best first:
+ *
+ *	<nlp>
+ *	  <rawtext>我想知道温度是多少</rawtext>
+ *	  <confidence>18</confidence>
+ *	  <result>
+ *	    <focus>want|dopre|something|value</focus>
+ *	    <confidence>40|12|31|20</confidence>
+ *	    <object>
+ *	      <want id="65535">我想</want>
+ *	      ...
+ *	    </object>
+ *	  </result>
+ *	  <result>...</result>
+ *	</nlp>
+ *
+ * asr_result_parse keeps every candidate with its slots. A slot's
+ * confidence is the <focus> entry of the same name. A candidate's
+ * confidence is on the scale of the top level <confidence>, which is
+ * what the thresholds in intent.h are set against: the best candidate
+ * gets the top level score (18 above), the others their mean slot
+ * score scaled by the same ratio. A candidate with a single score of
+ * its own keeps it; with no top level score the slot mean is used.
+ */
+
+#ifndef ASR_RESULT_H
+#define ASR_RESULT_H
+
+#define ASR_NBEST_MAX		5	/* candidates kept */
+#define ASR_MAX_SLOTS		8	/* slots kept per candidate */
+#define ASR_SLOT_LEN		64	/* bytes of a slot name or value */
+
+struct asr_slot {
+	char name[ASR_SLOT_LEN];
+	char value[ASR_SLOT_LEN];
+	int confidence;		/* -1 if not given */
+};
+
+struct asr_candidate {
+	struct asr_slot slot[ASR_MAX_SLOTS];
+	unsigned int nslots;
+	int confidence;
+};
+
+struct asr_result {
+	struct asr_candidate c[ASR_NBEST_MAX];
+	unsigned int count;
+	int confidence;		/* top level, -1 if not given */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returns 0, -1 if xml is not a result, or -2 if it has no candidate */
+int asr_result_parse(const char *xml, struct asr_result *r);
+/* the value of slot name in c, NULL if it has none */
+const char *asr_slot_value(const struct asr_candidate *c, const char *name);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -8,14 +8,21 @@
 #include "linuxrec.h"
 #include "formats.h"
 #include "awaken.h"
+#include "trace.h"
+#include "metrics.h"
+#include "xlog.h"
 
 #define AK_DBGON 1
 #if AK_DBGON == 1
-#define dbg printf
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
 #else
 #define dbg
 #endif
 
+/* long enough for the "xiu" fricative that opens the wake word */
+#define AK_GATE_PREROLL_MS  300
+#define AK_GATE_HANGOVER_MS 500
+
 #define DEFAULT_FORMAT		\
 {\
 	WAVE_FORMAT_PCM,	\
@@ -33,28 +40,124 @@ enum{
 };
 extern int g_status;
 
+METRIC_HISTOGRAM_DEFINE(m_ivw_write, "xiuxiu_ivw_audio_write_seconds",
+        "Time spent in QIVWAudioWrite per forwarded chunk", metric_buckets_fast);
+METRIC_COUNTER_DEFINE(m_ivw_restarts, "xiuxiu_ivw_session_restarts_total",
+        "Persistent wake-word sessions restarted after an error");
+
+#define AK_RESTART_INTERVAL_US  1000000
+
 static void Sleep(size_t ms)
 {
 	usleep(ms*1000);
 }
 
 
-static void iat_cb(char* data, unsigned long len, void *user_para){
+static void ivw_write(const char* data, unsigned long len, void *user_para){
 
     int ret;
     awaken_rec *ar = (awaken_rec*)user_para;
 	char sse_hints[128];
+    uint64_t t0 = metrics_now_us();
+
+    if(ar->persistent && ar->restart)
+        return;
 
     ret = QIVWAudioWrite(ar->session_id, data, len, ar->audio_status);
+    metric_observe_us(&m_ivw_write, metrics_now_us() - t0);
     if(MSP_SUCCESS != ret){
         dbg("QIVWAudioWrite failed:%d.\n", ret);
         snprintf(sse_hints, sizeof(sse_hints), "QIVWAudioWrite errorCode=%d", ret);
         QIVWSessionEnd(ar->session_id, sse_hints);
+        if(ar->persistent){
+            ar->session_id = NULL;
+            ar->restart = 1;
+        }
         return;
     }
     ar->audio_status = MSP_AUDIO_SAMPLE_CONTINUE;
 }
 
+/* sits between the engine and ak_callback to notice dead sessions */
+static int ivw_notify(const char *sessionID, int msg, int param1, int param2,
+        const void *info, void *userData){
+
+    awaken_rec *ar = (awaken_rec*)userData;
+
+    if(MSP_IVW_MSG_ERROR == msg && ar->persistent)
+        ar->restart = 1;
+    return ar->ak_callback(sessionID, msg, param1, param2, info, userData);
+}
+
+static int ivw_session_begin(awaken_rec *ar){
+
+    const char* session_id;
+    int err_code = MSP_SUCCESS;
+
+    session_id = QIVWSessionBegin(NULL, ar->session_begin_params, &err_code);
+    if(MSP_SUCCESS != err_code){
+        dbg("QIVWSessionBegin failed! error code:%d\n", err_code);
+        return err_code;
+    }
+
+    err_code = QIVWRegisterNotify(session_id, ivw_notify, ar);
+	if (err_code != MSP_SUCCESS)
+	{
+		dbg("QIVWRegisterNotify failed! error code:%d\n",err_code);
+        QIVWSessionEnd(session_id, "QIVWRegisterNotify failed");
+        return -1;
+	}
+
+    ar->audio_status = MSP_AUDIO_SAMPLE_FIRST;
+    ar->session_id = session_id;
+    vad_gate_reset(&ar->gate);
+    return 0;
+}
+
+/* runs on the capture thread, at most once a second while failing */
+static void ivw_session_restart(awaken_rec *ar){
+
+    uint64_t now = metrics_now_us();
+
+    if(now - ar->restart_us < AK_RESTART_INTERVAL_US)
+        return;
+    ar->restart_us = now;
+
+    if(ar->session_id){
+        QIVWSessionEnd(ar->session_id, "restart");
+        ar->session_id = NULL;
+    }
+    if(ivw_session_begin(ar) != 0)
+        return;
+    ar->restart = 0;
+    metric_inc(&m_ivw_restarts);
+    xlog(XLOG_WARN, "wake-word session restarted\n");
+}
+
+static void iat_cb(char* data, unsigned long len, void *user_para){
+
+    awaken_rec *ar = (awaken_rec*)user_para;
+
+    pthread_mutex_lock(&ar->route_lock);
+    if(ar->route){
+        ar->route(data, len, ar->route_para);
+        ar->routed = 1;
+        pthread_mutex_unlock(&ar->route_lock);
+        return;
+    }
+    pthread_mutex_unlock(&ar->route_lock);
+
+    /* don't replay pre-roll from before the recognizer took over */
+    if(ar->routed){
+        ar->routed = 0;
+        vad_gate_reset(&ar->gate);
+    }
+    if(ar->restart)
+        ivw_session_restart(ar);
+
+    vad_gate_process(&ar->gate, data, len, ivw_write, ar);
+}
+
 int ak_init(awaken_rec *ar, const char *session_begin_params
                 , Ak_callback ak_callback){
 
@@ -81,6 +184,13 @@ int ak_init(awaken_rec *ar, const char *session_begin_params
 	}
 	strncpy(ar->session_begin_params, session_begin_params, param_size);
     ar->ak_callback = ak_callback;
+    pthread_mutex_init(&ar->route_lock, NULL);
+
+    if (vad_gate_init(&ar->gate, 16000, AK_GATE_PREROLL_MS, AK_GATE_HANGOVER_MS) != 0) {
+        dbg("vad gate init failed\n");
+        errcode = -E_SR_NOMEM;
+        goto fail;
+    }
 
     errcode = create_recorder(&ar->recorder, iat_cb, (void*)ar);
     if (ar->recorder == NULL || errcode != 0) {
@@ -100,6 +210,7 @@ fail:
 		destroy_recorder(ar->recorder);
 		ar->recorder = NULL;
 	}
+	vad_gate_free(&ar->gate);
 
 	if (ar->session_begin_params) {
 		free(ar->session_begin_params);
@@ -109,6 +220,11 @@ fail:
 	return errcode;
 }
 
+void ak_set_persistent(awaken_rec *ar, int on){
+
+    ar->persistent = on;
+}
+
 int ak_starting_listening(awaken_rec *ar){
 
     const char* session_id;
@@ -122,22 +238,11 @@ int ak_starting_listening(awaken_rec *ar){
         return -E_SR_ALREADY;
     }
 
-    session_id = QIVWSessionBegin(NULL, ar->session_begin_params, &err_code);
-    if(MSP_SUCCESS != err_code){
-        dbg("QIVWSessionBegin failed! error code:%d\n", err_code);
+    err_code = ivw_session_begin(ar);
+    if(err_code != 0)
         return err_code;
-    }
-
-    err_code = QIVWRegisterNotify(session_id, ar->ak_callback, ar);
-	if (err_code != MSP_SUCCESS)
-	{
-		dbg("QIVWRegisterNotify failed! error code:%d\n",err_code);
-        QIVWSessionEnd(session_id, "QIVWRegisterNotify failed");
-        return -1;
-	}
-
-    ar->audio_status = MSP_AUDIO_SAMPLE_FIRST;
-    ar->session_id = session_id;
+    session_id = ar->session_id;
+    ar->restart = 0;
 
     errcode = open_recorder(ar->recorder, get_default_input_dev(), &wavfmt);
     if (errcode != 0) {
@@ -158,6 +263,14 @@ int ak_starting_listening(awaken_rec *ar){
     return 0;
 }
 
+void ak_route(awaken_rec *ar, Ak_route route, void *user_para){
+
+    pthread_mutex_lock(&ar->route_lock);
+    ar->route = route;
+    ar->route_para = user_para;
+    pthread_mutex_unlock(&ar->route_lock);
+}
+
 /* after stop_record, there are still some data callbacks */
 static void wait_for_rec_stop(struct recorder *rec, unsigned int timeout_ms)
 {
@@ -173,6 +286,7 @@ int ak_stop_listening(awaken_rec *ar){
 
     int ret;
 	char sse_hints[128];
+    TRACE_SPAN_BEGIN(ts);
 
     if(ar->state < AK_STATE_STARTED){
         dbg("Not started or already stopped.\n");
@@ -184,9 +298,18 @@ int ak_stop_listening(awaken_rec *ar){
         dbg("Stop failed!\n");
         return -E_SR_RECORDFAIL;
     }
-    wait_for_rec_stop(ar->recorder, -1);
+    {
+        TRACE_SPAN_BEGIN(wait_ts);
+        wait_for_rec_stop(ar->recorder, -1);
+        TRACE_SPAN_END(wait_ts, "wait_for_rec_stop");
+    }
     close_recorder(ar->recorder);
     ar->state = AK_STATE_INIT;
+    dbg("vad gate: %.1f%% of audio kept from the wake engine\n",
+            vad_gate_gated_fraction(&ar->gate) * 100);
+    ar->restart = 0;
+    if(!ar->session_id)     /* failed and not restarted yet */
+        return 0;
     ret = QIVWAudioWrite(ar->session_id, NULL, 0, MSP_AUDIO_SAMPLE_LAST);
     if(MSP_SUCCESS != ret){
         dbg("QIVWAudioWrite failed:%d.\n", ret);
@@ -196,6 +319,7 @@ int ak_stop_listening(awaken_rec *ar){
     }
     QIVWSessionEnd(ar->session_id, "sucess");
     ar->session_id = NULL;
+    TRACE_SPAN_END(ts, "ak_stop");
     return 0;
 }
 
@@ -207,6 +331,8 @@ void ak_uninit(awaken_rec *ar)
 		destroy_recorder(ar->recorder);
 		ar->recorder = NULL;
 	}
+	vad_gate_free(&ar->gate);
+	pthread_mutex_destroy(&ar->route_lock);
 
 	if (ar->session_begin_params) {
 		free(ar->session_begin_params);
@@ -2,6 +2,7 @@
 #define AWAKEN_H
 
 #include "linuxrec.h"
+#include "vad_gate.h"
 
 #define E_SR_NOACTIVEDEVICE		1
 #define E_SR_NOMEM				2
@@ -10,6 +11,8 @@
 #define E_SR_ALREADY			5
 
 typedef int (*Ak_callback)(const char *sessionID, int msg, int param1, int param2, const void *info, void *userData);
+/* same shape as the recorder callback */
+typedef void (*Ak_route)(char *data, unsigned long len, void *user_para);
 typedef struct{
     const char *session_id;
     struct recorder *recorder;
@@ -17,10 +20,27 @@ typedef struct{
     int state;
     int audio_status;
     Ak_callback ak_callback;
+    struct vad_gate gate;   /* keeps silence away from QIVWAudioWrite */
+
+    /* persistent mode: session and capture outlive each wake */
+    int persistent;
+    volatile int restart;   /* session failed, begin a new one */
+    uint64_t restart_us;
+    pthread_mutex_t route_lock;
+    Ak_route route;         /* while set, audio goes here instead of IVW */
+    void *route_para;
+    int routed;
 }awaken_rec;
 
 int ak_init(awaken_rec *ar, const char *session_begin_params,Ak_callback ak_callback);
+/* keep the IVW session and recorder running across wakes; call before
+ * ak_starting_listening and then use ak_route instead of ak_stop_listening */
+void ak_set_persistent(awaken_rec *ar, int on);
 int ak_starting_listening(awaken_rec *ar);
+/* send captured audio to route (e.g. a recognizer) instead of the wake
+ * engine, NULL to go back to wake detection. No route callback is running
+ * once this returns. */
+void ak_route(awaken_rec *ar, Ak_route route, void *user_para);
 int ak_stop_listening(awaken_rec *ar);
 void ak_uninit(awaken_rec *ar);
 #endif
@@ -0,0 +1,81 @@
+/*
+ * @file
+ * @brief barge-in: let the user talk over our prompts
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "barge_in.h"
+#include "sound_playback.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define BARGE_DBGON 1
+#if BARGE_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+/* long enough that the gate can't close again within one chunk */
+#define BARGE_IN_HANGOVER_MS	1000
+
+METRIC_COUNTER_DEFINE(m_barge_ins, "xiuxiu_barge_ins_total",
+		"Prompts stopped because the user started speaking over them");
+
+int barge_in_init(struct barge_in *b, barge_in_sink sink, void *sink_para)
+{
+	memset(b, 0, sizeof(*b));
+	if (vad_gate_init(&b->gate, 16000, BARGE_IN_PREROLL_MS,
+				BARGE_IN_HANGOVER_MS) != 0) {
+		vad_gate_free(&b->gate);
+		return -1;
+	}
+	/* $XIUXIU_IVW_GATE is about the wake engine, this gate must gate */
+	b->gate.enabled = 1;
+	vad_gate_set_onset(&b->gate, BARGE_IN_ONSET_MS);
+	b->sink = sink;
+	b->sink_para = sink_para;
+	metric_register(&m_barge_ins);
+	return 0;
+}
+
+void barge_in_free(struct barge_in *b)
+{
+	vad_gate_free(&b->gate);
+}
+
+void barge_in_reset(struct barge_in *b)
+{
+	vad_gate_reset(&b->gate);
+	b->through = 0;
+}
+
+static void on_speech(const char *data, unsigned long len, void *user_para)
+{
+	struct barge_in *b = (struct barge_in *)user_para;
+
+	if (!b->through) {
+		b->through = 1;
+		if (audio_stop() == 0) {
+			metric_inc(&m_barge_ins);
+			dbg("barge-in: prompt stopped\n");
+		}
+	}
+	b->sink((char *)data, len, b->sink_para);
+}
+
+void barge_in_feed(char *data, unsigned long len, void *user_para)
+{
+	struct barge_in *b = (struct barge_in *)user_para;
+
+	if (!b->through) {
+		if (audio_playing()) {
+			vad_gate_process(&b->gate, data, len, on_speech, b);
+			return;
+		}
+		/* the held audio is the prompt's tail, not the user */
+		b->through = 1;
+	}
+	b->sink(data, len, b->sink_para);
+}
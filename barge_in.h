@@ -0,0 +1,52 @@
+/*
+ * @file
+ * @brief barge-in: let the user talk over our prompts
+ *
+ * Sits on the audio route to the recognizer (see ak_route) for one
+ * turn. While a prompt is playing, capture is held in a vad_gate that
+ * needs BARGE_IN_ONSET_MS of consecutive voice to open; the prompt
+ * itself is kept out of it by the echo canceller (aec.h). When the
+ * gate opens the prompt is stopped through audio_stop() and the
+ * recognizer gets the audio from BARGE_IN_PREROLL_MS before the onset
+ * on. If the prompt ends first, audio from then on goes straight
+ * through and the recognizer's own endpointing takes over.
+ *
+ * Without echo cancellation ($XIUXIU_AEC=0) the prompt can interrupt
+ * itself; leave barge-in off there.
+ */
+
+#ifndef BARGE_IN_H
+#define BARGE_IN_H
+
+#include "vad_gate.h"
+
+#define BARGE_IN_ONSET_MS	60
+#define BARGE_IN_PREROLL_MS	300
+
+/* same shape as the recorder callback */
+typedef void (*barge_in_sink)(char *data, unsigned long len, void *user_para);
+
+struct barge_in {
+	struct vad_gate gate;
+	int through;		/* onset seen or prompt over, pass everything */
+	barge_in_sink sink;
+	void *sink_para;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* audio of each turn goes on to sink, e.g. sr_feed_audio; returns 0 or -1 */
+int barge_in_init(struct barge_in *b, barge_in_sink sink, void *sink_para);
+void barge_in_free(struct barge_in *b);
+/* start a turn; call after queueing its prompt */
+void barge_in_reset(struct barge_in *b);
+/* route callback, user_para is the barge_in */
+void barge_in_feed(char *data, unsigned long len, void *user_para);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * @file
+ * @brief xiuxiu-batch: recognize a corpus of recordings in parallel
+ *
+ *	xiuxiu-batch [-j sessions] [-c chunk_ms] [-g grammar.bnf] [-o out.jsonl] manifest
+ *
+ * Every file in the manifest (see corpus.h) is fed to its own QISR
+ * session straight from the mmap'd file, chunk_ms at a time and as fast
+ * as the engine takes it. Up to `sessions` files are in flight at once.
+ * One JSON object per file is written as soon as it finishes:
+ *
+ *	{"index":3,"file":"wav/0003.wav","label":"...","error":0,
+ *	 "result":"<xml>","audio_ms":2300,"wall_ms":180,"final_ms":12}
+ *
+ * wall_ms covers session begin to session end, final_ms the wait for
+ * the final result after the last chunk. Totals go to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "qisr.h"
+#include "msp_cmn.h"
+#include "msp_errors.h"
+#include "grammar.h"
+#include "corpus.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define BATCH_DBGON 1
+#if BATCH_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+#define BATCH_CHUNK_MS		200
+#define BATCH_POLL_US		2000
+#define BATCH_POLL_MAX		5000	/* 10 s for a final result */
+
+struct batch {
+	struct corpus corpus;
+	const char *asr_params;
+	unsigned int chunk_bytes;
+	size_t next;
+	FILE *out;
+	pthread_mutex_t out_lock;
+
+	size_t done;
+	size_t errors;
+	uint64_t audio_ms;
+};
+
+struct batch_result {
+	int error;
+	char *text;
+	size_t len;
+	size_t cap;
+	unsigned long audio_ms;
+	uint64_t wall_us;
+	uint64_t final_us;
+};
+
+static void result_append(struct batch_result *r, const char *s)
+{
+	size_t len = strlen(s);
+	size_t cap;
+	char *p;
+
+	if (r->len + len + 1 > r->cap) {
+		cap = r->cap ? r->cap : 1024;
+		while (cap < r->len + len + 1)
+			cap *= 2;
+		p = (char *)realloc(r->text, cap);
+		if (!p)
+			return;
+		r->text = p;
+		r->cap = cap;
+	}
+	memcpy(r->text + r->len, s, len + 1);
+	r->len += len;
+}
+
+/* feed one mmap'd recording and collect its final result */
+static void recognize(struct batch *b, const struct corpus_audio *a,
+		struct batch_result *r)
+{
+	const char *sid;
+	const char *rslt;
+	int status = MSP_AUDIO_SAMPLE_FIRST;
+	int ep_stat = MSP_EP_LOOKING_FOR_SPEECH;
+	int rec_stat = MSP_REC_STATUS_SUCCESS;
+	int ret = MSP_SUCCESS;
+	size_t off, n;
+	uint64_t t0;
+	int tries;
+
+	sid = QISRSessionBegin(NULL, b->asr_params, &ret);
+	if (ret != MSP_SUCCESS) {
+		r->error = ret;
+		return;
+	}
+
+	for (off = 0; off < a->len; off += n) {
+		n = a->len - off < b->chunk_bytes ? a->len - off : b->chunk_bytes;
+		ret = QISRAudioWrite(sid, a->pcm + off, n, status, &ep_stat, &rec_stat);
+		if (ret != MSP_SUCCESS)
+			goto end;
+		status = MSP_AUDIO_SAMPLE_CONTINUE;
+		if (rec_stat == MSP_REC_STATUS_SUCCESS) {
+			rslt = QISRGetResult(sid, &rec_stat, 0, &ret);
+			if (ret != MSP_SUCCESS)
+				goto end;
+			if (rslt)
+				result_append(r, rslt);
+		}
+		/* the engine ignores audio after the endpoint */
+		if (ep_stat == MSP_EP_AFTER_SPEECH)
+			break;
+	}
+
+	t0 = metrics_now_us();
+	ret = QISRAudioWrite(sid, NULL, 0, MSP_AUDIO_SAMPLE_LAST, &ep_stat, &rec_stat);
+	for (tries = 0; ret == MSP_SUCCESS && rec_stat != MSP_REC_STATUS_COMPLETE
+			&& tries < BATCH_POLL_MAX; tries++) {
+		rslt = QISRGetResult(sid, &rec_stat, 0, &ret);
+		if (rslt)
+			result_append(r, rslt);
+		if (rec_stat != MSP_REC_STATUS_COMPLETE)
+			usleep(BATCH_POLL_US);
+	}
+	r->final_us = metrics_now_us() - t0;
+	if (ret == MSP_SUCCESS && rec_stat != MSP_REC_STATUS_COMPLETE)
+		ret = -ETIMEDOUT;
+end:
+	r->error = ret;
+	QISRSessionEnd(sid, ret == MSP_SUCCESS ? "normal" : "err");
+}
+
+static void write_result(struct batch *b, size_t index, struct batch_result *r)
+{
+	const struct corpus_entry *e = &b->corpus.entries[index];
+
+	pthread_mutex_lock(&b->out_lock);
+	fprintf(b->out, "{\"index\":%lu,\"file\":", (unsigned long)index);
+	json_fputs(e->path, b->out);
+	fputs(",\"label\":", b->out);
+	json_fputs(e->label, b->out);
+	fprintf(b->out, ",\"error\":%d,\"result\":", r->error);
+	json_fputs(r->len ? r->text : "", b->out);
+	fprintf(b->out, ",\"audio_ms\":%lu,\"wall_ms\":%llu,\"final_ms\":%llu}\n",
+			r->audio_ms, (unsigned long long)r->wall_us / 1000,
+			(unsigned long long)r->final_us / 1000);
+	b->done++;
+	b->errors += r->error != 0;
+	b->audio_ms += r->audio_ms;
+	pthread_mutex_unlock(&b->out_lock);
+}
+
+static void *worker_proc(void *arg)
+{
+	struct batch *b = (struct batch *)arg;
+	struct batch_result r;
+	struct corpus_audio a;
+	uint64_t t0;
+	size_t i;
+
+	memset(&r, 0, sizeof(r));
+	while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->corpus.count) {
+		r.error = 0;
+		r.len = 0;
+		r.audio_ms = 0;
+		r.final_us = 0;
+		t0 = metrics_now_us();
+
+		r.error = corpus_audio_open(b->corpus.entries[i].path, &a);
+		if (r.error == 0) {
+			if (a.rate != SAMPLE_RATE_16K || a.channels != 1 || a.bits != 16) {
+				r.error = -EINVAL;
+			} else {
+				r.audio_ms = corpus_audio_ms(&a);
+				recognize(b, &a, &r);
+			}
+			corpus_audio_close(&a);
+		}
+		if (r.error)
+			dbg("%s: error %d\n", b->corpus.entries[i].path, r.error);
+		r.wall_us = metrics_now_us() - t0;
+		write_result(b, i, &r);
+	}
+	free(r.text);
+	return NULL;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: xiuxiu-batch [-j sessions] [-c chunk_ms] "
+			"[-g grammar.bnf] [-o out.jsonl] manifest\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *lgi_param = "appid = 5fc4a959,work_dir = .";
+	char asr_params[MAX_PARAMS_LEN];
+	struct batch b;
+	UserData asr_data;
+	pthread_t *workers;
+	long sessions = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int chunk_ms = BATCH_CHUNK_MS;
+	const char *out_path = NULL;
+	uint64_t t0, wall_us;
+	int i, nworkers, opt, ret;
+
+	while ((opt = getopt(argc, argv, "j:c:g:o:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			sessions = atol(optarg);
+			break;
+		case 'c':
+			chunk_ms = atoi(optarg);
+			break;
+		case 'g':
+			GRM_FILE = optarg;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind != argc - 1 || sessions < 1 || chunk_ms == 0) {
+		usage();
+		return 1;
+	}
+
+	xlog_init();
+	memset(&b, 0, sizeof(b));
+	pthread_mutex_init(&b.out_lock, NULL);
+	b.chunk_bytes = SAMPLE_RATE_16K * 2 / 1000 * chunk_ms;
+	b.out = out_path ? fopen(out_path, "w") : stdout;
+	if (!b.out) {
+		fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+		return 1;
+	}
+	ret = corpus_load(argv[optind], &b.corpus);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+
+	ret = MSPLogin(NULL, NULL, lgi_param);
+	if (MSP_SUCCESS != ret) {
+		fprintf(stderr, "MSPLogin failed, error code: %d.\n", ret);
+		goto exit;
+	}
+	memset(&asr_data, 0, sizeof(UserData));
+	ret = build_grammar_wait(&asr_data);
+	if (MSP_SUCCESS != ret) {
+		fprintf(stderr, "build grammer failed:%d\n", ret);
+		goto logout;
+	}
+	grammar_asr_params(asr_params, sizeof(asr_params), asr_data.grammar_id);
+	b.asr_params = asr_params;
+
+	if ((size_t)sessions > b.corpus.count)
+		sessions = b.corpus.count ? b.corpus.count : 1;
+	workers = (pthread_t *)calloc(sessions, sizeof(pthread_t));
+	if (!workers) {
+		ret = -ENOMEM;
+		goto logout;
+	}
+	t0 = metrics_now_us();
+	for (nworkers = 0; nworkers < sessions; nworkers++)
+		if (pthread_create(&workers[nworkers], NULL, worker_proc, &b) != 0)
+			break;
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	wall_us = metrics_now_us() - t0;
+	free(workers);
+
+	fprintf(stderr, "%lu files, %lu errors, %.2f h audio in %.1f s with %d sessions, "
+			"%.1fx real time\n", (unsigned long)b.done, (unsigned long)b.errors,
+			b.audio_ms / 3600000.0, wall_us / 1e6, nworkers,
+			wall_us ? b.audio_ms * 1000.0 / wall_us : 0.0);
+	ret = b.errors ? 2 : 0;
+
+logout:
+	MSPLogout();
+exit:
+	if (b.out != stdout)
+		fclose(b.out);
+	corpus_free(&b.corpus);
+	return ret;
+}
@@ -0,0 +1,256 @@
+/*
+ * @file
+ * @brief delay-and-sum beamforming of a microphone array to mono
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BEAM_NEON 1
+#endif
+#include "beamformer.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define BEAM_DBGON 1
+#if BEAM_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+#define BEAM_SOUND_MM_PER_S	343000
+#define BEAM_BUDGET_PERCENT	25
+/* mean square on channel 0, full scale is 32768^2 */
+#define BEAM_MIN_ENERGY		10000.0f	/* about -50 dBFS */
+#define BEAM_SPEECH_RATIO	4.0f		/* over the noise floor */
+#define BEAM_MIN_COHERENCE	0.4f		/* normalized correlation peak */
+
+METRIC_GAUGE_DEFINE(m_budget, "xiuxiu_beamformer_budget_used_percent",
+		"Share of its per-chunk CPU budget the beamformer used on the last chunk");
+METRIC_HISTOGRAM_DEFINE(m_process, "xiuxiu_beamformer_process_seconds",
+		"Time to beamform one capture chunk", metric_buckets_fast);
+METRIC_COUNTER_DEFINE(m_skipped, "xiuxiu_beamformer_estimates_skipped_total",
+		"Chunks that kept the previous direction to stay within the CPU budget");
+
+#if defined(__SSE2__)
+static float dot_f32(const float *a, const float *b, unsigned long n)
+{
+	__m128 acc = _mm_setzero_ps();
+	float lanes[4];
+	unsigned long i;
+	float sum;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	_mm_storeu_ps(lanes, acc);
+	sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+static void add_f32(float *acc, const float *x, unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_loadu_ps(x + i)));
+	for (; i < n; i++)
+		acc[i] += x[i];
+}
+#elif defined(BEAM_NEON)
+static float dot_f32(const float *a, const float *b, unsigned long n)
+{
+	float32x4_t acc = vdupq_n_f32(0);
+	float32x2_t pair;
+	unsigned long i;
+	float sum;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+	pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	sum = vget_lane_f32(pair, 0) + vget_lane_f32(pair, 1);
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+static void add_f32(float *acc, const float *x, unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		vst1q_f32(acc + i, vaddq_f32(vld1q_f32(acc + i), vld1q_f32(x + i)));
+	for (; i < n; i++)
+		acc[i] += x[i];
+}
+#else
+static float dot_f32(const float *a, const float *b, unsigned long n)
+{
+	unsigned long i;
+	float sum = 0;
+
+	for (i = 0; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+static void add_f32(float *acc, const float *x, unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++)
+		acc[i] += x[i];
+}
+#endif
+
+int beamformer_init(struct beamformer *bf, unsigned int channels,
+		unsigned int rate, unsigned long max_frames)
+{
+	const char *env = getenv("XIUXIU_BEAM_BUDGET");
+
+	memset(bf, 0, sizeof(*bf));
+	if (channels < 2 || channels > BEAM_MAX_CHANNELS || rate == 0 || max_frames == 0)
+		return -1;
+	bf->channels = channels;
+	bf->rate = rate;
+	bf->max_lag = (rate * BEAM_APERTURE_MM + BEAM_SOUND_MM_PER_S - 1)
+		/ BEAM_SOUND_MM_PER_S;
+	bf->max_frames = max_frames;
+	bf->stride = 2 * bf->max_lag + max_frames;
+	/* the row after the channels accumulates the output */
+	bf->rows = (float *)calloc((channels + 1) * bf->stride, sizeof(float));
+	if (!bf->rows)
+		return -1;
+
+	bf->budget_percent = env && atoi(env) > 0 ? atoi(env) : BEAM_BUDGET_PERCENT;
+	dbg("beamformer: %u channels, lags up to %u at %u Hz, %u%% budget\n",
+			channels, bf->max_lag, rate, bf->budget_percent);
+	return 0;
+}
+
+void beamformer_free(struct beamformer *bf)
+{
+	if (bf->rows) {
+		free(bf->rows);
+		bf->rows = NULL;
+	}
+}
+
+void beamformer_reset(struct beamformer *bf)
+{
+	if (bf->rows)
+		memset(bf->rows, 0, (bf->channels + 1) * bf->stride * sizeof(float));
+	memset(bf->delay, 0, sizeof(bf->delay));
+	bf->noise_floor = 0;
+	bf->skip = 0;
+}
+
+/* the window of channel c aligned with channel 0's output window */
+static float *window(struct beamformer *bf, unsigned int c, int delay)
+{
+	return bf->rows + c * bf->stride + bf->max_lag + delay;
+}
+
+/* steer towards the dominant source if this chunk is voiced */
+static void estimate(struct beamformer *bf, unsigned long n)
+{
+	const float *ref = window(bf, 0, 0);
+	float e0 = dot_f32(ref, ref, n);
+	float ms = e0 / n;
+	float floor = bf->noise_floor ? bf->noise_floor : ms;
+	float r, best, ec;
+	int d, lag = (int)bf->max_lag, best_d, changed = 0;
+	unsigned int c;
+
+	if (ms < BEAM_MIN_ENERGY || ms < floor * BEAM_SPEECH_RATIO) {
+		/* follow the floor down quickly and up slowly */
+		if (ms < floor)
+			floor -= (floor - ms) / 8;
+		else
+			floor += (ms - floor) / 64;
+		bf->noise_floor = floor;
+		return;
+	}
+
+	for (c = 1; c < bf->channels; c++) {
+		best = -1;
+		best_d = 0;
+		for (d = -lag; d <= lag; d++) {
+			r = dot_f32(ref, window(bf, c, d), n);
+			if (r > best) {
+				best = r;
+				best_d = d;
+			}
+		}
+		ec = dot_f32(window(bf, c, best_d), window(bf, c, best_d), n);
+		if (best < BEAM_MIN_COHERENCE * sqrtf(e0 * ec))
+			continue;
+		if (bf->delay[c] != best_d) {
+			bf->delay[c] = best_d;
+			changed = 1;
+		}
+	}
+	if (changed) {
+		char buf[BEAM_MAX_CHANNELS * 8];
+		int len = 0;
+
+		for (c = 1; c < bf->channels; c++)
+			len += snprintf(buf + len, sizeof(buf) - len, " %d", bf->delay[c]);
+		dbg("beamformer: steering delays%s\n", buf);
+	}
+}
+
+void beamformer_process(struct beamformer *bf, const int16_t *in,
+		unsigned long frames, int16_t *out)
+{
+	unsigned int c, history = 2 * bf->max_lag;
+	float *row, *acc = bf->rows + bf->channels * bf->stride;
+	float scale = 1.0f / bf->channels, v;
+	uint64_t t0 = metrics_now_us(), used, budget;
+	unsigned long t;
+
+	if (frames > bf->max_frames)
+		frames = bf->max_frames;
+	for (c = 0; c < bf->channels; c++) {
+		row = bf->rows + c * bf->stride + history;
+		for (t = 0; t < frames; t++)
+			row[t] = in[t * bf->channels + c];
+	}
+
+	if (bf->skip) {
+		bf->skip--;
+		metric_inc(&m_skipped);
+	} else {
+		estimate(bf, frames);
+	}
+
+	memcpy(acc, window(bf, 0, 0), frames * sizeof(float));
+	for (c = 1; c < bf->channels; c++)
+		add_f32(acc, window(bf, c, bf->delay[c]), frames);
+	for (t = 0; t < frames; t++) {
+		v = acc[t] * scale;
+		out[t] = v >= 32767.0f ? 32767 : v <= -32768.0f ? -32768 : (int16_t)lrintf(v);
+	}
+
+	for (c = 0; c < bf->channels; c++) {
+		row = bf->rows + c * bf->stride;
+		memmove(row, row + frames, history * sizeof(float));
+	}
+
+	/* an overrun is paid back by reusing the direction for a while */
+	used = metrics_now_us() - t0;
+	metric_observe_us(&m_process, used);
+	budget = (uint64_t)frames * 1000000 / bf->rate * bf->budget_percent / 100;
+	if (budget == 0)
+		budget = 1;
+	metric_set(&m_budget, (int64_t)(used * 100 / budget));
+	if (used > budget)
+		bf->skip = used / budget;
+}
@@ -0,0 +1,67 @@
+/*
+ * @file
+ * @brief delay-and-sum beamforming of a microphone array to mono
+ *
+ * Used by the recorder in place of the plain channel average when the
+ * device has several microphones. Each chunk, the delay of every
+ * channel against channel 0 is estimated by cross-correlation over the
+ * lags the array aperture allows; the set of delays is the steering
+ * direction, so no array geometry is needed. Estimates are only taken
+ * from voiced, coherent chunks, which keeps the beam on the talker
+ * through pauses. The channels are then aligned and averaged, adding
+ * the talker coherently and the diffuse noise incoherently.
+ *
+ * Direction estimation dominates the cost. The stage is given a budget,
+ * a share of each chunk's duration ($XIUXIU_BEAM_BUDGET percent,
+ * default 25); a chunk that overruns it makes the following chunks
+ * reuse the current direction until the overrun is paid back, so the
+ * capture thread never falls behind. Usage is exported as the
+ * xiuxiu_beamformer_budget_used_percent gauge.
+ *
+ * Input is interleaved 16 bit PCM. The correlation and summing loops
+ * use SSE or NEON when the compiler targets them and plain C otherwise.
+ */
+
+#ifndef BEAMFORMER_H
+#define BEAMFORMER_H
+
+#include <stdint.h>
+
+#define BEAM_MAX_CHANNELS	8
+#define BEAM_APERTURE_MM	100	/* largest microphone spacing we steer over */
+
+struct beamformer {
+	unsigned int channels;
+	unsigned int rate;
+	unsigned int max_lag;		/* samples, from BEAM_APERTURE_MM */
+	unsigned long max_frames;
+	unsigned long stride;		/* 2 * max_lag history + max_frames */
+	float *rows;			/* one row of stride per channel */
+	int delay[BEAM_MAX_CHANNELS];	/* against channel 0, in samples */
+	float noise_floor;		/* mean square of unvoiced chunks */
+
+	unsigned int budget_percent;
+	unsigned long skip;		/* chunks left to reuse the direction */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returns 0, or -1 for an unsupported channel count or no memory */
+int beamformer_init(struct beamformer *bf, unsigned int channels,
+		unsigned int rate, unsigned long max_frames);
+void beamformer_free(struct beamformer *bf);
+/* forget history and direction, e.g. when capture restarts */
+void beamformer_reset(struct beamformer *bf);
+
+/* beamform frames <= max_frames interleaved frames into mono out. The
+ * output lags the input by max_lag samples. */
+void beamformer_process(struct beamformer *bf, const int16_t *in,
+		unsigned long frames, int16_t *out);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
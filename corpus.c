@@ -0,0 +1,228 @@
+/*
+ * @file
+ * @brief manifest loading and mmap'd audio for the offline tools
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "corpus.h"
+
+static uint32_t le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t le16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+	FILE *f;
+	char *buf;
+	long size;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = size >= 0 ? (char *)malloc(size + 1) : NULL;
+	if (buf && fread(buf, 1, size, f) != (size_t)size) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+	if (buf) {
+		buf[size] = '\0';
+		*len = size;
+	}
+	return buf;
+}
+
+static char *join_path(const char *dir, size_t dir_len, const char *name)
+{
+	char *p;
+
+	if (name[0] == '/' || dir_len == 0)
+		return strdup(name);
+	p = (char *)malloc(dir_len + strlen(name) + 2);
+	if (p)
+		sprintf(p, "%.*s/%s", (int)dir_len, dir, name);
+	return p;
+}
+
+int corpus_load(const char *manifest, struct corpus *c)
+{
+	const char *slash = strrchr(manifest, '/');
+	size_t dir_len = slash ? (size_t)(slash - manifest) : 0;
+	size_t len, lines = 1, i;
+	char *line, *next, *label;
+
+	memset(c, 0, sizeof(*c));
+	c->text = read_file(manifest, &len);
+	if (!c->text)
+		return -errno;
+	for (i = 0; i < len; i++)
+		lines += c->text[i] == '\n';
+	c->entries = (struct corpus_entry *)calloc(lines, sizeof(struct corpus_entry));
+	if (!c->entries) {
+		corpus_free(c);
+		return -ENOMEM;
+	}
+
+	for (line = c->text; line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		line[strcspn(line, "\r")] = '\0';
+		line += strspn(line, " \t");
+		if (*line == '\0' || *line == '#')
+			continue;
+
+		label = line + strcspn(line, " \t");
+		if (*label) {
+			*label++ = '\0';
+			label += strspn(label, " \t");
+		}
+		c->entries[c->count].path = join_path(manifest, dir_len, line);
+		if (!c->entries[c->count].path) {
+			corpus_free(c);
+			return -ENOMEM;
+		}
+		c->entries[c->count].label = label;
+		c->count++;
+	}
+	return 0;
+}
+
+void corpus_free(struct corpus *c)
+{
+	size_t i;
+
+	for (i = 0; i < c->count; i++)
+		free(c->entries[i].path);
+	free(c->entries);
+	free(c->text);
+	memset(c, 0, sizeof(*c));
+}
+
+/* walk the RIFF chunks for "fmt " and "data" */
+static int parse_wav(struct corpus_audio *a)
+{
+	const unsigned char *p = (const unsigned char *)a->map;
+	const unsigned char *end = p + a->map_len;
+	uint32_t size;
+	int have_fmt = 0;
+
+	p += 12;
+	while (p + 8 <= end) {
+		size = le32(p + 4);
+		if (memcmp(p, "fmt ", 4) == 0 && size >= 16 && p + 8 + 16 <= end) {
+			if (le16(p + 8) != 1)	/* PCM only */
+				return -EINVAL;
+			a->channels = le16(p + 10);
+			a->rate = le32(p + 12);
+			a->bits = le16(p + 22);
+			have_fmt = 1;
+		} else if (memcmp(p, "data", 4) == 0) {
+			if (!have_fmt)
+				return -EINVAL;
+			a->pcm = (const char *)p + 8;
+			a->len = (size_t)(end - (p + 8));
+			if (size < a->len)
+				a->len = size;
+			return 0;
+		}
+		p += 8 + size + (size & 1);
+	}
+	return -EINVAL;
+}
+
+int corpus_audio_open(const char *path, struct corpus_audio *a)
+{
+	struct stat st;
+	int fd, err;
+
+	memset(a, 0, sizeof(*a));
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	a->map_len = st.st_size;
+	if (a->map_len) {
+		a->map = mmap(NULL, a->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (a->map == MAP_FAILED) {
+			err = -errno;
+			a->map = NULL;
+			close(fd);
+			return err;
+		}
+		madvise(a->map, a->map_len, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	if (a->map_len >= 12 && memcmp(a->map, "RIFF", 4) == 0
+			&& memcmp((char *)a->map + 8, "WAVE", 4) == 0) {
+		err = parse_wav(a);
+		if (err) {
+			corpus_audio_close(a);
+			return err;
+		}
+		return 0;
+	}
+
+	a->pcm = (const char *)a->map;
+	a->len = a->map_len;
+	a->rate = 16000;
+	a->channels = 1;
+	a->bits = 16;
+	return 0;
+}
+
+void corpus_audio_close(struct corpus_audio *a)
+{
+	if (a->map)
+		munmap(a->map, a->map_len);
+	memset(a, 0, sizeof(*a));
+}
+
+unsigned long corpus_audio_ms(const struct corpus_audio *a)
+{
+	unsigned long frame = a->channels * a->bits / 8;
+
+	if (!frame || !a->rate)
+		return 0;
+	return (unsigned long)((uint64_t)a->len / frame * 1000 / a->rate);
+}
+
+void json_fputs(const char *s, FILE *f)
+{
+	unsigned char c;
+
+	putc('"', f);
+	for (; (c = *s) != '\0'; s++) {
+		if (c == '"' || c == '\\') {
+			putc('\\', f);
+			putc(c, f);
+		} else if (c < 0x20) {
+			fprintf(f, "\\u%04x", c);
+		} else {
+			putc(c, f);
+		}
+	}
+	putc('"', f);
+}
@@ -0,0 +1,66 @@
+/*
+ * @file
+ * @brief recorded corpus access for the offline tools
+ *
+ * A manifest lists one recording per line, optionally followed by a
+ * label after a tab or spaces:
+ *
+ *	# comment
+ *	wav/0001.wav	打电话给丁伟
+ *	/data/neg/kitchen.pcm	neg
+ *
+ * Relative paths are taken from the manifest's directory. Recordings
+ * are mmap'd rather than read, so thousands of files cost no more
+ * memory than the chunks in flight. .wav files are parsed for their
+ * format; anything else is taken as raw 16 kHz 16 bit mono PCM.
+ */
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+struct corpus_entry {
+	char *path;
+	const char *label;	/* "" if none */
+};
+
+struct corpus {
+	struct corpus_entry *entries;
+	size_t count;
+	char *text;		/* manifest contents, labels point into it */
+};
+
+struct corpus_audio {
+	void *map;
+	size_t map_len;
+	const char *pcm;
+	size_t len;		/* bytes */
+	unsigned int rate;
+	unsigned int channels;
+	unsigned int bits;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returns 0 or a negative errno */
+int corpus_load(const char *manifest, struct corpus *c);
+void corpus_free(struct corpus *c);
+
+/* returns 0, a negative errno, or -EINVAL for a malformed wav */
+int corpus_audio_open(const char *path, struct corpus_audio *a);
+void corpus_audio_close(struct corpus_audio *a);
+/* milliseconds of audio in a */
+unsigned long corpus_audio_ms(const struct corpus_audio *a);
+
+/* write s as a quoted JSON string */
+void json_fputs(const char *s, FILE *f);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * @file
+ * @brief timestamped playback reference for echo cancellation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "echo_ref.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define ECHO_REF_DBGON 1
+#if ECHO_REF_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+METRIC_COUNTER_DEFINE(m_published, "xiuxiu_echo_ref_samples_total",
+		"Playback reference samples published for echo cancellation");
+METRIC_COUNTER_DEFINE(m_resyncs, "xiuxiu_echo_ref_resyncs_total",
+		"Playback reference blocks re-anchored on their ALSA timestamp");
+
+/* samples[i] is valid for ring index stamp[i] only */
+static struct {
+	pthread_mutex_t lock;
+	int16_t samples[ECHO_REF_RING];
+	uint32_t stamp[ECHO_REF_RING];
+} ring = { PTHREAD_MUTEX_INITIALIZER, {0}, {0} };
+
+int echo_ref_enabled()
+{
+	static int enabled = -1;
+	const char *env;
+
+	if (enabled < 0) {
+		env = getenv("XIUXIU_AEC");
+		enabled = !(env && strcmp(env, "0") == 0);
+	}
+	return enabled;
+}
+
+int echo_ref_source_open(struct echo_ref_source *src, unsigned int rate,
+		unsigned int channels, unsigned long max_frames)
+{
+	src->next = 0;
+	if (src->ready && src->rate == rate && src->channels == channels
+			&& src->max_frames >= max_frames) {
+		if (src->resample)
+			resampler_reset(&src->rs);
+		return 0;
+	}
+	echo_ref_source_close(src);
+	if (rate == 0 || channels == 0 || max_frames == 0)
+		return -1;
+
+	src->rate = rate;
+	src->channels = channels;
+	src->max_frames = max_frames;
+	src->resample = rate != ECHO_REF_RATE;
+	src->mix = (int16_t *)malloc(max_frames * sizeof(int16_t));
+	if (!src->mix)
+		goto fail;
+	if (src->resample) {
+		if (resampler_init(&src->rs, rate, ECHO_REF_RATE, max_frames) != 0)
+			goto fail;
+		src->out = (int16_t *)malloc(resampler_max_out(&src->rs, max_frames)
+				* sizeof(int16_t));
+		if (!src->out)
+			goto fail;
+	}
+	src->ready = 1;
+	return 0;
+fail:
+	echo_ref_source_close(src);
+	return -1;
+}
+
+void echo_ref_source_close(struct echo_ref_source *src)
+{
+	if (src->resample)
+		resampler_free(&src->rs);
+	free(src->mix);
+	free(src->out);
+	memset(src, 0, sizeof(*src));
+}
+
+static void ring_add(uint64_t idx, const int16_t *x, unsigned long n)
+{
+	unsigned long i, pos;
+	int32_t v;
+
+	pthread_mutex_lock(&ring.lock);
+	for (i = 0; i < n; i++) {
+		pos = (idx + i) % ECHO_REF_RING;
+		if (ring.stamp[pos] == (uint32_t)(idx + i)) {
+			v = ring.samples[pos] + x[i];
+			ring.samples[pos] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+		} else {
+			ring.samples[pos] = x[i];
+			ring.stamp[pos] = (uint32_t)(idx + i);
+		}
+	}
+	pthread_mutex_unlock(&ring.lock);
+}
+
+void echo_ref_publish(struct echo_ref_source *src, const int16_t *pcm,
+		unsigned long frames, uint64_t play_us)
+{
+	uint64_t idx = echo_ref_index(play_us), start;
+	unsigned long n, out, done;
+	const int16_t *mono;
+	int64_t drift;
+
+	if (!src->ready || !echo_ref_enabled())
+		return;
+
+	/* stay contiguous while the clock agrees with us */
+	drift = (int64_t)(idx - src->next);
+	if (src->next && drift >= -ECHO_REF_SLACK && drift <= ECHO_REF_SLACK) {
+		idx = src->next;
+	} else if (src->next) {
+		metric_inc(&m_resyncs);
+		dbg("echo ref: re-anchored by %lld samples\n", (long long)drift);
+	}
+
+	start = idx;
+	for (done = 0; done < frames; done += n) {
+		n = frames - done < src->max_frames ? frames - done : src->max_frames;
+		mono = pcm + done;
+		if (src->channels > 1) {
+			pcm_downmix_s16(pcm + done * src->channels, n, src->channels, -1,
+					src->mix);
+			mono = src->mix;
+		}
+		out = n;
+		if (src->resample) {
+			out = resampler_process(&src->rs, mono, n, src->out);
+			mono = src->out;
+		}
+		ring_add(idx, mono, out);
+		idx += out;
+	}
+	metric_add(&m_published, (int64_t)(idx - start));
+	src->next = idx;
+}
+
+void echo_ref_drop(struct echo_ref_source *src)
+{
+	uint64_t idx = echo_ref_index(metrics_now_us()), end = src->next;
+
+	if (!src->ready || end <= idx)
+		goto out;
+	if (end - idx > ECHO_REF_RING)
+		end = idx + ECHO_REF_RING;
+	/* other streams mixed into the same slots go with it */
+	pthread_mutex_lock(&ring.lock);
+	for (; idx < end; idx++)
+		ring.stamp[idx % ECHO_REF_RING] = (uint32_t)(idx + 1);
+	pthread_mutex_unlock(&ring.lock);
+out:
+	src->next = 0;
+}
+
+int echo_ref_read(uint64_t idx, unsigned int n, int16_t *out)
+{
+	unsigned int i, pos, live = 0;
+
+	pthread_mutex_lock(&ring.lock);
+	for (i = 0; i < n; i++) {
+		pos = (idx + i) % ECHO_REF_RING;
+		if (ring.stamp[pos] == (uint32_t)(idx + i)) {
+			out[i] = ring.samples[pos];
+			live |= out[i] != 0;
+		} else {
+			out[i] = 0;
+		}
+	}
+	pthread_mutex_unlock(&ring.lock);
+	return live != 0;
+}
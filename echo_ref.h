@@ -0,0 +1,77 @@
+/*
+ * @file
+ * @brief timestamped playback reference for echo cancellation
+ *
+ * The playback threads publish every block they write together with the
+ * CLOCK_MONOTONIC time, taken from the ALSA timestamps, at which its
+ * first frame leaves the speaker. The block is downmixed and resampled
+ * to ECHO_REF_RATE mono and added into a shared ring indexed by that
+ * time, so the TTS and music streams mix the way dmix mixes them. The
+ * capture side reads the ring by the capture time of its own samples
+ * (see aec.h), which keeps the two clocks aligned without either side
+ * knowing about the other.
+ *
+ * A source keeps its blocks contiguous in the ring while the timestamps
+ * agree to within ECHO_REF_SLACK samples and re-anchors on the
+ * timestamp when they don't, e.g. after an underrun or a pause.
+ *
+ * $XIUXIU_AEC=0 turns publishing and cancellation off.
+ */
+
+#ifndef ECHO_REF_H
+#define ECHO_REF_H
+
+#include <stdint.h>
+#include "resampler.h"
+
+#define ECHO_REF_RATE		16000
+#define ECHO_REF_RING		(ECHO_REF_RATE * 2)	/* 2 s of reference */
+#define ECHO_REF_SLACK		32			/* 2 ms */
+
+/* one playback stream's conversion state */
+struct echo_ref_source {
+	int ready;
+	unsigned int rate;
+	unsigned int channels;
+	unsigned long max_frames;
+	struct resampler rs;
+	int resample;
+	int16_t *mix;
+	int16_t *out;
+	uint64_t next;		/* ring index the next block continues at, 0: none */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int echo_ref_enabled();
+
+/* (re)configure src for a new stream of 16 bit frames; blocks up to
+ * max_frames are converted in one go. returns 0 or -1 */
+int echo_ref_source_open(struct echo_ref_source *src, unsigned int rate,
+		unsigned int channels, unsigned long max_frames);
+void echo_ref_source_close(struct echo_ref_source *src);
+
+/* add frames of interleaved pcm whose first frame plays at play_us */
+void echo_ref_publish(struct echo_ref_source *src, const int16_t *pcm,
+		unsigned long frames, uint64_t play_us);
+/* the stream was dropped: forget what src published that has not been
+ * played yet, so it is not cancelled from speech that follows */
+void echo_ref_drop(struct echo_ref_source *src);
+
+/* n reference samples from ring index idx, silence where nothing was
+ * published; returns 0 if all of them are silence */
+int echo_ref_read(uint64_t idx, unsigned int n, int16_t *out);
+
+/* ring index of a CLOCK_MONOTONIC time */
+static inline uint64_t echo_ref_index(uint64_t us)
+{
+	return us * (ECHO_REF_RATE / 1000) / 1000;
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
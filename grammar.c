@@ -0,0 +1,174 @@
+/*
+ * @file
+ * @brief offline grammar build shared by the device loop and the tools
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "qisr.h"
+#include "msp_cmn.h"
+#include "msp_errors.h"
+#include "grammar.h"
+#include "xlog.h"
+
+#define GRM_DBGON 1
+#if GRM_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+#define GRM_WAIT_MS 50
+
+const char * ASR_RES_PATH        = "fo|res/asr/common.jet"; //离线语法识别资源路径
+const char * GRM_BUILD_PATH      = "res/asr/GrmBuilld"; //构建离线语法识别网络生成数据保存路径
+const char * GRM_FILE            = "call.bnf"; //构建离线识别语法网络所用的语法文件
+const char * LEX_NAME            = "contact"; //更新离线识别语法的contact槽（语法文件为此示例中使用的call.bnf）
+
+int build_grm_cb(int ecode, const char *info, void *udata)
+{
+	UserData *grm_data = (UserData *)udata;
+
+	if (MSP_SUCCESS == ecode && NULL != info) {
+		dbg("构建语法成功！ 语法ID:%s\n", info);
+		if (NULL != grm_data)
+			snprintf(grm_data->grammar_id, MAX_GRAMMARID_LEN - 1, "%s", info);
+	}
+	else
+		dbg("构建语法失败！%d\n", ecode);
+
+	if (NULL != grm_data) {
+		grm_data->errcode = ecode;
+		/* last: build_grammar_wait reads the rest once it sees this */
+		__atomic_store_n(&grm_data->build_fini, 1, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+int build_grammar(UserData *udata)
+{
+	FILE *grm_file                           = NULL;
+	char *grm_content                        = NULL;
+	unsigned int grm_cnt_len                 = 0;
+	char grm_build_params[MAX_PARAMS_LEN];
+	int ret                                  = 0;
+
+	grm_file = fopen(GRM_FILE, "rb");	
+	if(NULL == grm_file) {
+		dbg("打开\"%s\"文件失败！[%s]\n", GRM_FILE, strerror(errno));
+		return -1; 
+	}
+
+	fseek(grm_file, 0, SEEK_END);
+	grm_cnt_len = ftell(grm_file);
+	fseek(grm_file, 0, SEEK_SET);
+
+	grm_content = (char *)malloc(grm_cnt_len + 1);
+	if (NULL == grm_content)
+	{
+		dbg("内存分配失败!\n");
+		fclose(grm_file);
+		grm_file = NULL;
+		return -1;
+	}
+	fread((void*)grm_content, 1, grm_cnt_len, grm_file);
+	grm_content[grm_cnt_len] = '\0';
+	fclose(grm_file);
+	grm_file = NULL;
+
+	snprintf(grm_build_params, MAX_PARAMS_LEN - 1, 
+		"engine_type = local, \
+		asr_res_path = %s, sample_rate = %d, \
+		grm_build_path = %s, ",
+		ASR_RES_PATH,
+		SAMPLE_RATE_16K,
+		GRM_BUILD_PATH
+		);
+	ret = QISRBuildGrammar("bnf", grm_content, grm_cnt_len, grm_build_params, build_grm_cb, udata);
+
+	free(grm_content);
+	grm_content = NULL;
+
+	return ret;
+}
+
+int build_grammar_wait(UserData *udata)
+{
+	int ret;
+
+	ret = build_grammar(udata);
+	if (MSP_SUCCESS != ret)
+		return ret;
+	while (1 != __atomic_load_n(&udata->build_fini, __ATOMIC_ACQUIRE))
+		usleep(GRM_WAIT_MS * 1000);
+	return udata->errcode;
+}
+
+int update_lex_cb(int ecode, const char *info, void *udata)
+{
+	UserData *lex_data = (UserData *)udata;
+
+	/* the slot is updated in place: grammar_id stays as it is */
+	if (NULL != lex_data) {
+		lex_data->errcode = ecode;
+		__atomic_store_n(&lex_data->update_fini, 1, __ATOMIC_RELEASE);
+	}
+
+	if (MSP_SUCCESS == ecode)
+		dbg("更新词典成功！\n");
+	else
+		dbg("更新词典失败！%d\n", ecode);
+
+	return 0;
+}
+
+int update_lexicon(UserData *udata, const char *lex_name,
+		const char *lex_content, unsigned int lex_cnt_len)
+{
+	char update_lex_params[MAX_PARAMS_LEN];
+
+	snprintf(update_lex_params, MAX_PARAMS_LEN - 1, 
+		"engine_type = local, text_encoding = UTF-8, \
+		asr_res_path = %s, sample_rate = %d, \
+		grm_build_path = %s, grammar_list = %s, ",
+		ASR_RES_PATH,
+		SAMPLE_RATE_16K,
+		GRM_BUILD_PATH,
+		udata->grammar_id);
+	udata->update_fini = 0;
+	return QISRUpdateLexicon(lex_name, lex_content, lex_cnt_len,
+			update_lex_params, update_lex_cb, udata);
+}
+
+int update_lexicon_wait(UserData *udata, const char *lex_name,
+		const char *lex_content, unsigned int lex_cnt_len)
+{
+	int ret;
+
+	ret = update_lexicon(udata, lex_name, lex_content, lex_cnt_len);
+	if (MSP_SUCCESS != ret)
+		return ret;
+	while (1 != __atomic_load_n(&udata->update_fini, __ATOMIC_ACQUIRE))
+		usleep(GRM_WAIT_MS * 1000);
+	return udata->errcode;
+}
+
+int grammar_asr_params(char *buf, size_t size, const char *grammar_id)
+{
+	return snprintf(buf, size, 
+		"engine_type = local, \
+		asr_res_path = %s, sample_rate = %d, \
+		grm_build_path = %s, local_grammar = %s, \
+		result_type = xml, result_encoding = UTF-8, \
+		asr_nbest = %d, ",
+		ASR_RES_PATH,
+		SAMPLE_RATE_16K,
+		GRM_BUILD_PATH,
+		grammar_id,
+		ASR_NBEST
+		);
+}
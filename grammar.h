@@ -0,0 +1,53 @@
+/*
+ * @file
+ * @brief offline grammar build shared by the device loop and the tools
+ */
+
+#ifndef GRAMMAR_H
+#define GRAMMAR_H
+
+#include <stddef.h>
+
+#define SAMPLE_RATE_16K     (16000)
+#define MAX_GRAMMARID_LEN   (32)
+#define MAX_PARAMS_LEN      (1024)
+#define ASR_NBEST           (3)  //识别候选结果数, see asr_result.h
+
+extern const char * ASR_RES_PATH;
+extern const char * GRM_BUILD_PATH;
+extern const char * GRM_FILE;
+extern const char * LEX_NAME;
+
+typedef struct _UserData {
+	int     build_fini; //标识语法构建是否完成
+	int     update_fini; //标识更新词典是否完成
+	int     errcode; //记录语法构建或更新词典回调错误码
+	char    grammar_id[MAX_GRAMMARID_LEN]; //保存语法构建返回的语法ID
+}UserData;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int build_grm_cb(int ecode, const char *info, void *udata);
+/* start building GRM_FILE; udata->build_fini is set when done */
+int build_grammar(UserData *udata);
+/* build_grammar and wait for the callback; returns its error code */
+int build_grammar_wait(UserData *udata);
+int update_lex_cb(int ecode, const char *info, void *udata);
+/* start replacing the words of slot lex_name in udata->grammar_id, one
+ * per line; udata->update_fini is set when done. The grammar keeps
+ * its id */
+int update_lexicon(UserData *udata, const char *lex_name,
+		const char *lex_content, unsigned int lex_cnt_len);
+/* update_lexicon and wait for the callback; returns its error code */
+int update_lexicon_wait(UserData *udata, const char *lex_name,
+		const char *lex_content, unsigned int lex_cnt_len);
+/* QISRSessionBegin params for recognizing with grammar_id */
+int grammar_asr_params(char *buf, size_t size, const char *grammar_id);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
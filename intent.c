@@ -0,0 +1,215 @@
+/*
+ * @file
+ * @brief chair commands resolved from N-best recognition results
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intent.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define INTENT_DBGON 1
+#if INTENT_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+METRIC_COUNTER_DEFINE(m_rescues, "xiuxiu_intent_nbest_rescues_total",
+		"Commands taken that the top candidate alone would have re-prompted");
+
+struct word {
+	const char *text;
+	int value;
+};
+
+/* the <something> slot of bin/call.bnf */
+static const struct word targets[] = {
+	{ "最大能量", INTENT_ENERGY }, { "能量", INTENT_ENERGY },
+	{ "温度", INTENT_TEMPERATURE }, { "温", INTENT_TEMPERATURE },
+	{ "力度", INTENT_STRENGTH },
+	{ "速度", INTENT_SPEED },
+	{ "按摩摆幅", INTENT_AMPLITUDE }, { "摆幅", INTENT_AMPLITUDE },
+	{ "自转幅度", INTENT_AMPLITUDE }, { "幅度", INTENT_AMPLITUDE },
+	{ "自转", INTENT_AMPLITUDE },
+	{ "剩余时间", INTENT_TIME }, { "时间", INTENT_TIME },
+	{ "歌", INTENT_MUSIC }, { "歌曲", INTENT_MUSIC }, { "音乐", INTENT_MUSIC },
+	{ NULL, 0 }
+};
+
+/* the <dopre> slot; 0 asks */
+static const struct word steps[] = {
+	{ "增", 1 }, { "增加", 1 }, { "加大", 1 }, { "提高", 1 }, { "升", 1 },
+	{ "降低", -1 }, { "降", -1 }, { "减少", -1 }, { "减小", -1 }, { "减", -1 },
+	{ "了解", 0 }, { "知道", 0 }, { "获得", 0 },
+	{ NULL, 0 }
+};
+
+static const struct word music[] = {
+	{ "播放", INTENT_PLAY }, { "播", INTENT_PLAY },
+	{ "停止", INTENT_STOP }, { "暂停", INTENT_STOP },
+	{ "停止播放", INTENT_STOP }, { "暂停播放", INTENT_STOP },
+	{ NULL, 0 }
+};
+
+/* 0 and *value if text is in words, else -1 */
+static int lookup(const struct word *words, const char *text, int *value)
+{
+	for (; text && words->text; words++) {
+		if (strcmp(words->text, text) == 0) {
+			*value = words->value;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int intent_of(const struct asr_candidate *c, struct intent *it)
+{
+	const char *something = asr_slot_value(c, "something");
+	const char *dopre = asr_slot_value(c, "dopre");
+	const char *time = asr_slot_value(c, "time");
+	const char *song = asr_slot_value(c, "song");
+	int target, v;
+
+	memset(it, 0, sizeof(*it));
+	it->confidence = c->confidence;
+	if (!something && song) {
+		/* 播放<song>; the titles come from the lexicon */
+		if (lookup(music, dopre, &v) != 0 || v != INTENT_PLAY)
+			return -1;
+		it->kind = INTENT_PLAY;
+		it->target = INTENT_MUSIC;
+		snprintf(it->song, sizeof(it->song), "%s", song);
+		return 0;
+	}
+	if (!something) {
+		if (time && strcmp(time, "下一首") == 0)
+			it->kind = INTENT_NEXT;
+		else if (time && strcmp(time, "上一首") == 0)
+			it->kind = INTENT_PREVIOUS;
+		else
+			return -1;
+		it->target = INTENT_MUSIC;
+		return 0;
+	}
+	if (lookup(targets, something, &target) != 0)
+		return -1;
+	it->target = (enum intent_target)target;
+
+	if (target == INTENT_MUSIC) {
+		if (lookup(music, dopre, &v) != 0)
+			return -1;
+		it->kind = (enum intent_kind)v;
+		return 0;
+	}
+	if (dopre) {
+		if (lookup(steps, dopre, &v) != 0)
+			return -1;
+		if (v) {
+			/* the steps the chair has replies for */
+			if (target != INTENT_ENERGY && target != INTENT_TEMPERATURE
+					&& target != INTENT_STRENGTH)
+				return -1;
+			it->kind = INTENT_ADJUST;
+			it->delta = v;
+			return 0;
+		}
+	} else if (!asr_slot_value(c, "value")) {
+		/* neither does nor asks anything */
+		return -1;
+	}
+	it->kind = INTENT_QUERY;
+	return 0;
+}
+
+static int same(const struct intent *a, const struct intent *b)
+{
+	return a->kind == b->kind && a->target == b->target
+		&& a->delta == b->delta && strcmp(a->song, b->song) == 0;
+}
+
+static int resolve(const struct asr_result *r, struct intent *it, int final)
+{
+	struct intent each[ASR_NBEST_MAX], best;
+	int valid[ASR_NBEST_MAX];
+	unsigned int i, j, top;
+	int score, agree, found = 0;
+
+	memset(&best, 0, sizeof(best));
+	for (i = 0; i < r->count; i++) {
+		valid[i] = intent_of(&r->c[i], &each[i]) == 0;
+		each[i].candidate = i;
+	}
+	for (i = 0; i < r->count; i++) {
+		if (!valid[i])
+			continue;
+		/* counted once, at its best candidate */
+		for (j = 0; j < i; j++)
+			if (valid[j] && same(&each[j], &each[i]))
+				break;
+		if (j < i)
+			continue;
+		/* the most confident of them, plus a bounded bonus for the
+		 * others agreeing: agreement only tips a borderline one over */
+		top = i;
+		agree = 0;
+		for (j = i + 1; j < r->count; j++) {
+			if (!valid[j] || !same(&each[j], &each[i]))
+				continue;
+			if (each[j].confidence > each[top].confidence) {
+				agree += each[top].confidence > 0 ? each[top].confidence : 0;
+				top = j;
+			} else {
+				agree += each[j].confidence > 0 ? each[j].confidence : 0;
+			}
+		}
+		agree /= INTENT_AGREE_SHARE;
+		score = each[top].confidence
+			+ (agree < INTENT_AGREE_BONUS ? agree : INTENT_AGREE_BONUS);
+		if (score > 100)
+			score = 100;
+		if (!found || score > best.confidence) {
+			best = each[top];
+			best.confidence = score;
+			found = 1;
+		}
+	}
+	if (!found)
+		return -1;
+	*it = best;
+	if (best.confidence < INTENT_MIN_CONFIDENCE) {
+		if (final)
+			dbg("intent: best %d/%d under %d\n", best.kind,
+					best.target, best.confidence);
+		return -2;
+	}
+	if (final && (!valid[0] || each[0].confidence < INTENT_MIN_CONFIDENCE)) {
+		dbg("intent: candidate %u of %u taken at %d\n", best.candidate,
+				r->count, best.confidence);
+		metric_inc(&m_rescues);
+	}
+	return 0;
+}
+
+int intent_resolve(const struct asr_result *r, struct intent *it)
+{
+	return resolve(r, it, 1);
+}
+
+int intent_early(const struct asr_result *r, struct intent *it)
+{
+	struct intent other;
+	unsigned int i;
+
+	/* on its own, agreement never acts early */
+	if (resolve(r, it, 0) != 0
+			|| r->c[it->candidate].confidence < INTENT_EARLY_CONFIDENCE)
+		return -1;
+	for (i = 0; i < r->count; i++)
+		if (intent_of(&r->c[i], &other) == 0 && !same(&other, it))
+			return -1;
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * @file
+ * @brief chair commands resolved from N-best recognition results
+ *
+ * Every candidate of the N-best list is mapped to the command it
+ * would give, if any. A command scores the confidence of its most
+ * confident candidate plus 1/INTENT_AGREE_SHARE of the others giving
+ * it, at most INTENT_AGREE_BONUS. So a result whose top candidate is
+ * borderline but whose alternatives say the same thing (我想/我要,
+ * 温/温度, ...) is taken rather than re-prompted, while weak ones
+ * agreeing never add up to a command; and a top candidate that is no
+ * valid command at all gives way to the best one that is.
+ */
+
+#ifndef INTENT_H
+#define INTENT_H
+
+#include "asr_result.h"
+
+/* on the scale of the engine's top level <confidence>, see asr_result.h */
+#define INTENT_MIN_CONFIDENCE	20
+#define INTENT_EARLY_CONFIDENCE	50	/* to act before the utterance ends */
+#define INTENT_AGREE_SHARE	4
+#define INTENT_AGREE_BONUS	10
+
+enum intent_kind {
+	INTENT_NONE,
+	INTENT_ADJUST,		/* delta the target by a step */
+	INTENT_QUERY,		/* say the target's value */
+	INTENT_PLAY,
+	INTENT_STOP,
+	INTENT_NEXT,
+	INTENT_PREVIOUS,
+};
+
+enum intent_target {
+	INTENT_NO_TARGET,
+	INTENT_ENERGY,
+	INTENT_TEMPERATURE,
+	INTENT_STRENGTH,
+	INTENT_SPEED,
+	INTENT_AMPLITUDE,
+	INTENT_TIME,		/* of the program left */
+	INTENT_MUSIC,
+};
+
+struct intent {
+	enum intent_kind kind;
+	enum intent_target target;
+	int delta;		/* +1 or -1 for INTENT_ADJUST */
+	int confidence;		/* score over the candidates agreeing */
+	unsigned int candidate;	/* the most confident of them */
+	char song[ASR_SLOT_LEN];	/* the <song> to play, "" if none */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the command candidate c gives; returns 0, or -1 if it is none */
+int intent_of(const struct asr_candidate *c, struct intent *it);
+/* the best command of r; returns 0, -1 if no candidate is a command,
+ * or -2 if the best is under INTENT_MIN_CONFIDENCE (*it still set) */
+int intent_resolve(const struct asr_result *r, struct intent *it);
+/* whether a result in the middle of the utterance is safe to act on:
+ * the best command's own candidate reaches INTENT_EARLY_CONFIDENCE,
+ * without the agreement bonus, and no candidate gives another one.
+ * Returns 0 with *it set, or -1 */
+int intent_early(const struct asr_result *r, struct intent *it);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
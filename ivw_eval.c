@@ -0,0 +1,416 @@
+/*
+ * @file
+ * @brief xiuxiu-ivw-eval: score wake-word thresholds against a corpus
+ *
+ *	xiuxiu-ivw-eval [-j sessions] [-c chunk_ms] [-t thresholds]
+ *		[-r ivw_res_path] [-o out.jsonl] manifest
+ *
+ * The manifest (see corpus.h) labels every recording "pos" or "neg".
+ * A positive may give the end of the keyword in milliseconds, as in
+ * "pos 1830", to have its detection latency measured:
+ *
+ *	wake/0001.wav	pos 1830
+ *	wake/0002.wav	pos
+ *	tv/evening.pcm	neg
+ *
+ * Every recording is run once per threshold through its own QIVW
+ * session, chunk_ms at a time and as fast as the engine takes it, with
+ * up to `sessions` in flight. thresholds is a list "900,1200,1450" or a
+ * range "900:2000:100" and defaults to the 1450 test.c uses. Per
+ * threshold the tool prints false accepts per hour of negative audio,
+ * the false-reject rate over the positives and the median and p90
+ * latency from keyword end to the wake, counted in audio time and
+ * rounded up to the chunk. -o writes one JSON object per run as well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "qivw.h"
+#include "msp_cmn.h"
+#include "msp_errors.h"
+#include "corpus.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define IVW_EVAL_DBGON 1
+#if IVW_EVAL_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+#define IVW_EVAL_CHUNK_MS	40
+#define IVW_EVAL_THRESHOLD	1450
+#define IVW_EVAL_MAX_THRESHOLDS	64
+#define IVW_EVAL_RES_PATH	"res/ivw/wakeupresource.jet"
+#define IVW_EVAL_PARAMS_LEN	512
+
+enum eval_label {
+	EVAL_SKIP = 0,
+	EVAL_POS,
+	EVAL_NEG,
+};
+
+struct eval_file {
+	enum eval_label label;
+	long end_ms;		/* keyword end, -1 if not given */
+};
+
+/* totals for one threshold, guarded by ivw_eval.lock */
+struct eval_point {
+	int threshold;
+	char params[IVW_EVAL_PARAMS_LEN];
+	size_t pos;
+	size_t detected;
+	size_t neg;
+	size_t false_accepts;
+	uint64_t neg_ms;
+	size_t errors;
+	long *latency_ms;	/* one per timed detection */
+	size_t latencies;
+};
+
+struct ivw_eval {
+	struct corpus corpus;
+	struct eval_file *files;
+	struct eval_point points[IVW_EVAL_MAX_THRESHOLDS];
+	int npoints;
+	unsigned int chunk_bytes;
+	size_t next;		/* job = file * npoints + point */
+	size_t jobs;
+	FILE *out;
+	pthread_mutex_t lock;
+};
+
+/* one session's view of its wakes */
+struct eval_run {
+	size_t written;		/* bytes handed to the engine so far */
+	size_t first_wake;	/* written at the first wake, 0 if none */
+	int wakes;
+	int error;
+};
+
+static int eval_notify(const char *sessionID, int msg, int param1, int param2,
+		const void *info, void *userData)
+{
+	struct eval_run *run = (struct eval_run *)userData;
+
+	if (msg == MSP_IVW_MSG_WAKEUP) {
+		if (run->wakes++ == 0)
+			run->first_wake = run->written;
+	} else if (msg == MSP_IVW_MSG_ERROR) {
+		run->error = param1;
+	}
+	return 0;
+}
+
+static void run_ivw(struct ivw_eval *ev, const struct corpus_audio *a,
+		const char *params, struct eval_run *run)
+{
+	const char *sid;
+	int status = MSP_AUDIO_SAMPLE_FIRST;
+	int ret = MSP_SUCCESS;
+	size_t off, n;
+
+	sid = QIVWSessionBegin(NULL, params, &ret);
+	if (ret != MSP_SUCCESS) {
+		run->error = ret;
+		return;
+	}
+	ret = QIVWRegisterNotify(sid, eval_notify, run);
+	for (off = 0; ret == MSP_SUCCESS && !run->error && off < a->len; off += n) {
+		n = a->len - off < ev->chunk_bytes ? a->len - off : ev->chunk_bytes;
+		if (off + n == a->len)
+			status = MSP_AUDIO_SAMPLE_LAST;
+		run->written = off + n;
+		ret = QIVWAudioWrite(sid, a->pcm + off, n, status);
+		status = MSP_AUDIO_SAMPLE_CONTINUE;
+	}
+	if (ret != MSP_SUCCESS)
+		run->error = ret;
+	QIVWSessionEnd(sid, run->error ? "err" : "normal");
+}
+
+static void record(struct ivw_eval *ev, size_t file, struct eval_point *p,
+		const struct eval_run *run, unsigned long audio_ms)
+{
+	const struct eval_file *f = &ev->files[file];
+	int timed = f->label == EVAL_POS && run->wakes && f->end_ms >= 0;
+	long latency = 0;
+
+	if (timed)
+		latency = (long)(run->first_wake / 2 * 1000 / 16000) - f->end_ms;
+
+	pthread_mutex_lock(&ev->lock);
+	if (run->error) {
+		p->errors++;
+	} else if (f->label == EVAL_POS) {
+		p->pos++;
+		if (run->wakes) {
+			p->detected++;
+			if (timed)
+				p->latency_ms[p->latencies++] = latency;
+		}
+	} else {
+		p->neg++;
+		p->neg_ms += audio_ms;
+		p->false_accepts += run->wakes;
+	}
+	if (ev->out) {
+		fputs("{\"file\":", ev->out);
+		json_fputs(ev->corpus.entries[file].path, ev->out);
+		fprintf(ev->out, ",\"label\":\"%s\",\"threshold\":%d,\"error\":%d,"
+				"\"wakes\":%d,\"audio_ms\":%lu", f->label == EVAL_POS ? "pos" : "neg",
+				p->threshold, run->error, run->wakes, audio_ms);
+		if (timed)
+			fprintf(ev->out, ",\"latency_ms\":%ld", latency);
+		fputs("}\n", ev->out);
+	}
+	pthread_mutex_unlock(&ev->lock);
+}
+
+static void *worker_proc(void *arg)
+{
+	struct ivw_eval *ev = (struct ivw_eval *)arg;
+	struct corpus_audio a;
+	struct eval_run run;
+	size_t job, file;
+	int err;
+
+	while ((job = __atomic_fetch_add(&ev->next, 1, __ATOMIC_RELAXED)) < ev->jobs) {
+		file = job / ev->npoints;
+		if (ev->files[file].label == EVAL_SKIP)
+			continue;
+
+		memset(&run, 0, sizeof(run));
+		err = corpus_audio_open(ev->corpus.entries[file].path, &a);
+		if (err == 0) {
+			if (a.rate != 16000 || a.channels != 1 || a.bits != 16)
+				run.error = -EINVAL;
+			else
+				run_ivw(ev, &a, ev->points[job % ev->npoints].params, &run);
+		} else {
+			run.error = err;
+		}
+		if (run.error)
+			dbg("%s: error %d\n", ev->corpus.entries[file].path, run.error);
+		record(ev, file, &ev->points[job % ev->npoints], &run, corpus_audio_ms(&a));
+		if (err == 0)
+			corpus_audio_close(&a);
+	}
+	return NULL;
+}
+
+static int parse_labels(struct ivw_eval *ev)
+{
+	const char *label;
+	char *end;
+	size_t i;
+
+	ev->files = (struct eval_file *)calloc(ev->corpus.count, sizeof(struct eval_file));
+	if (!ev->files)
+		return -ENOMEM;
+	for (i = 0; i < ev->corpus.count; i++) {
+		label = ev->corpus.entries[i].label;
+		ev->files[i].end_ms = -1;
+		if (strcmp(label, "neg") == 0) {
+			ev->files[i].label = EVAL_NEG;
+		} else if (strncmp(label, "pos", 3) == 0) {
+			ev->files[i].label = EVAL_POS;
+			if (label[3] != '\0') {
+				ev->files[i].end_ms = strtol(label + 3, &end, 10);
+				if (end == label + 3 || ev->files[i].end_ms < 0)
+					ev->files[i].end_ms = -1;
+			}
+		} else {
+			fprintf(stderr, "%s: label \"%s\" is not pos or neg, skipped\n",
+					ev->corpus.entries[i].path, label);
+		}
+	}
+	return 0;
+}
+
+/* "900,1200,1450" or "900:2000:100" */
+static int parse_thresholds(struct ivw_eval *ev, const char *s)
+{
+	int lo, hi, step;
+	char *end;
+
+	if (sscanf(s, "%d:%d:%d", &lo, &hi, &step) == 3) {
+		if (step <= 0 || hi < lo)
+			return -EINVAL;
+		for (; lo <= hi; lo += step) {
+			if (ev->npoints == IVW_EVAL_MAX_THRESHOLDS)
+				return -E2BIG;
+			ev->points[ev->npoints++].threshold = lo;
+		}
+		return 0;
+	}
+	while (*s) {
+		if (ev->npoints == IVW_EVAL_MAX_THRESHOLDS)
+			return -E2BIG;
+		ev->points[ev->npoints++].threshold = strtol(s, &end, 10);
+		if (end == s || (*end != ',' && *end != '\0'))
+			return -EINVAL;
+		s = *end ? end + 1 : end;
+	}
+	return ev->npoints ? 0 : -EINVAL;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(struct ivw_eval *ev)
+{
+	struct eval_point *p;
+	long p50, p90;
+	int i;
+
+	printf("threshold  FA/h     FRR      p50_ms  p90_ms  errors\n");
+	for (i = 0; i < ev->npoints; i++) {
+		p = &ev->points[i];
+		p50 = p90 = -1;
+		if (p->latencies) {
+			qsort(p->latency_ms, p->latencies, sizeof(long), cmp_long);
+			p50 = p->latency_ms[p->latencies / 2];
+			p90 = p->latency_ms[p->latencies * 9 / 10];
+		}
+		printf("%-9d  %-7.2f  %-7.4f  %-6ld  %-6ld  %lu\n", p->threshold,
+				p->neg_ms ? p->false_accepts * 3600000.0 / p->neg_ms : 0.0,
+				p->pos ? (double)(p->pos - p->detected) / p->pos : 0.0,
+				p50, p90, (unsigned long)p->errors);
+	}
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: xiuxiu-ivw-eval [-j sessions] [-c chunk_ms] "
+			"[-t thresholds] [-r ivw_res_path] [-o out.jsonl] manifest\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *lgi_param = "appid = 5fc4a959,work_dir = .";
+	const char *res_path = IVW_EVAL_RES_PATH;
+	const char *thresholds = NULL;
+	const char *out_path = NULL;
+	struct ivw_eval ev;
+	pthread_t *workers;
+	long sessions = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int chunk_ms = IVW_EVAL_CHUNK_MS;
+	uint64_t t0, wall_us;
+	int i, nworkers, opt, ret;
+
+	memset(&ev, 0, sizeof(ev));
+	while ((opt = getopt(argc, argv, "j:c:t:r:o:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			sessions = atol(optarg);
+			break;
+		case 'c':
+			chunk_ms = atoi(optarg);
+			break;
+		case 't':
+			thresholds = optarg;
+			break;
+		case 'r':
+			res_path = optarg;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind != argc - 1 || sessions < 1 || chunk_ms == 0) {
+		usage();
+		return 1;
+	}
+	if (thresholds) {
+		if (parse_thresholds(&ev, thresholds) != 0) {
+			fprintf(stderr, "bad thresholds \"%s\"\n", thresholds);
+			return 1;
+		}
+	} else {
+		ev.points[ev.npoints++].threshold = IVW_EVAL_THRESHOLD;
+	}
+
+	xlog_init();
+	pthread_mutex_init(&ev.lock, NULL);
+	ev.chunk_bytes = 16000 * 2 / 1000 * chunk_ms;
+	ret = corpus_load(argv[optind], &ev.corpus);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+	ret = parse_labels(&ev);
+	for (i = 0; ret == 0 && i < ev.npoints; i++) {
+		snprintf(ev.points[i].params, sizeof(ev.points[i].params),
+				"ivw_threshold=0:%d,sst=wakeup,ivw_res_path =fo|%s",
+				ev.points[i].threshold, res_path);
+		ev.points[i].latency_ms = (long *)calloc(ev.corpus.count + 1, sizeof(long));
+		if (!ev.points[i].latency_ms)
+			ret = -ENOMEM;
+	}
+	if (ret) {
+		fprintf(stderr, "%s\n", strerror(-ret));
+		goto exit;
+	}
+	if (out_path) {
+		ev.out = fopen(out_path, "w");
+		if (!ev.out) {
+			fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+			ret = 1;
+			goto exit;
+		}
+	}
+
+	ret = MSPLogin(NULL, NULL, lgi_param);
+	if (MSP_SUCCESS != ret) {
+		fprintf(stderr, "MSPLogin failed, error code: %d.\n", ret);
+		goto exit;
+	}
+
+	ev.jobs = ev.corpus.count * ev.npoints;
+	if ((size_t)sessions > ev.jobs)
+		sessions = ev.jobs ? ev.jobs : 1;
+	workers = (pthread_t *)calloc(sessions, sizeof(pthread_t));
+	if (!workers) {
+		ret = -ENOMEM;
+		goto logout;
+	}
+	t0 = metrics_now_us();
+	for (nworkers = 0; nworkers < sessions; nworkers++)
+		if (pthread_create(&workers[nworkers], NULL, worker_proc, &ev) != 0)
+			break;
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	wall_us = metrics_now_us() - t0;
+	free(workers);
+
+	report(&ev);
+	fprintf(stderr, "%lu runs over %d thresholds in %.1f s with %d sessions\n",
+			(unsigned long)ev.jobs, ev.npoints, wall_us / 1e6, nworkers);
+	ret = 0;
+
+logout:
+	MSPLogout();
+exit:
+	if (ev.out)
+		fclose(ev.out);
+	for (i = 0; i < ev.npoints; i++)
+		free(ev.points[i].latency_ms);
+	free(ev.files);
+	corpus_free(&ev.corpus);
+	return ret;
+}
@@ -0,0 +1,240 @@
+/*
+ * @file
+ * @brief background lexicon updates of the running grammar
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "msp_errors.h"
+#include "grammar.h"
+#include "lexicon.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define LEXICON_DBGON 1
+#if LEXICON_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+METRIC_HISTOGRAM_DEFINE(m_update, "xiuxiu_lexicon_update_seconds",
+		"Time to apply a batch of lexicon changes", metric_buckets_slow);
+METRIC_COUNTER_DEFINE(m_failures, "xiuxiu_lexicon_update_failures_total",
+		"Lexicon batches dropped because an update failed");
+METRIC_GAUGE_DEFINE(m_generation, "xiuxiu_lexicon_generation",
+		"Lexicon updates published since start");
+
+struct lexicon_slot {
+	char name[LEXICON_SLOT_LEN];
+	char *words;
+	unsigned int len;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* a change came or stop */
+	char grammar_id[MAX_GRAMMARID_LEN];
+	unsigned int generation;
+	struct lexicon_slot pending[LEXICON_MAX_SLOTS];
+	unsigned int npending;
+	uint64_t changed_us;		/* of the last change pending */
+	lexicon_grammar_cb on_grammar;
+	lexicon_hold_cb hold;
+	void *arg;
+	int running;
+	pthread_t thread;
+} lex = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+int lexicon_set(const char *slot, const char *words, unsigned int len)
+{
+	struct lexicon_slot *s = NULL;
+	unsigned int i;
+	char *copy;
+
+	copy = (char *)malloc(len + 1);
+	if (!copy)
+		return -ENOMEM;
+	memcpy(copy, words, len);
+	copy[len] = '\0';
+
+	pthread_mutex_lock(&lex.lock);
+	/* a newer list of the same slot replaces the pending one */
+	for (i = 0; i < lex.npending; i++)
+		if (strcmp(lex.pending[i].name, slot) == 0)
+			s = &lex.pending[i];
+	if (!s) {
+		if (lex.npending == LEXICON_MAX_SLOTS) {
+			pthread_mutex_unlock(&lex.lock);
+			free(copy);
+			return -1;
+		}
+		s = &lex.pending[lex.npending++];
+		snprintf(s->name, sizeof(s->name), "%s", slot);
+	} else {
+		free(s->words);
+	}
+	s->words = copy;
+	s->len = len;
+	lex.changed_us = metrics_now_us();
+	pthread_cond_broadcast(&lex.cond);
+	pthread_mutex_unlock(&lex.lock);
+	dbg("lexicon: <%s> changed, %u bytes\n", slot, len);
+	return 0;
+}
+
+/* apply a batch in order to the grammar of udata */
+static int apply(struct lexicon_slot *batch, unsigned int n, UserData *udata)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < n; i++) {
+		ret = update_lexicon_wait(udata, batch[i].name, batch[i].words,
+				batch[i].len);
+		if (ret != MSP_SUCCESS) {
+			xlog(XLOG_WARN, "lexicon: <%s> update failed: %d\n",
+					batch[i].name, ret);
+			return ret;
+		}
+	}
+	return MSP_SUCCESS;
+}
+
+static void wait_ms(uint64_t ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&lex.cond, &lex.lock, &ts);
+}
+
+static void *lexicon_proc(void *arg)
+{
+	struct lexicon_slot batch[LEXICON_MAX_SLOTS];
+	uint64_t now, due;
+	unsigned int n, i;
+	UserData udata;
+	int ret;
+
+	pthread_mutex_lock(&lex.lock);
+	while (lex.running) {
+		if (!lex.npending) {
+			pthread_cond_wait(&lex.cond, &lex.lock);
+			continue;
+		}
+		now = metrics_now_us();
+		due = lex.changed_us + LEXICON_BATCH_MS * 1000ULL;
+		if (now < due) {
+			wait_ms((due - now) / 1000 + 1);
+			continue;
+		}
+
+		/* no session may use the grammar while its slots change */
+		if (lex.hold) {
+			pthread_mutex_unlock(&lex.lock);
+			ret = lex.hold(1, lex.arg);
+			pthread_mutex_lock(&lex.lock);
+			if (ret != 0) {
+				dbg("lexicon: sessions open, update held back\n");
+				continue;
+			}
+			if (!lex.running) {
+				lex.hold(0, lex.arg);
+				break;
+			}
+		}
+		n = lex.npending;
+		memcpy(batch, lex.pending, n * sizeof(batch[0]));
+		lex.npending = 0;
+		memset(&udata, 0, sizeof(udata));
+		snprintf(udata.grammar_id, sizeof(udata.grammar_id), "%s",
+				lex.grammar_id);
+		pthread_mutex_unlock(&lex.lock);
+
+		ret = apply(batch, n, &udata);
+		metric_observe_us(&m_update, metrics_now_us() - now);
+		for (i = 0; i < n; i++)
+			free(batch[i].words);
+
+		pthread_mutex_lock(&lex.lock);
+		if (ret == MSP_SUCCESS) {
+			lex.generation++;
+			metric_set(&m_generation, lex.generation);
+			xlog(XLOG_INFO, "lexicon: %u slots updated, grammar %s\n", n,
+					lex.grammar_id);
+			if (lex.on_grammar) {
+				pthread_mutex_unlock(&lex.lock);
+				lex.on_grammar(udata.grammar_id, lex.arg);
+				pthread_mutex_lock(&lex.lock);
+			}
+		} else {
+			metric_inc(&m_failures);
+		}
+		if (lex.hold) {
+			pthread_mutex_unlock(&lex.lock);
+			lex.hold(0, lex.arg);
+			pthread_mutex_lock(&lex.lock);
+		}
+	}
+	pthread_mutex_unlock(&lex.lock);
+	return NULL;
+}
+
+int lexicon_start(const char *grammar_id, lexicon_grammar_cb on_grammar,
+		lexicon_hold_cb hold, void *arg)
+{
+	pthread_mutex_lock(&lex.lock);
+	snprintf(lex.grammar_id, sizeof(lex.grammar_id), "%s", grammar_id);
+	lex.on_grammar = on_grammar;
+	lex.hold = hold;
+	lex.arg = arg;
+	lex.running = 1;
+	pthread_mutex_unlock(&lex.lock);
+	if (pthread_create(&lex.thread, NULL, lexicon_proc, NULL) != 0) {
+		lex.running = 0;
+		return -1;
+	}
+	metric_register(&m_generation);
+	return 0;
+}
+
+void lexicon_stop()
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&lex.lock);
+	if (!lex.running) {
+		pthread_mutex_unlock(&lex.lock);
+		return;
+	}
+	lex.running = 0;
+	pthread_cond_broadcast(&lex.cond);
+	pthread_mutex_unlock(&lex.lock);
+	pthread_join(lex.thread, NULL);
+
+	for (i = 0; i < lex.npending; i++)
+		free(lex.pending[i].words);
+	lex.npending = 0;
+}
+
+unsigned int lexicon_grammar(char *id, size_t size)
+{
+	unsigned int generation;
+
+	pthread_mutex_lock(&lex.lock);
+	snprintf(id, size, "%s", lex.grammar_id);
+	generation = lex.generation;
+	pthread_mutex_unlock(&lex.lock);
+	return generation;
+}
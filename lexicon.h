@@ -0,0 +1,64 @@
+/*
+ * @file
+ * @brief background lexicon updates of the running grammar
+ *
+ * Changing the words of a grammar slot, e.g. the song titles of
+ * <song> in call.bnf, needs no QISRBuildGrammar: QISRUpdateLexicon
+ * replaces one slot's word list in place, and the grammar keeps its
+ * id. Changes given to lexicon_set, e.g. by update_music_list in
+ * sound_playback.c, are batched for LEXICON_BATCH_MS and applied by a
+ * background thread. As the slot changes in place, under sessions
+ * using it too, a batch is only applied while hold keeps every
+ * session closed, e.g. with sr_config_hold: it waits for the open
+ * ones to end, and the ones beginning meanwhile wait for the batch.
+ * Once every slot of a batch is updated a new generation is
+ * published: lexicon_grammar reports it and on_grammar is told, e.g.
+ * to rebuild the sr_config sessions begin with. A batch that fails is
+ * dropped.
+ */
+
+#ifndef LEXICON_H
+#define LEXICON_H
+
+#include <stddef.h>
+
+#define LEXICON_BATCH_MS	500	/* changes closer than this go together */
+#define LEXICON_HOLD_MS		200	/* hold is asked again after this */
+#define LEXICON_MAX_SLOTS	4
+#define LEXICON_SLOT_LEN	32
+
+#define LEXICON_MUSIC_SLOT	"song"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* called on the lexicon thread with the grammar id each time an
+ * update was published */
+typedef void (*lexicon_grammar_cb)(const char *grammar_id, void *arg);
+/* on the lexicon thread: with 1 before a batch, to keep sessions of
+ * the grammar from being open; nonzero if some still is after up to
+ * LEXICON_HOLD_MS, and it is asked again. With 0 after the batch and
+ * on_grammar */
+typedef int (*lexicon_hold_cb)(int hold, void *arg);
+
+/* after build_grammar_wait, with the id it built; on_grammar and hold
+ * may be NULL. Returns 0 or -1 */
+int lexicon_start(const char *grammar_id, lexicon_grammar_cb on_grammar,
+		lexicon_hold_cb hold, void *arg);
+void lexicon_stop();
+
+/* replace the words of slot, one per line; may be called before
+ * lexicon_start. Returns 0, -1 if too many slots have changes pending,
+ * or -ENOMEM */
+int lexicon_set(const char *slot, const char *words, unsigned int len);
+
+/* copy the grammar id sessions should begin with to id; returns its
+ * generation, which changes each time an update was published */
+unsigned int lexicon_grammar(char *id, size_t size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -1,712 +1,1239 @@
-/*
-@file
-@brief  record demo for linux
-
-@author		taozhang9
-@date		2016/05/27
-*/
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <fcntl.h>
-#include <alsa/asoundlib.h>
-#include <signal.h>
-#include <sys/stat.h>
-#include <pthread.h>
-#include "formats.h"
-#include "linuxrec.h"
-
-#define DBG_ON 1
-
-#if DBG_ON
-#define dbg  printf
-#else
-#define dbg
-#endif
-
-
-/* Do not change the sequence */
-enum {
-	RECORD_STATE_CREATED,	/* Init		*/
-	RECORD_STATE_CLOSING,
-	RECORD_STATE_READY,		/* Opened	*/
-	RECORD_STATE_STOPPING,	/* During Stop	*/
-	RECORD_STATE_RECORDING,	/* Started	*/
-};
-
-#define SAMPLE_RATE  16000
-#define SAMPLE_BIT_SIZE 16
-#define FRAME_CNT   10
-//#define BUF_COUNT   1
-#define DEF_BUFF_TIME  500000
-#define DEF_PERIOD_TIME 100000
-
-#define DEFAULT_FORMAT		\
-{\
-	WAVE_FORMAT_PCM,	\
-	1,			\
-	16000,			\
-	32000,			\
-	2,			\
-	16,			\
-	sizeof(WAVEFORMATEX)	\
-}
-#if 0
-struct bufinfo {
-	char *data;
-	unsigned int bufsize;
-};
-#endif
-
-
-static int show_xrun = 1;
-static int start_record_internal(snd_pcm_t *pcm)
-{
-	return snd_pcm_start(pcm);
-}
-
-static int stop_record_internal(snd_pcm_t *pcm)
-{
-	return snd_pcm_drop(pcm);
-}
-
-
-static int is_stopped_internal(struct recorder *rec)
-{
-	snd_pcm_state_t state;
-
-	state =  snd_pcm_state((snd_pcm_t *)rec->wavein_hdl);
-	switch (state) {
-	case SND_PCM_STATE_RUNNING:
-	case SND_PCM_STATE_DRAINING:
-		return 0;
-	default: break;
-	}
-	return 1;
-	
-}
-
-static int format_ms_to_alsa(const WAVEFORMATEX * wavfmt, 
-						snd_pcm_format_t * format)
-{
-	snd_pcm_format_t tmp;
-	tmp = snd_pcm_build_linear_format(wavfmt->wBitsPerSample, 
-			wavfmt->wBitsPerSample, wavfmt->wBitsPerSample == 8 ? 1 : 0, 0);
-	if ( tmp == SND_PCM_FORMAT_UNKNOWN )
-		return -EINVAL;
-	*format = tmp;
-	return 0;
-}
-
-/* set hardware and software params */
-static int set_hwparams(struct recorder * rec,  const WAVEFORMATEX *wavfmt,
-			unsigned int buffertime, unsigned int periodtime)
-{
-	snd_pcm_hw_params_t *params;
-	int err;
-	unsigned int rate;
-	snd_pcm_format_t format;
-	snd_pcm_uframes_t size;
-	snd_pcm_t *handle = (snd_pcm_t *)rec->wavein_hdl;
-
-	rec->buffer_time = buffertime;
-	rec->period_time = periodtime;
-
-	snd_pcm_hw_params_alloca(&params);
-	err = snd_pcm_hw_params_any(handle, params);
-	if (err < 0) {
-		dbg("Broken configuration for this PCM");
-		return err;
-	}
-	err = snd_pcm_hw_params_set_access(handle, params,
-					   SND_PCM_ACCESS_RW_INTERLEAVED);
-	if (err < 0) {
-		dbg("Access type not available");
-		return err;
-	}
-	err = format_ms_to_alsa(wavfmt, &format);
-	if (err) {
-		dbg("Invalid format");
-		return - EINVAL;
-	}
-	err = snd_pcm_hw_params_set_format(handle, params, format);
-	if (err < 0) {
-		dbg("Sample format non available");
-		return err;
-	}
-	err = snd_pcm_hw_params_set_channels(handle, params, wavfmt->nChannels);
-	if (err < 0) {
-		dbg("Channels count non available");
-		return err;
-	}
-
-	rate = wavfmt->nSamplesPerSec;
-	err = snd_pcm_hw_params_set_rate_near(handle, params, &rate, 0);
-	if (err < 0) {
-		dbg("Set rate failed");
-		return err;
-	}
-	if(rate != wavfmt->nSamplesPerSec) {
-		dbg("Rate mismatch");
-		return -EINVAL;
-	}
-	if (rec->buffer_time == 0 || rec->period_time == 0) {
-		err = snd_pcm_hw_params_get_buffer_time_max(params,
-						    &rec->buffer_time, 0);
-		assert(err >= 0);
-		if (rec->buffer_time > 500000)
-			rec->buffer_time = 500000;
-		rec->period_time = rec->buffer_time / 4;
-	}
-	err = snd_pcm_hw_params_set_period_time_near(handle, params,
-					     &rec->period_time, 0);
-	if (err < 0) {
-		dbg("set period time fail");
-		return err;
-	}
-	err = snd_pcm_hw_params_set_buffer_time_near(handle, params,
-					     &rec->buffer_time, 0);
-	if (err < 0) {
-		dbg("set buffer time failed");
-		return err;
-	}
-	err = snd_pcm_hw_params_get_period_size(params, &size, 0);
-	if (err < 0) {
-		dbg("get period size fail");
-		return err;
-	}
-	rec->period_frames = size; 
-	err = snd_pcm_hw_params_get_buffer_size(params, &size);
-	if (size == rec->period_frames) {
-		dbg("Can't use period equal to buffer size (%lu == %lu)",
-				      size, rec->period_frames);
-		return -EINVAL;
-	}
-	rec->buffer_frames = size;
-	rec->bits_per_frame = wavfmt->wBitsPerSample;
-
-	/* set to driver */
-	err = snd_pcm_hw_params(handle, params);
-	if (err < 0) {
-		dbg("Unable to install hw params:");
-		return err;
-	}
-	return 0;
-}
-static int set_swparams(struct recorder * rec)
-{
-	int err;
-	snd_pcm_sw_params_t *swparams;
-	snd_pcm_t * handle = (snd_pcm_t*)(rec->wavein_hdl);
-	/* sw para */
-	snd_pcm_sw_params_alloca(&swparams);
-	err = snd_pcm_sw_params_current(handle, swparams);
-	if (err < 0) {
-		dbg("get current sw para fail");
-		return err;
-	}
-
-	err = snd_pcm_sw_params_set_avail_min(handle, swparams, 
-						rec->period_frames);
-	if (err < 0) {
-		dbg("set avail min failed");
-		return err;
-	}
-	/* set a value bigger than the buffer frames to prevent the auto start.
-	 * we use the snd_pcm_start to explicit start the pcm */
-	err = snd_pcm_sw_params_set_start_threshold(handle, swparams, 
-			rec->buffer_frames * 2);
-	if (err < 0) {
-		dbg("set start threshold fail");
-		return err;
-	}
-
-	if ( (err = snd_pcm_sw_params(handle, swparams)) < 0) {
-		dbg("unable to install sw params:");
-		return err;
-	}
-	return 0;
-}
-
-static int set_params(struct recorder *rec, WAVEFORMATEX *fmt,
-		unsigned int buffertime, unsigned int periodtime)
-{
-	int err;
-	WAVEFORMATEX defmt = DEFAULT_FORMAT;
-	
-	if (fmt == NULL) {
-		fmt = &defmt;
-	}
-	err = set_hwparams(rec, fmt, buffertime, periodtime);
-	if (err)
-		return err;
-	err = set_swparams(rec);
-	if (err)
-		return err;
-	return 0;
-}
-
-/*
- *   Underrun and suspend recovery
- */
- 
-static int xrun_recovery(snd_pcm_t *handle, int err)
-{
-	if (err == -EPIPE) {	/* over-run */
-		if (show_xrun)
-			printf("!!!!!!overrun happend!!!!!!");
-
-		err = snd_pcm_prepare(handle);
-		if (err < 0) {
-			if (show_xrun)
-				printf("Can't recovery from overrun,"
-				"prepare failed: %s\n", snd_strerror(err));
-			return err;
-		}
-		return 0;
-	} else if (err == -ESTRPIPE) {
-		while ((err = snd_pcm_resume(handle)) == -EAGAIN)
-			usleep(200000);	/* wait until the suspend flag is released */
-		if (err < 0) {
-			err = snd_pcm_prepare(handle);
-			if (err < 0) {
-				if (show_xrun)
-					printf("Can't recovery from suspend,"
-					"prepare failed: %s\n", snd_strerror(err));
-				return err;
-			}
-		}
-		return 0;
-	}
-	return err;
-}
-static ssize_t pcm_read(struct recorder *rec, size_t rcount)
-{
-	ssize_t r;
-	size_t count = rcount;
-	char *data;
-	snd_pcm_t *handle = (snd_pcm_t *)rec->wavein_hdl;
-	if(!handle)
-		return -EINVAL;
-
-	data = rec->audiobuf;
-	while (count > 0) {
-		r = snd_pcm_readi(handle, data, count);
-		if (r == -EAGAIN || (r >= 0 && (size_t)r < count)) {
-			snd_pcm_wait(handle, 100);
-		} else if (r < 0) {
-			if(xrun_recovery(handle, r) < 0) {
-				return -1;
-			}
-		} 
-
-		if (r > 0) {
-			count -= r;
-			data += r * rec->bits_per_frame / 8;
-		}
-	}
-	return rcount;
-}
-
-static void * record_thread_proc(void * para)
-{
-	struct recorder * rec = (struct recorder *) para;
-	size_t frames, bytes;
-	sigset_t mask, oldmask;
-
-
-	sigemptyset(&mask);
-	sigaddset(&mask, SIGINT);
-	sigaddset(&mask, SIGTERM);
-	pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
-
-	while(1) {
-
-		frames = rec->period_frames;
-		bytes = frames * rec->bits_per_frame / 8; 
-
-		/* closing, exit the thread */
-		if (rec->state == RECORD_STATE_CLOSING){
-			break;
-        }
-
-		if(rec->state < RECORD_STATE_RECORDING){
-			usleep(100000);
-            continue;
-        }
-
-		if (pcm_read(rec, frames) != frames) {
-			return NULL;
-		}
-
-		if (rec->on_data_ind)
-			rec->on_data_ind(rec->audiobuf, bytes, 
-					rec->user_cb_para);
-	}
-	return rec;
-
-}
-static int create_record_thread(void * para, pthread_t * tidp)
-{
-	int err;
-	err = pthread_create(tidp, NULL, record_thread_proc, (void *)para);
-	if (err != 0)
-		return err;
-
-	return 0;
-}
-
-#if 0 /* don't use it now... cuz only one buffer supported */
-static void free_rec_buffer(struct recorder * rec)
-{
-	if (rec->bufheader) {
-		unsigned int i;
-		struct bufinfo *info = (struct bufinfo *) rec->bufheader;
-
-		assert(rec->bufcount > 0);
-		for (i = 0; i < rec->bufcount; ++i) {
-			if (info->data) {
-				free(info->data);
-				info->data = NULL;
-				info->bufsize = 0;
-				info->audio_bytes = 0;
-			}
-			info++;
-		}
-		free(rec->bufheader);
-		rec->bufheader = NULL;
-	}
-	rec->bufcount = 0;
-}
-
-static int prepare_rec_buffer(struct recorder * rec )
-{
-	struct bufinfo *buffers;
-	unsigned int i;
-	int err;
-	size_t sz;
-
-	/* the read and QISRWrite is blocked, currently only support one buffer,
-	 * if overrun too much, need more buffer and another new thread
-	 * to write the audio to network */
-	rec->bufcount = 1;
-	sz = sizeof(struct bufinfo)*rec->bufcount;
-	buffers=(struct bufinfo*)malloc(sz);
-	if (!buffers) {
-		rec->bufcount = 0;
-		goto fail;
-	}
-	memset(buffers, 0, sz);
-	rec->bufheader = buffers;
-
-	for (i = 0; i < rec->bufcount; ++i) {
-		buffers[i].bufsize = 
-			(rec->period_frames * rec->bits_per_frame / 8);
-		buffers[i].data = (char *)malloc(buffers[i].bufsize);
-		if (!buffers[i].data) {
-			buffers[i].bufsize = 0;
-			goto fail;
-		}
-		buffers[i].audio_bytes = 0;
-	}
-	return 0;
-fail:
-	free_rec_buffer(rec);
-	return -ENOMEM;
-}
-#else
-static void free_rec_buffer(struct recorder * rec)
-{
-	if (rec->audiobuf) {
-		free(rec->audiobuf);
-		rec->audiobuf = NULL;
-	}
-}
-
-static int prepare_rec_buffer(struct recorder * rec )
-{
-	/* the read and QISRWrite is blocked, currently only support one buffer,
-	 * if overrun too much, need more buffer and another new thread
-	 * to write the audio to network */
-	size_t sz = (rec->period_frames * rec->bits_per_frame / 8);
-	rec->audiobuf = (char *)malloc(sz);
-	if(!rec->audiobuf)
-		return -ENOMEM;
-	return 0;
-}
-#endif
-
-static int open_recorder_internal(struct recorder * rec, 
-		record_dev_id dev, WAVEFORMATEX * fmt)
-{
-	int err = 0;
-
-	err = snd_pcm_open((snd_pcm_t **)&rec->wavein_hdl, dev.u.name, 
-			SND_PCM_STREAM_CAPTURE, 0);
-	if(err < 0)
-		goto fail;
-
-	err = set_params(rec, fmt, DEF_BUFF_TIME, DEF_PERIOD_TIME);
-	if(err)
-		goto fail;
-
-	assert(rec->bufheader == NULL);
-	err = prepare_rec_buffer(rec);
-	if(err)
-		goto fail;
-
-	err = create_record_thread((void*)rec, 
-			&rec->rec_thread);
-	if(err)
-		goto fail;
-	
-
-	return 0;
-fail:
-	if(rec->wavein_hdl)
-		snd_pcm_close((snd_pcm_t *) rec->wavein_hdl);
-	rec->wavein_hdl = NULL;
-	free_rec_buffer(rec);
-	return err;
-}
-
-static void close_recorder_internal(struct recorder *rec)
-{
-	snd_pcm_t * handle;
-
-	handle = (snd_pcm_t *) rec->wavein_hdl;
-
-	/* may be the thread is blocked at read, cancel it */
-    pthread_cancel(rec->rec_thread);
-	
-	/* wait for the pcm thread quit first */
-	pthread_join(rec->rec_thread, NULL);
-
-	if(handle) {
-		snd_pcm_close(handle);
-		rec->wavein_hdl = NULL;
-	}
-	free_rec_buffer(rec);
-}
-/* return the count of pcm device */
-/* list all cards */
-static int get_pcm_device_cnt(snd_pcm_stream_t stream)
-{
-	void **hints, **n;
-	char *io, *name;
-    const char *filter;
-	int cnt = 0;
-
-	if (snd_device_name_hint(-1, "pcm", &hints) < 0)
-		return 0;
-	n = hints;
-	filter = stream == SND_PCM_STREAM_CAPTURE ? "Input" : "Output";
-	while (*n != NULL) {
-		io = snd_device_name_get_hint(*n, "IOID");
-		name = snd_device_name_get_hint(*n, "NAME");
-		if (name && (io == NULL || strcmp(io, filter) == 0))
-			cnt ++;
-		if (io != NULL)
-			free(io);
-		if (name != NULL)
-			free(name);
-		n++;
-	}
-	snd_device_name_free_hint(hints);
-	return cnt;
-}
-
-static void free_name_desc(char **name_or_desc) 
-{
-	char **ss;
-	ss = name_or_desc;
-	if(NULL == name_or_desc)
-		return;
-	while(*name_or_desc) {
-		free(*name_or_desc);
-		*name_or_desc = NULL;
-		name_or_desc++;
-	}
-	free(ss);
-}
-/* return success: total count, need free the name and desc buffer 
- * fail: -1 , *name_out and *desc_out will be NULL */
-static int list_pcm(snd_pcm_stream_t stream, char**name_out, 
-						char ** desc_out)
-{
-	void **hints, **n;
-	char **name, **descr;
-	char *io;
-	const char *filter;
-	int cnt = 0;
-	int i = 0;
-
-	if (snd_device_name_hint(-1, "pcm", &hints) < 0)
-		return 0;
-	n = hints;
-	cnt = get_pcm_device_cnt(stream);
-	if(!cnt) {
-		goto fail; 
-	}
-
-	*name_out = (char*)calloc(sizeof(char *) , (1+cnt));
-	if (*name_out == NULL)
-		goto fail;
-	*desc_out = (char*)calloc(sizeof(char *) , (1 + cnt));
-	if (*desc_out == NULL)
-		goto fail;
-
-	/* the last one is a flag, NULL */
-	name_out[cnt] = NULL;
-	desc_out[cnt] = NULL;
-	name = name_out;
-	descr = desc_out;
-
-	filter = stream == SND_PCM_STREAM_CAPTURE ? "Input" : "Output";
-	while (*n != NULL && i < cnt) {
-		*name = snd_device_name_get_hint(*n, "NAME");
-		*descr = snd_device_name_get_hint(*n, "DESC");
-		io = snd_device_name_get_hint(*n, "IOID");
-		if (name == NULL || 
-			(io != NULL && strcmp(io, filter) != 0) ){
-			if (*name) free(*name);
-			if (*descr) free(*descr);
-		} else {
-			if (*descr == NULL) {
-				*descr = (char*)malloc(4);
-				memset(*descr, 0, 4);
-			}
-			name++;
-			descr++;
-			i++;
-		}
-		if (io != NULL)
-			free(io);
-		n++;
-	}
-	snd_device_name_free_hint(hints);
-	return cnt;
-fail:
-	free_name_desc(name_out);
-	free_name_desc(desc_out);
-	snd_device_name_free_hint(hints);
-	return -1;
-}
-/* -------------------------------------
- * Interfaces 
- --------------------------------------*/ 
-/* the device id is a pcm string name in linux */
-record_dev_id  get_default_input_dev()
-{
-	record_dev_id id; 
-	id.u.name = "default";
-	return id;
-}
-
-record_dev_id * list_input_device() 
-{
-	// TODO: unimplemented
-	return NULL;
-}
-
-int get_input_dev_num()
-{
-	return get_pcm_device_cnt(SND_PCM_STREAM_CAPTURE);
-}
-
-
-/* callback will be run on a new thread */
-int create_recorder(struct recorder ** out_rec, 
-				void (*on_data_ind)(char *data, unsigned long len, void *user_cb_para), 
-				void* user_cb_para)
-{
-	struct recorder * myrec;
-	myrec = (struct recorder *)malloc(sizeof(struct recorder));
-	if(!myrec)
-		return -RECORD_ERR_MEMFAIL;
-
-	memset(myrec, 0, sizeof(struct recorder));
-	myrec->on_data_ind = on_data_ind;
-	myrec->user_cb_para = user_cb_para;
-	myrec->state = RECORD_STATE_CREATED;
-
-	*out_rec = myrec;
-	return 0;
-}
-
-void destroy_recorder(struct recorder *rec)
-{
-	if(!rec)
-		return;
-
-	free(rec);
-}
-
-int open_recorder(struct recorder * rec, record_dev_id dev, WAVEFORMATEX * fmt)
-{
-	int ret = 0;
-	if(!rec )
-		return -RECORD_ERR_INVAL;
-	if(rec->state >= RECORD_STATE_READY)
-		return 0;
-
-	ret = open_recorder_internal(rec, dev, fmt);
-	if(ret == 0)
-		rec->state = RECORD_STATE_READY;
-	return 0;
-
-}
-
-void close_recorder(struct recorder *rec)
-{
-	if(rec == NULL || rec->state < RECORD_STATE_READY)
-		return;
-	if(rec->state == RECORD_STATE_RECORDING)
-		stop_record(rec);
-
-	rec->state = RECORD_STATE_CLOSING;
-
-	close_recorder_internal(rec);
-
-	rec->state = RECORD_STATE_CREATED;	
-}
-
-int start_record(struct recorder * rec)
-{
-	int ret;
-	if(rec == NULL)
-		return -RECORD_ERR_INVAL;
-	if( rec->state < RECORD_STATE_READY)
-		return -RECORD_ERR_NOT_READY;
-	if( rec->state == RECORD_STATE_RECORDING)
-		return 0;
-
-	ret = start_record_internal((snd_pcm_t *)rec->wavein_hdl);
-	if(ret == 0)
-		rec->state = RECORD_STATE_RECORDING;
-	return ret;
-}
-
-int stop_record(struct recorder * rec)
-{
-	int ret;
-	if(rec == NULL)
-		return -RECORD_ERR_INVAL;
-	if( rec->state < RECORD_STATE_RECORDING)
-		return 0;
-
-	rec->state = RECORD_STATE_STOPPING;
-	ret = stop_record_internal((snd_pcm_t *)rec->wavein_hdl);
-	if(ret == 0) {		
-		rec->state = RECORD_STATE_READY;
-	}
-	return ret;
-}
-
-int is_record_stopped(struct recorder *rec)
-{
-	if(rec->state == RECORD_STATE_RECORDING)
-		return 0;
-
-	return is_stopped_internal(rec);
-}
+/*
+@file
+@brief  record demo for linux
+
+@author		taozhang9
+@date		2016/05/27
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <alsa/asoundlib.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "formats.h"
+#include "linuxrec.h"
+#include "metrics.h"
+#include "xlog.h"
+#include "rt_thread.h"
+#include "resampler.h"
+#include "beamformer.h"
+#include "echo_ref.h"
+#include "aec.h"
+
+#define DBG_ON 1
+
+#if DBG_ON
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+
+/* Do not change the sequence */
+enum {
+	RECORD_STATE_CREATED,	/* Init		*/
+	RECORD_STATE_CLOSING,
+	RECORD_STATE_READY,		/* Opened	*/
+	RECORD_STATE_STOPPING,	/* During Stop	*/
+	RECORD_STATE_RECORDING,	/* Started	*/
+};
+
+#define SAMPLE_RATE  16000
+#define SAMPLE_BIT_SIZE 16
+#define FRAME_CNT   10
+//#define BUF_COUNT   1
+#define DEF_BUFF_TIME  500000
+#define DEF_PERIOD_TIME 100000
+
+/* buffer, period and delivered chunk time in us, indexed by rec_profile.
+ * balanced keeps the historical 500/100 ms sizing */
+static const struct rec_timing rec_profiles[REC_PROFILE_MAX] = {
+	{ DEF_BUFF_TIME, DEF_PERIOD_TIME, DEF_PERIOD_TIME },	/* balanced */
+	{  80000,  10000,  20000 },				/* low-latency */
+	{ 1000000, 250000, 250000 },				/* power-save */
+};
+static const char *rec_profile_names[REC_PROFILE_MAX] = {
+	"balanced", "low-latency", "power-save"
+};
+
+#define DEFAULT_FORMAT		\
+{\
+	WAVE_FORMAT_PCM,	\
+	1,			\
+	16000,			\
+	32000,			\
+	2,			\
+	16,			\
+	sizeof(WAVEFORMATEX)	\
+}
+METRIC_COUNTER_DEFINE(m_overruns, "xiuxiu_capture_overruns_total",
+		"Capture overruns recovered by snd_pcm_prepare");
+METRIC_COUNTER_DEFINE(m_chunks, "xiuxiu_capture_chunks_total",
+		"Capture chunks delivered to the recorder callback");
+METRIC_COUNTER_DEFINE(m_zero_copy, "xiuxiu_capture_zero_copy_chunks_total",
+		"Capture chunks handed to the callback straight from the mmap ring");
+METRIC_HISTOGRAM_DEFINE(m_jitter, "xiuxiu_capture_jitter_seconds",
+		"Deviation of capture period completions from the period time",
+		metric_buckets_fast);
+
+#if 0
+struct bufinfo {
+	char *data;
+	unsigned int bufsize;
+};
+#endif
+
+
+static int show_xrun = 1;
+static int start_record_internal(snd_pcm_t *pcm)
+{
+	return snd_pcm_start(pcm);
+}
+
+static int stop_record_internal(snd_pcm_t *pcm)
+{
+	return snd_pcm_drop(pcm);
+}
+
+
+static int is_stopped_internal(struct recorder *rec)
+{
+	snd_pcm_state_t state;
+
+	state =  snd_pcm_state((snd_pcm_t *)rec->wavein_hdl);
+	switch (state) {
+	case SND_PCM_STATE_RUNNING:
+	case SND_PCM_STATE_DRAINING:
+		return 0;
+	default: break;
+	}
+	return 1;
+	
+}
+
+static int format_ms_to_alsa(const WAVEFORMATEX * wavfmt, 
+						snd_pcm_format_t * format)
+{
+	snd_pcm_format_t tmp;
+	tmp = snd_pcm_build_linear_format(wavfmt->wBitsPerSample, 
+			wavfmt->wBitsPerSample, wavfmt->wBitsPerSample == 8 ? 1 : 0, 0);
+	if ( tmp == SND_PCM_FORMAT_UNKNOWN )
+		return -EINVAL;
+	*format = tmp;
+	return 0;
+}
+
+/* set hardware and software params */
+static int set_hwparams(struct recorder * rec,  const WAVEFORMATEX *wavfmt,
+			unsigned int buffertime, unsigned int periodtime)
+{
+	snd_pcm_hw_params_t *params;
+	int err;
+	unsigned int rate, channels;
+	/* 16 bit mono is what we can downmix and resample to ourselves */
+	int convertible = wavfmt->nChannels == 1 && wavfmt->wBitsPerSample == 16;
+	snd_pcm_format_t format;
+	snd_pcm_uframes_t size;
+	snd_pcm_t *handle = (snd_pcm_t *)rec->wavein_hdl;
+
+	rec->buffer_time = buffertime;
+	rec->period_time = periodtime;
+
+	snd_pcm_hw_params_alloca(&params);
+	err = snd_pcm_hw_params_any(handle, params);
+	if (err < 0) {
+		dbg("Broken configuration for this PCM");
+		return err;
+	}
+	/* prefer reading straight out of the DMA ring */
+	rec->mmap_access = 1;
+	err = snd_pcm_hw_params_set_access(handle, params,
+					   SND_PCM_ACCESS_MMAP_INTERLEAVED);
+	if (err < 0) {
+		rec->mmap_access = 0;
+		err = snd_pcm_hw_params_set_access(handle, params,
+						   SND_PCM_ACCESS_RW_INTERLEAVED);
+	}
+	if (err < 0) {
+		dbg("Access type not available");
+		return err;
+	}
+	err = format_ms_to_alsa(wavfmt, &format);
+	if (err) {
+		dbg("Invalid format");
+		return - EINVAL;
+	}
+	err = snd_pcm_hw_params_set_format(handle, params, format);
+	if (err < 0) {
+		dbg("Sample format non available");
+		return err;
+	}
+	channels = wavfmt->nChannels;
+	if (convertible && rec->beamform && rec->capture_channel < 0) {
+		/* the whole array, the beamformer makes the mono */
+		err = snd_pcm_hw_params_get_channels_max(params, &channels);
+		if (err < 0 || channels > BEAM_MAX_CHANNELS)
+			channels = BEAM_MAX_CHANNELS;
+		err = snd_pcm_hw_params_set_channels_near(handle, params, &channels);
+	} else {
+		err = snd_pcm_hw_params_set_channels(handle, params, channels);
+		if (err < 0 && convertible)
+			err = snd_pcm_hw_params_set_channels_near(handle, params, &channels);
+	}
+	if (err < 0) {
+		dbg("Channels count non available");
+		return err;
+	}
+
+	/* take the device rate and convert in prepare_convert, the plug
+	 * layer's resampler is much slower than ours on ARM */
+	if (convertible)
+		snd_pcm_hw_params_set_rate_resample(handle, params, 0);
+	rate = wavfmt->nSamplesPerSec;
+	err = snd_pcm_hw_params_set_rate_near(handle, params, &rate, 0);
+	if (err < 0) {
+		dbg("Set rate failed");
+		return err;
+	}
+	if(rate != wavfmt->nSamplesPerSec && !convertible) {
+		dbg("Rate mismatch");
+		return -EINVAL;
+	}
+	rec->dev_rate = rate;
+	rec->dev_channels = channels;
+	if (rec->buffer_time == 0 || rec->period_time == 0) {
+		err = snd_pcm_hw_params_get_buffer_time_max(params,
+						    &rec->buffer_time, 0);
+		assert(err >= 0);
+		if (rec->buffer_time > 500000)
+			rec->buffer_time = 500000;
+		rec->period_time = rec->buffer_time / 4;
+	}
+	err = snd_pcm_hw_params_set_period_time_near(handle, params,
+					     &rec->period_time, 0);
+	if (err < 0) {
+		dbg("set period time fail");
+		return err;
+	}
+	err = snd_pcm_hw_params_set_buffer_time_near(handle, params,
+					     &rec->buffer_time, 0);
+	if (err < 0) {
+		dbg("set buffer time failed");
+		return err;
+	}
+	err = snd_pcm_hw_params_get_period_size(params, &size, 0);
+	if (err < 0) {
+		dbg("get period size fail");
+		return err;
+	}
+	rec->period_frames = size; 
+	err = snd_pcm_hw_params_get_buffer_size(params, &size);
+	if (size == rec->period_frames) {
+		dbg("Can't use period equal to buffer size (%lu == %lu)",
+				      size, rec->period_frames);
+		return -EINVAL;
+	}
+	rec->buffer_frames = size;
+	rec->bits_per_frame = wavfmt->wBitsPerSample * channels;
+
+	/* the callback gets chunk_time worth of audio whatever the period */
+	if (rec->timing.chunk_time)
+		rec->chunk_frames = (size_t)rate * rec->timing.chunk_time / 1000000;
+	else
+		rec->chunk_frames = rec->period_frames;
+	if (rec->chunk_frames == 0)
+		rec->chunk_frames = rec->period_frames;
+	dbg("capture: period %luus buffer %luus chunk %lu frames, %s access\n",
+			(unsigned long)rec->period_time, (unsigned long)rec->buffer_time,
+			(unsigned long)rec->chunk_frames, rec->mmap_access ? "mmap" : "rw");
+
+	/* set to driver */
+	err = snd_pcm_hw_params(handle, params);
+	if (err < 0) {
+		dbg("Unable to install hw params:");
+		return err;
+	}
+	return 0;
+}
+static int set_swparams(struct recorder * rec)
+{
+	int err;
+	snd_pcm_sw_params_t *swparams;
+	snd_pcm_t * handle = (snd_pcm_t*)(rec->wavein_hdl);
+	/* sw para */
+	snd_pcm_sw_params_alloca(&swparams);
+	err = snd_pcm_sw_params_current(handle, swparams);
+	if (err < 0) {
+		dbg("get current sw para fail");
+		return err;
+	}
+
+	err = snd_pcm_sw_params_set_avail_min(handle, swparams, 
+						rec->period_frames);
+	if (err < 0) {
+		dbg("set avail min failed");
+		return err;
+	}
+	/* set a value bigger than the buffer frames to prevent the auto start.
+	 * we use the snd_pcm_start to explicit start the pcm */
+	err = snd_pcm_sw_params_set_start_threshold(handle, swparams, 
+			rec->buffer_frames * 2);
+	if (err < 0) {
+		dbg("set start threshold fail");
+		return err;
+	}
+	/* CLOCK_MONOTONIC timestamps align capture with the echo reference;
+	 * without them pcm_read falls back to the time it wakes up */
+	if (snd_pcm_sw_params_set_tstamp_mode(handle, swparams,
+				SND_PCM_TSTAMP_ENABLE) < 0
+			|| snd_pcm_sw_params_set_tstamp_type(handle, swparams,
+				SND_PCM_TSTAMP_TYPE_MONOTONIC) < 0)
+		dbg("no monotonic capture timestamps\n");
+
+	if ( (err = snd_pcm_sw_params(handle, swparams)) < 0) {
+		dbg("unable to install sw params:");
+		return err;
+	}
+	return 0;
+}
+
+static void free_convert(struct recorder *rec)
+{
+	if (rec->aec) {
+		aec_free((struct aec *)rec->aec);
+		free(rec->aec);
+		rec->aec = NULL;
+	}
+	if (rec->aecbuf) {
+		free(rec->aecbuf);
+		rec->aecbuf = NULL;
+	}
+	if (rec->beamformer) {
+		beamformer_free((struct beamformer *)rec->beamformer);
+		free(rec->beamformer);
+		rec->beamformer = NULL;
+	}
+	if (rec->resampler) {
+		resampler_free((struct resampler *)rec->resampler);
+		free(rec->resampler);
+		rec->resampler = NULL;
+	}
+	if (rec->mixbuf) {
+		free(rec->mixbuf);
+		rec->mixbuf = NULL;
+	}
+	if (rec->convbuf) {
+		free(rec->convbuf);
+		rec->convbuf = NULL;
+	}
+}
+
+/* set up the downmix and resampling from the format set_hwparams got
+ * to the one that was asked for, then echo cancellation */
+static int prepare_convert(struct recorder *rec, const WAVEFORMATEX *fmt)
+{
+	struct resampler *r = NULL;
+	struct beamformer *bf;
+	struct aec *a;
+	unsigned long max_out = rec->chunk_frames;
+
+	if (rec->dev_channels != fmt->nChannels) {
+		rec->mixbuf = (short *)malloc(rec->chunk_frames * sizeof(short));
+		if (!rec->mixbuf)
+			goto nomem;
+	}
+	if (rec->mixbuf && rec->beamform && rec->capture_channel < 0) {
+		bf = (struct beamformer *)malloc(sizeof(struct beamformer));
+		if (!bf)
+			goto nomem;
+		if (beamformer_init(bf, rec->dev_channels, rec->dev_rate,
+					rec->chunk_frames) == 0) {
+			rec->beamformer = bf;
+		} else {
+			free(bf);
+			xlog(XLOG_WARN, "can't beamform %u channels, averaging them\n",
+					rec->dev_channels);
+		}
+	}
+	if (rec->dev_rate != fmt->nSamplesPerSec) {
+		r = (struct resampler *)malloc(sizeof(struct resampler));
+		if (!r)
+			goto nomem;
+		if (resampler_init(r, rec->dev_rate, fmt->nSamplesPerSec,
+					rec->chunk_frames) != 0) {
+			free(r);
+			free_convert(rec);
+			dbg("Rate mismatch, can't resample %u to %u\n",
+					rec->dev_rate, fmt->nSamplesPerSec);
+			return -EINVAL;
+		}
+		rec->resampler = r;
+		max_out = resampler_max_out(r, rec->chunk_frames);
+		rec->convbuf = (short *)malloc(max_out * sizeof(short));
+		if (!rec->convbuf)
+			goto nomem;
+	}
+	if (echo_ref_enabled() && fmt->nSamplesPerSec == ECHO_REF_RATE
+			&& fmt->nChannels == 1 && fmt->wBitsPerSample == 16) {
+		a = (struct aec *)malloc(sizeof(struct aec));
+		if (!a)
+			goto nomem;
+		if (aec_init(a) != 0) {
+			free(a);
+			goto nomem;
+		}
+		rec->aec = a;
+		rec->aecbuf = (short *)malloc((max_out + AEC_BLOCK) * sizeof(short));
+		if (!rec->aecbuf)
+			goto nomem;
+		/* the filters delay the audio by half their length */
+		rec->conv_delay_us = 0;
+		if (r)
+			rec->conv_delay_us += (unsigned long long)r->taps / 2
+				* 1000000 / rec->dev_rate;
+		if (rec->beamformer)
+			rec->conv_delay_us += (unsigned long long)
+				((struct beamformer *)rec->beamformer)->max_lag
+				* 1000000 / rec->dev_rate;
+	}
+	if (rec->aec)
+		dbg("capture: echo cancellation on, %u us conversion delay\n",
+				rec->conv_delay_us);
+	if (rec->mixbuf || rec->resampler)
+		dbg("capture: device %u Hz x%u, converting to %u Hz mono%s\n",
+				rec->dev_rate, rec->dev_channels, fmt->nSamplesPerSec,
+				rec->beamformer ? " by beamforming"
+				: rec->mixbuf && rec->capture_channel >= 0
+				? " from one channel" : "");
+	return 0;
+nomem:
+	free_convert(rec);
+	return -ENOMEM;
+}
+
+static int set_params(struct recorder *rec, WAVEFORMATEX *fmt,
+		unsigned int buffertime, unsigned int periodtime)
+{
+	int err;
+	WAVEFORMATEX defmt = DEFAULT_FORMAT;
+	
+	if (fmt == NULL) {
+		fmt = &defmt;
+	}
+	err = set_hwparams(rec, fmt, buffertime, periodtime);
+	if (err)
+		return err;
+	err = set_swparams(rec);
+	if (err)
+		return err;
+	return prepare_convert(rec, fmt);
+}
+
+/*
+ *   Underrun and suspend recovery
+ */
+ 
+static int xrun_recovery(snd_pcm_t *handle, int err)
+{
+	if (err == -EPIPE) {	/* over-run */
+		metric_inc(&m_overruns);
+		if (show_xrun)
+			xlog(XLOG_WARN, "!!!!!!overrun happend!!!!!!\n");
+
+		err = snd_pcm_prepare(handle);
+		if (err < 0) {
+			if (show_xrun)
+				xlog(XLOG_ERROR, "Can't recovery from overrun,"
+				"prepare failed: %s\n", snd_strerror(err));
+			return err;
+		}
+		return 0;
+	} else if (err == -ESTRPIPE) {
+		while ((err = snd_pcm_resume(handle)) == -EAGAIN)
+			usleep(200000);	/* wait until the suspend flag is released */
+		if (err < 0) {
+			err = snd_pcm_prepare(handle);
+			if (err < 0) {
+				if (show_xrun)
+					xlog(XLOG_ERROR, "Can't recovery from suspend,"
+					"prepare failed: %s\n", snd_strerror(err));
+				return err;
+			}
+		}
+		return 0;
+	}
+	return err;
+}
+/* recover from xrun/suspend and restart; a recovered capture pcm is
+ * PREPARED and would never raise a poll event */
+static int pcm_recover(snd_pcm_t *handle, int err)
+{
+	if (xrun_recovery(handle, err) < 0)
+		return -1;
+	if (snd_pcm_state(handle) == SND_PCM_STATE_PREPARED
+			&& snd_pcm_start(handle) < 0)
+		return -1;
+	return 0;
+}
+
+/* downmix and resample one chunk to the requested format in place of
+ * *data; returns its length in bytes */
+static unsigned long convert_chunk(struct recorder *rec, char **data)
+{
+	const short *mono = (const short *)*data;
+	unsigned long n = rec->chunk_frames;
+
+	if (rec->beamformer) {
+		beamformer_process((struct beamformer *)rec->beamformer, mono, n,
+				rec->mixbuf);
+		mono = rec->mixbuf;
+		*data = (char *)rec->mixbuf;
+	} else if (rec->mixbuf) {
+		pcm_downmix_s16(mono, n, rec->dev_channels, rec->capture_channel,
+				rec->mixbuf);
+		mono = rec->mixbuf;
+		*data = (char *)rec->mixbuf;
+	}
+	if (rec->resampler) {
+		n = resampler_process((struct resampler *)rec->resampler, mono, n,
+				rec->convbuf);
+		*data = (char *)rec->convbuf;
+	}
+	return n * sizeof(short);
+}
+
+static void deliver_chunk(struct recorder *rec, char *data)
+{
+	unsigned long len = rec->chunk_frames * rec->bits_per_frame / 8;
+	int64_t behind = (int64_t)(rec->anchor_frame - rec->frames_delivered);
+	uint64_t chunk_us;
+
+	/* capture time of the chunk's first frame */
+	chunk_us = rec->anchor_us - behind * 1000000 / (int64_t)rec->dev_rate;
+	rec->frames_delivered += rec->chunk_frames;
+
+	metric_inc(&m_chunks);
+	if (rec->mixbuf || rec->resampler)
+		len = convert_chunk(rec, &data);
+	if (rec->aec) {
+		len = aec_process((struct aec *)rec->aec, (const int16_t *)data,
+				len / sizeof(short), chunk_us - rec->conv_delay_us,
+				rec->aecbuf) * sizeof(short);
+		data = (char *)rec->aecbuf;
+		if (len == 0)
+			return;
+	}
+	if (rec->on_data_ind)
+		rec->on_data_ind(data, len, rec->user_cb_para);
+}
+
+/* the callback may have called stop_record, which drops the pcm */
+static int stopped_in_callback(struct recorder *rec)
+{
+	return rec->state < RECORD_STATE_RECORDING;
+}
+
+/* RW access: copy whatever is available into audiobuf */
+static int pcm_read_rw(struct recorder *rec)
+{
+	snd_pcm_sframes_t r;
+	size_t bytes_per_frame = rec->bits_per_frame / 8;
+	snd_pcm_t *handle = (snd_pcm_t *)rec->wavein_hdl;
+
+	while (1) {
+		r = snd_pcm_readi(handle, rec->audiobuf + rec->chunk_fill * bytes_per_frame,
+				rec->chunk_frames - rec->chunk_fill);
+		if (r == -EAGAIN || r == 0)
+			return 0;
+		if (r < 0)
+			return pcm_recover(handle, r);
+
+		rec->chunk_fill += r;
+		if (rec->chunk_fill == rec->chunk_frames) {
+			rec->chunk_fill = 0;
+			deliver_chunk(rec, rec->audiobuf);
+			if (stopped_in_callback(rec))
+				return 0;
+		}
+	}
+}
+
+/* MMAP access: whole chunks that are contiguous in the DMA ring are
+ * handed to the callback in place; only the pieces split by the ring
+ * wrap or by a period boundary go through audiobuf */
+static int pcm_read_mmap(struct recorder *rec)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames, done, n;
+	snd_pcm_sframes_t avail, committed;
+	size_t bytes_per_frame = rec->bits_per_frame / 8;
+	snd_pcm_t *handle = (snd_pcm_t *)rec->wavein_hdl;
+	char *src;
+	int err;
+
+	while (1) {
+		avail = snd_pcm_avail_update(handle);
+		if (avail < 0)
+			return pcm_recover(handle, avail);
+		if (avail == 0)
+			return 0;
+
+		frames = avail;
+		err = snd_pcm_mmap_begin(handle, &areas, &offset, &frames);
+		if (err < 0)
+			return pcm_recover(handle, err);
+
+		src = (char *)areas[0].addr
+			+ (areas[0].first + offset * areas[0].step) / 8;
+		for (done = 0; done < frames; done += n) {
+			if (rec->chunk_fill == 0 && frames - done >= rec->chunk_frames) {
+				n = rec->chunk_frames;
+				metric_inc(&m_zero_copy);
+				deliver_chunk(rec, src + done * bytes_per_frame);
+				/* nothing to commit into a dropped pcm */
+				if (stopped_in_callback(rec))
+					return 0;
+				continue;
+			}
+			n = rec->chunk_frames - rec->chunk_fill;
+			if (n > frames - done)
+				n = frames - done;
+			memcpy(rec->audiobuf + rec->chunk_fill * bytes_per_frame,
+					src + done * bytes_per_frame, n * bytes_per_frame);
+			rec->chunk_fill += n;
+			if (rec->chunk_fill == rec->chunk_frames) {
+				rec->chunk_fill = 0;
+				deliver_chunk(rec, rec->audiobuf);
+				if (stopped_in_callback(rec))
+					return 0;
+			}
+		}
+
+		committed = snd_pcm_mmap_commit(handle, offset, frames);
+		if (committed < 0 || (snd_pcm_uframes_t)committed != frames)
+			return pcm_recover(handle, committed >= 0 ? -EPIPE : committed);
+	}
+}
+
+/* note when the frames now available were captured: the newest one at
+ * the ALSA timestamp, or at the time we woke up if there is none */
+static void pcm_stamp(struct recorder *rec)
+{
+	snd_pcm_t *handle = (snd_pcm_t *)rec->wavein_hdl;
+	snd_pcm_uframes_t avail;
+	snd_pcm_sframes_t r;
+	snd_htimestamp_t ts;
+	uint64_t now = metrics_now_us(), us = 0;
+
+	if (snd_pcm_htimestamp(handle, &avail, &ts) == 0) {
+		us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+		/* zero, or on another clock */
+		if (us > now || now - us > 1000000)
+			us = 0;
+	}
+	if (us == 0) {
+		r = snd_pcm_avail_update(handle);
+		if (r < 0)
+			return;
+		avail = r;
+		us = now;
+	}
+	rec->anchor_frame = rec->frames_delivered + rec->chunk_fill + avail;
+	rec->anchor_us = us;
+}
+
+/* consume all available frames without blocking.
+ * returns -1 if the device is gone */
+static int pcm_read(struct recorder *rec)
+{
+	if (!rec->wavein_hdl)
+		return -1;
+	if (rec->aec)
+		pcm_stamp(rec);
+	if (rec->mmap_access)
+		return pcm_read_mmap(rec);
+	return pcm_read_rw(rec);
+}
+
+static void ctrl_signal(struct recorder *rec)
+{
+	uint64_t one = 1;
+
+	if (write(rec->ctrl_fd, &one, sizeof(one)) < 0)
+		return;	/* counter saturated, the thread is awake anyway */
+}
+
+static void ctrl_clear(struct recorder *rec)
+{
+	uint64_t v;
+
+	if (read(rec->ctrl_fd, &v, sizeof(v)) < 0)
+		return;
+}
+
+/* sleep until pcm data or a control command arrives; returns 1 when the
+ * pcm may be readable */
+static int wait_for_event(struct recorder *rec, int recording)
+{
+	struct pollfd *pfds = (struct pollfd *)rec->pollfds;
+	unsigned short revents = 0;
+	unsigned int nfds = recording ? rec->pollfd_count + 1 : 1;
+	int err;
+
+	do {
+		err = poll(pfds, nfds, -1);
+	} while (err < 0 && errno == EINTR);
+	if (err < 0)
+		return 0;
+
+	if (pfds[0].revents & POLLIN)
+		ctrl_clear(rec);
+	if (!recording)
+		return 0;
+
+	snd_pcm_poll_descriptors_revents((snd_pcm_t *)rec->wavein_hdl,
+			pfds + 1, rec->pollfd_count, &revents);
+	return (revents & (POLLIN | POLLERR)) ? 1 : 0;
+}
+
+static void * record_thread_proc(void * para)
+{
+	struct recorder * rec = (struct recorder *) para;
+	sigset_t mask, oldmask;
+	struct rt_jitter jitter;
+	int recording = 0;
+
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+	rt_jitter_init(&jitter, rec->period_time, &m_jitter);
+
+	while(1) {
+
+		/* closing, exit the thread */
+		if (rec->state == RECORD_STATE_CLOSING){
+			dbg("capture jitter max %lluus\n",
+					(unsigned long long)jitter.max_us);
+			break;
+        }
+
+		if (rec->state < RECORD_STATE_RECORDING) {
+			recording = 0;
+			jitter.last_us = 0;
+			wait_for_event(rec, 0);
+			continue;
+		}
+		if (!recording) {
+			recording = 1;
+			rec->chunk_fill = 0;
+			if (rec->resampler)
+				resampler_reset((struct resampler *)rec->resampler);
+			if (rec->beamformer)
+				beamformer_reset((struct beamformer *)rec->beamformer);
+			if (rec->aec)
+				aec_reset((struct aec *)rec->aec);
+			rec->frames_delivered = 0;
+			rec->anchor_frame = 0;
+			rec->anchor_us = metrics_now_us();
+		}
+
+		if (!wait_for_event(rec, 1))
+			continue;
+		/* stop_record may have dropped the pcm while we were waiting */
+		if (rec->state < RECORD_STATE_RECORDING)
+			continue;
+
+		rt_jitter_tick(&jitter);
+		if (pcm_read(rec) < 0) {
+			/* a stop_record racing the read fails it with -EBADFD;
+			 * only a pcm that is still meant to run is gone */
+			if (rec->state < RECORD_STATE_RECORDING)
+				continue;
+			return NULL;
+		}
+	}
+	return rec;
+
+}
+static int create_record_thread(void * para, pthread_t * tidp)
+{
+	int err;
+	err = rt_thread_create(tidp, RT_ROLE_CAPTURE, record_thread_proc, (void *)para);
+	if (err != 0)
+		return err;
+
+	return 0;
+}
+
+#if 0 /* don't use it now... cuz only one buffer supported */
+static void free_rec_buffer(struct recorder * rec)
+{
+	if (rec->bufheader) {
+		unsigned int i;
+		struct bufinfo *info = (struct bufinfo *) rec->bufheader;
+
+		assert(rec->bufcount > 0);
+		for (i = 0; i < rec->bufcount; ++i) {
+			if (info->data) {
+				free(info->data);
+				info->data = NULL;
+				info->bufsize = 0;
+				info->audio_bytes = 0;
+			}
+			info++;
+		}
+		free(rec->bufheader);
+		rec->bufheader = NULL;
+	}
+	rec->bufcount = 0;
+}
+
+static int prepare_rec_buffer(struct recorder * rec )
+{
+	struct bufinfo *buffers;
+	unsigned int i;
+	int err;
+	size_t sz;
+
+	/* the read and QISRWrite is blocked, currently only support one buffer,
+	 * if overrun too much, need more buffer and another new thread
+	 * to write the audio to network */
+	rec->bufcount = 1;
+	sz = sizeof(struct bufinfo)*rec->bufcount;
+	buffers=(struct bufinfo*)malloc(sz);
+	if (!buffers) {
+		rec->bufcount = 0;
+		goto fail;
+	}
+	memset(buffers, 0, sz);
+	rec->bufheader = buffers;
+
+	for (i = 0; i < rec->bufcount; ++i) {
+		buffers[i].bufsize = 
+			(rec->period_frames * rec->bits_per_frame / 8);
+		buffers[i].data = (char *)malloc(buffers[i].bufsize);
+		if (!buffers[i].data) {
+			buffers[i].bufsize = 0;
+			goto fail;
+		}
+		buffers[i].audio_bytes = 0;
+	}
+	return 0;
+fail:
+	free_rec_buffer(rec);
+	return -ENOMEM;
+}
+#else
+static void free_rec_buffer(struct recorder * rec)
+{
+	if (rec->audiobuf) {
+		free(rec->audiobuf);
+		rec->audiobuf = NULL;
+	}
+}
+
+static int prepare_rec_buffer(struct recorder * rec )
+{
+	/* the read and QISRWrite is blocked, currently only support one buffer,
+	 * if overrun too much, need more buffer and another new thread
+	 * to write the audio to network */
+	size_t sz = (rec->chunk_frames * rec->bits_per_frame / 8);
+	rec->audiobuf = (char *)malloc(sz);
+	if(!rec->audiobuf)
+		return -ENOMEM;
+	return 0;
+}
+#endif
+
+static void free_poll(struct recorder *rec)
+{
+	if (rec->ctrl_fd >= 0) {
+		close(rec->ctrl_fd);
+		rec->ctrl_fd = -1;
+	}
+	if (rec->pollfds) {
+		free(rec->pollfds);
+		rec->pollfds = NULL;
+	}
+	rec->pollfd_count = 0;
+}
+
+/* slot 0 is the control eventfd, the pcm descriptors follow */
+static int prepare_poll(struct recorder *rec)
+{
+	snd_pcm_t *handle = (snd_pcm_t *)rec->wavein_hdl;
+	struct pollfd *pfds;
+	int count;
+
+	count = snd_pcm_poll_descriptors_count(handle);
+	if (count <= 0)
+		return -EINVAL;
+
+	pfds = (struct pollfd *)calloc(count + 1, sizeof(struct pollfd));
+	if (!pfds)
+		return -ENOMEM;
+	rec->pollfds = pfds;
+
+	rec->ctrl_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (rec->ctrl_fd < 0) {
+		free_poll(rec);
+		return -errno;
+	}
+	pfds[0].fd = rec->ctrl_fd;
+	pfds[0].events = POLLIN;
+
+	if (snd_pcm_poll_descriptors(handle, pfds + 1, count) != count) {
+		free_poll(rec);
+		return -EINVAL;
+	}
+	rec->pollfd_count = count;
+	return 0;
+}
+
+static int open_recorder_internal(struct recorder * rec, 
+		record_dev_id dev, WAVEFORMATEX * fmt)
+{
+	int err = 0;
+
+	err = snd_pcm_open((snd_pcm_t **)&rec->wavein_hdl, dev.u.name, 
+			SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK);
+	if(err < 0)
+		goto fail;
+
+	err = set_params(rec, fmt, rec->timing.buffer_time, rec->timing.period_time);
+	if(err)
+		goto fail;
+
+	assert(rec->bufheader == NULL);
+	err = prepare_rec_buffer(rec);
+	if(err)
+		goto fail;
+
+	err = prepare_poll(rec);
+	if(err)
+		goto fail;
+
+	err = create_record_thread((void*)rec, 
+			&rec->rec_thread);
+	if(err)
+		goto fail;
+	
+
+	return 0;
+fail:
+	if(rec->wavein_hdl)
+		snd_pcm_close((snd_pcm_t *) rec->wavein_hdl);
+	rec->wavein_hdl = NULL;
+	free_rec_buffer(rec);
+	free_poll(rec);
+	free_convert(rec);
+	return err;
+}
+
+static void close_recorder_internal(struct recorder *rec)
+{
+	snd_pcm_t * handle;
+
+	handle = (snd_pcm_t *) rec->wavein_hdl;
+
+	/* the thread sleeps in poll on the control fd, wake it to see CLOSING */
+	ctrl_signal(rec);
+
+	/* wait for the pcm thread quit first */
+	pthread_join(rec->rec_thread, NULL);
+
+	if(handle) {
+		snd_pcm_close(handle);
+		rec->wavein_hdl = NULL;
+	}
+	free_rec_buffer(rec);
+	free_poll(rec);
+	free_convert(rec);
+}
+/* return the count of pcm device */
+/* list all cards */
+static int get_pcm_device_cnt(snd_pcm_stream_t stream)
+{
+	void **hints, **n;
+	char *io, *name;
+    const char *filter;
+	int cnt = 0;
+
+	if (snd_device_name_hint(-1, "pcm", &hints) < 0)
+		return 0;
+	n = hints;
+	filter = stream == SND_PCM_STREAM_CAPTURE ? "Input" : "Output";
+	while (*n != NULL) {
+		io = snd_device_name_get_hint(*n, "IOID");
+		name = snd_device_name_get_hint(*n, "NAME");
+		if (name && (io == NULL || strcmp(io, filter) == 0))
+			cnt ++;
+		if (io != NULL)
+			free(io);
+		if (name != NULL)
+			free(name);
+		n++;
+	}
+	snd_device_name_free_hint(hints);
+	return cnt;
+}
+
+static void free_name_desc(char **name_or_desc) 
+{
+	char **ss;
+	ss = name_or_desc;
+	if(NULL == name_or_desc)
+		return;
+	while(*name_or_desc) {
+		free(*name_or_desc);
+		*name_or_desc = NULL;
+		name_or_desc++;
+	}
+	free(ss);
+}
+/* return success: total count, need free the name and desc buffer 
+ * fail: -1 , *name_out and *desc_out will be NULL */
+static int list_pcm(snd_pcm_stream_t stream, char**name_out, 
+						char ** desc_out)
+{
+	void **hints, **n;
+	char **name, **descr;
+	char *io;
+	const char *filter;
+	int cnt = 0;
+	int i = 0;
+
+	if (snd_device_name_hint(-1, "pcm", &hints) < 0)
+		return 0;
+	n = hints;
+	cnt = get_pcm_device_cnt(stream);
+	if(!cnt) {
+		goto fail; 
+	}
+
+	*name_out = (char*)calloc(sizeof(char *) , (1+cnt));
+	if (*name_out == NULL)
+		goto fail;
+	*desc_out = (char*)calloc(sizeof(char *) , (1 + cnt));
+	if (*desc_out == NULL)
+		goto fail;
+
+	/* the last one is a flag, NULL */
+	name_out[cnt] = NULL;
+	desc_out[cnt] = NULL;
+	name = name_out;
+	descr = desc_out;
+
+	filter = stream == SND_PCM_STREAM_CAPTURE ? "Input" : "Output";
+	while (*n != NULL && i < cnt) {
+		*name = snd_device_name_get_hint(*n, "NAME");
+		*descr = snd_device_name_get_hint(*n, "DESC");
+		io = snd_device_name_get_hint(*n, "IOID");
+		if (name == NULL || 
+			(io != NULL && strcmp(io, filter) != 0) ){
+			if (*name) free(*name);
+			if (*descr) free(*descr);
+		} else {
+			if (*descr == NULL) {
+				*descr = (char*)malloc(4);
+				memset(*descr, 0, 4);
+			}
+			name++;
+			descr++;
+			i++;
+		}
+		if (io != NULL)
+			free(io);
+		n++;
+	}
+	snd_device_name_free_hint(hints);
+	return cnt;
+fail:
+	free_name_desc(name_out);
+	free_name_desc(desc_out);
+	snd_device_name_free_hint(hints);
+	return -1;
+}
+/* -------------------------------------
+ * Interfaces 
+ --------------------------------------*/ 
+/* the device id is a pcm string name in linux */
+record_dev_id  get_default_input_dev()
+{
+	record_dev_id id; 
+	const char *env = getenv("XIUXIU_CAPTURE_DEVICE");
+
+	/* e.g. hw:1,0 to skip the plug layer entirely */
+	id.u.name = env && *env ? (char *)env : (char *)"default";
+	return id;
+}
+
+record_dev_id * list_input_device() 
+{
+	// TODO: unimplemented
+	return NULL;
+}
+
+int get_input_dev_num()
+{
+	return get_pcm_device_cnt(SND_PCM_STREAM_CAPTURE);
+}
+
+
+/* $XIUXIU_CAPTURE_PROFILE picks the profile of recorders that don't set one */
+static int rec_profile_default()
+{
+	const char *env = getenv("XIUXIU_CAPTURE_PROFILE");
+	int p = rec_profile_from_name(env);
+
+	if (p < 0) {
+		if (env && *env)
+			xlog(XLOG_WARN, "XIUXIU_CAPTURE_PROFILE: unknown profile \"%s\"\n", env);
+		p = REC_PROFILE_BALANCED;
+	}
+	return p;
+}
+
+int rec_profile_from_name(const char *name)
+{
+	int i;
+
+	if (!name)
+		return -1;
+	for (i = 0; i < REC_PROFILE_MAX; i++)
+		if (strcmp(name, rec_profile_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+int set_recorder_profile(struct recorder *rec, int profile)
+{
+	if (!rec || profile < 0 || profile >= REC_PROFILE_MAX)
+		return -RECORD_ERR_INVAL;
+	return set_recorder_timing(rec, &rec_profiles[profile]);
+}
+
+int set_recorder_timing(struct recorder *rec, const struct rec_timing *timing)
+{
+	if (!rec || !timing)
+		return -RECORD_ERR_INVAL;
+	/* takes effect on the next open_recorder */
+	if (rec->state >= RECORD_STATE_READY)
+		return -RECORD_ERR_GENERAL;
+	rec->timing = *timing;
+	return 0;
+}
+
+/* callback will be run on a new thread */
+int create_recorder(struct recorder ** out_rec, 
+				void (*on_data_ind)(char *data, unsigned long len, void *user_cb_para), 
+				void* user_cb_para)
+{
+	struct recorder * myrec;
+	const char *env;
+	myrec = (struct recorder *)malloc(sizeof(struct recorder));
+	if(!myrec)
+		return -RECORD_ERR_MEMFAIL;
+
+	memset(myrec, 0, sizeof(struct recorder));
+	myrec->on_data_ind = on_data_ind;
+	myrec->user_cb_para = user_cb_para;
+	myrec->state = RECORD_STATE_CREATED;
+	myrec->ctrl_fd = -1;
+	env = getenv("XIUXIU_CAPTURE_CHANNEL");
+	myrec->capture_channel = env && *env ? atoi(env) : -1;
+	env = getenv("XIUXIU_BEAMFORM");
+	myrec->beamform = env && strcmp(env, "1") == 0;
+	myrec->timing = rec_profiles[rec_profile_default()];
+
+	*out_rec = myrec;
+	return 0;
+}
+
+void destroy_recorder(struct recorder *rec)
+{
+	if(!rec)
+		return;
+
+	free(rec);
+}
+
+int open_recorder(struct recorder * rec, record_dev_id dev, WAVEFORMATEX * fmt)
+{
+	int ret = 0;
+	if(!rec )
+		return -RECORD_ERR_INVAL;
+	if(rec->state >= RECORD_STATE_READY)
+		return 0;
+
+	ret = open_recorder_internal(rec, dev, fmt);
+	if(ret == 0)
+		rec->state = RECORD_STATE_READY;
+	return 0;
+
+}
+
+void close_recorder(struct recorder *rec)
+{
+	if(rec == NULL || rec->state < RECORD_STATE_READY)
+		return;
+	if(rec->state == RECORD_STATE_RECORDING)
+		stop_record(rec);
+
+	rec->state = RECORD_STATE_CLOSING;
+
+	close_recorder_internal(rec);
+
+	rec->state = RECORD_STATE_CREATED;	
+}
+
+int start_record(struct recorder * rec)
+{
+	int ret;
+	if(rec == NULL)
+		return -RECORD_ERR_INVAL;
+	if( rec->state < RECORD_STATE_READY)
+		return -RECORD_ERR_NOT_READY;
+	if( rec->state == RECORD_STATE_RECORDING)
+		return 0;
+
+	ret = start_record_internal((snd_pcm_t *)rec->wavein_hdl);
+	if(ret == 0) {
+		rec->state = RECORD_STATE_RECORDING;
+		ctrl_signal(rec);
+	}
+	return ret;
+}
+
+int stop_record(struct recorder * rec)
+{
+	int ret;
+	if(rec == NULL)
+		return -RECORD_ERR_INVAL;
+	if( rec->state < RECORD_STATE_RECORDING)
+		return 0;
+
+	rec->state = RECORD_STATE_STOPPING;
+	ret = stop_record_internal((snd_pcm_t *)rec->wavein_hdl);
+	if(ret == 0) {		
+		rec->state = RECORD_STATE_READY;
+	}
+	ctrl_signal(rec);
+	return ret;
+}
+
+int is_record_stopped(struct recorder *rec)
+{
+	if(rec->state == RECORD_STATE_RECORDING)
+		return 0;
+
+	return is_stopped_internal(rec);
+}
@@ -33,6 +33,23 @@ enum {
 	RECORD_ERR_NOT_READY
 };
 
+/* capture sizing. period_time is the ALSA wakeup interval; chunk_time
+ * is how much audio each on_data_ind call carries, re-chunked from the
+ * periods so consumers don't see the device's period size. 0 picks the
+ * device default for buffer/period and one period per chunk. */
+struct rec_timing {
+	unsigned int buffer_time;	/* us */
+	unsigned int period_time;	/* us */
+	unsigned int chunk_time;	/* us */
+};
+
+enum rec_profile {
+	REC_PROFILE_BALANCED,		/* 500 ms buffer, 100 ms periods and chunks */
+	REC_PROFILE_LOW_LATENCY,	/* 80 ms buffer, 10 ms periods, 20 ms chunks */
+	REC_PROFILE_POWER_SAVE,		/* 1 s buffer, 250 ms periods and chunks */
+	REC_PROFILE_MAX
+};
+
 typedef struct {
 	union {
 		char *	name;
@@ -57,7 +74,28 @@ struct recorder {
 	unsigned int bufcount; 
 	
 	char *audiobuf;
+	struct rec_timing timing;	/* requested sizing, see set_recorder_profile */
+	size_t chunk_frames;		/* frames per on_data_ind call */
+	size_t chunk_fill;		/* frames already in audiobuf */
+	int ctrl_fd;			/* eventfd waking the thread on start/stop/close */
+	void * pollfds;			/* ctrl_fd followed by the pcm poll descriptors */
+	unsigned int pollfd_count;	/* pcm descriptors only */
+	int mmap_access;		/* 1: SND_PCM_ACCESS_MMAP_INTERLEAVED, 0: RW */
 	int bits_per_frame;
+	unsigned int dev_rate;		/* device format, may differ from the request */
+	unsigned int dev_channels;
+	int capture_channel;		/* kept when downmixing, -1 averages all */
+	int beamform;			/* capture every channel and beamform them */
+	void * beamformer;		/* struct beamformer, replaces the average */
+	void * resampler;		/* struct resampler, NULL if the rates match */
+	short * mixbuf;			/* one chunk downmixed to mono */
+	short * convbuf;		/* one chunk at the requested rate */
+	void * aec;			/* struct aec, NULL if echo cancellation is off */
+	short * aecbuf;			/* one chunk after echo cancellation */
+	unsigned int conv_delay_us;	/* delay added by the conversion */
+	unsigned long long anchor_us;	/* capture time of frame anchor_frame */
+	unsigned long long anchor_frame;
+	unsigned long long frames_delivered;
 	unsigned int buffer_time;
 	unsigned int period_time;
 	size_t period_frames;
@@ -72,7 +110,7 @@ extern "C" {
  * @fn
  * @brief	Get the default input device ID
  *
- * @return	returns "default" in linux.
+ * @return	returns $XIUXIU_CAPTURE_DEVICE, or "default" in linux.
  *
  */
 record_dev_id get_default_input_dev();
@@ -101,6 +139,32 @@ int create_recorder(struct recorder ** out_rec,
 				void (*on_data_ind)(char *data, unsigned long len, void *user_para), 
 				void* user_cb_para);
 
+/**
+ * @fn
+ * @brief	Select the capture sizing used by the next open_recorder.
+ *
+ * New recorders start with the profile named by $XIUXIU_CAPTURE_PROFILE
+ * ("balanced", "low-latency" or "power-save"), balanced if unset.
+ * Smaller periods cut wake and VAD latency at the cost of more wakeups.
+ *
+ * @return	int			- Return 0 in success, otherwise return error code.
+ * @param	rec			- [in] recorder object, not open
+ * @param	profile		- [in] one of rec_profile
+ */
+int set_recorder_profile(struct recorder *rec, int profile);
+
+/**
+ * @fn
+ * @brief	Like set_recorder_profile with explicit times.
+ */
+int set_recorder_timing(struct recorder *rec, const struct rec_timing *timing);
+
+/**
+ * @fn
+ * @brief	Map a profile name to rec_profile, -1 if unknown.
+ */
+int rec_profile_from_name(const char *name);
+
 /**
  * @fn 
  * @brief	Destroy recorder object. free memory. 
@@ -115,6 +179,16 @@ void destroy_recorder(struct recorder *rec);
  * @param	rec			- [in] recorder object
  * @param	dev			- [in] device id, from 0.
  * @param	fmt			- [in] record format.
+ *
+ * The device is opened at fmt if it can do it. Otherwise, for 16 bit
+ * mono requests, it is opened at its own rate and channel count and the
+ * recorder converts: $XIUXIU_CAPTURE_CHANNEL picks the channel to keep,
+ * the average of all channels is used if unset, then the audio is
+ * resampled to fmt's rate. ALSA's own rate conversion is disabled.
+ * With $XIUXIU_BEAMFORM=1 all of the device's channels are captured
+ * and beamformed to mono instead, see beamformer.h.
+ * 16 kHz mono capture then has our own playback cancelled from it,
+ * unless $XIUXIU_AEC=0, see aec.h.
  * @see
  * 	get_default_input_dev()
  */
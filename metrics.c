@@ -0,0 +1,260 @@
+/*
+ * @file
+ * @brief metrics registry and Unix socket exporter
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics.h"
+#include "xlog.h"
+
+#define METRICS_DBGON 1
+#if METRICS_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+#define METRICS_BUF_SIZE	(64 * 1024)
+#define METRICS_REQ_WAIT_MS	100
+
+const uint64_t metric_buckets_fast[12] = {
+	50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000
+};
+const uint64_t metric_buckets_slow[12] = {
+	10000, 25000, 50000, 100000, 250000, 500000,
+	1000000, 2000000, 4000000, 8000000, 15000000, 30000000
+};
+
+static struct metric *g_metrics = NULL;
+static pthread_t g_serve_pt;
+static volatile int g_serving = 0;
+static int g_listen_fd = -1;
+static char g_sock_path[108];
+
+void metric_register(struct metric *m)
+{
+	int expected = 0;
+
+	if (!__atomic_compare_exchange_n(&m->registered, &expected, 1, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return;
+
+	m->next = __atomic_load_n(&g_metrics, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&g_metrics, &m->next, m, 1,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+}
+
+void metric_add(struct metric *m, int64_t v)
+{
+	if (!__atomic_load_n(&m->registered, __ATOMIC_RELAXED))
+		metric_register(m);
+	__atomic_add_fetch(&m->value, v, __ATOMIC_RELAXED);
+}
+
+void metric_set(struct metric *m, int64_t v)
+{
+	if (!__atomic_load_n(&m->registered, __ATOMIC_RELAXED))
+		metric_register(m);
+	__atomic_store_n(&m->value, v, __ATOMIC_RELAXED);
+}
+
+int64_t metric_get(struct metric *m)
+{
+	return __atomic_load_n(&m->value, __ATOMIC_RELAXED);
+}
+
+void metric_observe_us(struct metric *m, uint64_t us)
+{
+	int i;
+
+	if (!__atomic_load_n(&m->registered, __ATOMIC_RELAXED))
+		metric_register(m);
+
+	for (i = 0; i < m->nbounds; i++)
+		if (us <= m->bounds[i])
+			break;
+	__atomic_add_fetch(&m->buckets[i], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&m->sum, us, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&m->count, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int format_one(struct metric *m, char *buf, int size)
+{
+	static const char *types[] = { "counter", "gauge", "histogram" };
+	uint64_t cum = 0;
+	int off, i;
+
+	off = snprintf(buf, size, "# HELP %s %s\n# TYPE %s %s\n",
+			m->name, m->help, m->name, types[m->type]);
+	if (off >= size)
+		return size;
+
+	if (m->type != METRIC_HISTOGRAM) {
+		off += snprintf(buf + off, size - off, "%s %lld\n",
+				m->name, (long long)metric_get(m));
+		return off < size ? off : size;
+	}
+
+	for (i = 0; i <= m->nbounds && off < size; i++) {
+		cum += __atomic_load_n(&m->buckets[i], __ATOMIC_RELAXED);
+		if (i < m->nbounds)
+			off += snprintf(buf + off, size - off,
+					"%s_bucket{le=\"%g\"} %llu\n",
+					m->name, m->bounds[i] / 1e6, (unsigned long long)cum);
+		else
+			off += snprintf(buf + off, size - off,
+					"%s_bucket{le=\"+Inf\"} %llu\n",
+					m->name, (unsigned long long)cum);
+	}
+	if (off < size)
+		off += snprintf(buf + off, size - off, "%s_sum %.6f\n%s_count %llu\n",
+				m->name, __atomic_load_n(&m->sum, __ATOMIC_RELAXED) / 1e6,
+				m->name, (unsigned long long)cum);
+	return off < size ? off : size;
+}
+
+int metrics_format(char *buf, int size)
+{
+	struct metric *m;
+	int off = 0;
+
+	for (m = __atomic_load_n(&g_metrics, __ATOMIC_ACQUIRE);
+			m && off < size - 1; m = m->next)
+		off += format_one(m, buf + off, size - off);
+	if (off >= size)
+		off = size - 1;
+	buf[off] = '\0';
+	return off;
+}
+
+static void write_all(int fd, const char *buf, int len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+/* answer HTTP scrapers with a header, plain socat/nc readers without */
+static void serve_client(int fd, char *buf)
+{
+	static const char hdr[] = "HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n\r\n";
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	char req[512];
+	int http = 0;
+	int len;
+
+	if (poll(&pfd, 1, METRICS_REQ_WAIT_MS) > 0
+			&& read(fd, req, sizeof(req)) > 0)
+		http = 1;
+
+	len = metrics_format(buf, METRICS_BUF_SIZE);
+	if (http)
+		write_all(fd, hdr, sizeof(hdr) - 1);
+	write_all(fd, buf, len);
+}
+
+static void *serve_proc(void *arg)
+{
+	char *buf;
+	int fd;
+
+	buf = (char *)malloc(METRICS_BUF_SIZE);
+	if (!buf)
+		return NULL;
+
+	while (g_serving) {
+		fd = accept(g_listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		serve_client(fd, buf);
+		close(fd);
+	}
+	free(buf);
+	return NULL;
+}
+
+int metrics_serve(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (g_serving)
+		return 0;
+
+	if (!path)
+		path = getenv("XIUXIU_METRICS_SOCK");
+	if (!path || !*path)
+		path = METRICS_DEFAULT_SOCK;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -EINVAL;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+			|| listen(fd, 4) < 0) {
+		dbg("metrics: can't listen on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	g_listen_fd = fd;
+	strcpy(g_sock_path, path);
+	g_serving = 1;
+	if (pthread_create(&g_serve_pt, NULL, serve_proc, NULL) != 0) {
+		g_serving = 0;
+		close(fd);
+		unlink(path);
+		g_listen_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void metrics_stop()
+{
+	if (!g_serving)
+		return;
+
+	g_serving = 0;
+	/* wake the blocking accept */
+	shutdown(g_listen_fd, SHUT_RDWR);
+	pthread_join(g_serve_pt, NULL);
+	close(g_listen_fd);
+	g_listen_fd = -1;
+	unlink(g_sock_path);
+}
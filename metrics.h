@@ -0,0 +1,83 @@
+/*
+ * @file
+ * @brief lock-free metrics registry and Prometheus exporter
+ *
+ * Metrics are plain static structs owned by the module that updates
+ * them. Every update is a single atomic operation, so they are safe on
+ * the capture and playback threads. A metric is registered on its first
+ * update (or explicitly by metric_register) and is then exported by
+ * metrics_serve() in Prometheus text format on a local Unix socket:
+ *
+ *	curl --unix-socket /tmp/xiuxiu-metrics.sock http://localhost/metrics
+ *
+ * Histograms observe integer microseconds and are exported in seconds.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#define METRICS_DEFAULT_SOCK	"/tmp/xiuxiu-metrics.sock"
+#define METRIC_MAX_BUCKETS		16
+
+enum metric_type {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM
+};
+
+struct metric {
+	const char *name;
+	const char *help;
+	int type;
+	int64_t value;			/* counter, gauge */
+	const uint64_t *bounds;	/* histogram upper bounds in us, ascending */
+	int nbounds;
+	uint64_t buckets[METRIC_MAX_BUCKETS + 1];	/* last one is +Inf */
+	uint64_t sum;
+	uint64_t count;
+	int registered;
+	struct metric *next;
+};
+
+#define METRIC_COUNTER_DEFINE(var, name, help) \
+	static struct metric var = { name, help, METRIC_COUNTER }
+#define METRIC_GAUGE_DEFINE(var, name, help) \
+	static struct metric var = { name, help, METRIC_GAUGE }
+#define METRIC_HISTOGRAM_DEFINE(var, name, help, bounds) \
+	static struct metric var = { name, help, METRIC_HISTOGRAM, 0, bounds, \
+		(int)(sizeof(bounds) / sizeof(bounds[0])) }
+
+/* bucket sets shared by most latency histograms, in microseconds */
+extern const uint64_t metric_buckets_fast[12];	/* 50us .. 250ms */
+extern const uint64_t metric_buckets_slow[12];	/* 10ms .. 30s */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void metric_register(struct metric *m);
+void metric_add(struct metric *m, int64_t v);
+void metric_set(struct metric *m, int64_t v);
+void metric_observe_us(struct metric *m, uint64_t us);
+uint64_t metrics_now_us();
+
+/* the value of a counter or gauge */
+int64_t metric_get(struct metric *m);
+
+/* write the registry in Prometheus text format; returns bytes used */
+int metrics_format(char *buf, int size);
+
+/* start the exporter thread. path NULL means $XIUXIU_METRICS_SOCK
+ * or METRICS_DEFAULT_SOCK */
+int metrics_serve(const char *path);
+void metrics_stop();
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#define metric_inc(m)	metric_add(m, 1)
+
+#endif
@@ -0,0 +1,387 @@
+/*
+ * @file
+ * @brief spoken replies from templates of cached fragments
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "reply.h"
+#include "tts.h"
+#include "sound_playback.h"
+#include "msp_errors.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define REPLY_DBGON 1
+#if REPLY_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+#define REPLY_SILENCE		300	/* |sample| at or below is silence */
+#define MS_SAMPLES(ms)		(TTS_RATE / 1000 * (ms))
+#define XFADE			MS_SAMPLES(REPLY_XFADE_MS)
+
+METRIC_COUNTER_DEFINE(m_hits, "xiuxiu_reply_cache_hits_total",
+		"Reply fragments played from the fragment cache");
+METRIC_COUNTER_DEFINE(m_misses, "xiuxiu_reply_cache_misses_total",
+		"Fixed reply fragments synthesized because they were not cached");
+METRIC_COUNTER_DEFINE(m_slots, "xiuxiu_reply_slots_total",
+		"Variable reply slots synthesized on demand");
+METRIC_GAUGE_DEFINE(m_bytes, "xiuxiu_reply_cache_bytes",
+		"Audio held by the reply fragment cache");
+
+struct fragment {
+	struct fragment *next;
+	char *text;
+	int16_t *pcm;
+	unsigned long n;
+	uint64_t used;		/* cache.tick of the last use */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct fragment *head;
+	unsigned long bytes;
+	uint64_t tick;
+} cache = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+struct pcm_buf {
+	int16_t *pcm;
+	unsigned long n;
+	unsigned long cap;
+};
+
+static int buf_append(const void *data, unsigned int len, void *user_para)
+{
+	struct pcm_buf *b = (struct pcm_buf *)user_para;
+	unsigned long n = len / sizeof(int16_t), cap;
+	int16_t *pcm;
+
+	if (b->n + n > b->cap) {
+		cap = b->cap ? b->cap * 2 : TTS_RATE;
+		while (cap < b->n + n)
+			cap *= 2;
+		pcm = (int16_t *)realloc(b->pcm, cap * sizeof(int16_t));
+		if (!pcm)
+			return -1;
+		b->pcm = pcm;
+		b->cap = cap;
+	}
+	memcpy(b->pcm + b->n, data, n * sizeof(int16_t));
+	b->n += n;
+	return 0;
+}
+
+/* cut leading and trailing silence down to REPLY_PAD_MS */
+static void trim(int16_t *pcm, unsigned long *n)
+{
+	unsigned long first = 0, last = *n, pad = MS_SAMPLES(REPLY_PAD_MS);
+
+	while (first < last && abs(pcm[first]) <= REPLY_SILENCE)
+		first++;
+	while (last > first && abs(pcm[last - 1]) <= REPLY_SILENCE)
+		last--;
+	if (first == last) {
+		*n = 0;
+		return;
+	}
+	first = first > pad ? first - pad : 0;
+	last = last + pad < *n ? last + pad : *n;
+	memmove(pcm, pcm + first, (last - first) * sizeof(int16_t));
+	*n = last - first;
+}
+
+/* synthesized and trimmed audio of text in *pcm, which the caller frees */
+static int synth_fragment(const char *text, int16_t **pcm, unsigned long *n)
+{
+	struct pcm_buf b = { NULL, 0, 0 };
+	int ret;
+
+	ret = tts_synth(text, TTS_SESSION_PARAMS, buf_append, &b);
+	if (ret != MSP_SUCCESS) {
+		free(b.pcm);
+		return ret;
+	}
+	trim(b.pcm, &b.n);
+	*pcm = b.pcm;
+	*n = b.n;
+	return MSP_SUCCESS;
+}
+
+/* call with the lock held; the least recently used go first */
+static void evict(const struct fragment *keep)
+{
+	struct fragment **pp, **lru, *f;
+
+	while (cache.bytes > REPLY_CACHE_BYTES) {
+		lru = NULL;
+		for (pp = &cache.head; *pp; pp = &(*pp)->next)
+			if (*pp != keep && (!lru || (*pp)->used < (*lru)->used))
+				lru = pp;
+		if (!lru)
+			break;
+		f = *lru;
+		*lru = f->next;
+		cache.bytes -= f->n * sizeof(int16_t);
+		dbg("reply: evicted \"%s\"\n", f->text);
+		free(f->text);
+		free(f->pcm);
+		free(f);
+	}
+	metric_set(&m_bytes, cache.bytes);
+}
+
+/* a copy of the cached audio of text in *pcm; MSP_ERROR_NO_DATA if
+ * it is not cached */
+static int cache_get(const char *text, int16_t **pcm, unsigned long *n)
+{
+	struct fragment *f;
+
+	pthread_mutex_lock(&cache.lock);
+	for (f = cache.head; f; f = f->next)
+		if (strcmp(f->text, text) == 0)
+			break;
+	if (!f) {
+		pthread_mutex_unlock(&cache.lock);
+		return MSP_ERROR_NO_DATA;
+	}
+	f->used = ++cache.tick;
+	*n = f->n;
+	*pcm = (int16_t *)malloc((f->n ? f->n : 1) * sizeof(int16_t));
+	if (*pcm)
+		memcpy(*pcm, f->pcm, f->n * sizeof(int16_t));
+	pthread_mutex_unlock(&cache.lock);
+	return *pcm ? MSP_SUCCESS : MSP_ERROR_OUT_OF_MEMORY;
+}
+
+/* cache a copy of the trimmed audio of text */
+static void cache_put(const char *text, const int16_t *pcm, unsigned long n)
+{
+	struct fragment *f;
+
+	f = (struct fragment *)calloc(1, sizeof(*f));
+	if (!f)
+		return;
+	f->pcm = (int16_t *)malloc((n ? n : 1) * sizeof(int16_t));
+	f->text = strdup(text);
+	if (!f->pcm || !f->text) {
+		free(f->pcm);
+		free(f->text);
+		free(f);
+		return;
+	}
+	memcpy(f->pcm, pcm, n * sizeof(int16_t));
+	f->n = n;
+
+	pthread_mutex_lock(&cache.lock);
+	f->used = ++cache.tick;
+	f->next = cache.head;
+	cache.head = f;
+	cache.bytes += n * sizeof(int16_t);
+	evict(f);
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/* joins fragments with a crossfade, holding back the last XFADE
+ * samples until the next fragment or the end */
+struct joiner {
+	unsigned int queue;	/* from audio_queue_begin */
+	int16_t tail[XFADE];
+	unsigned long tail_n;
+	int stopped;
+};
+
+static void join(struct joiner *j, const int16_t *pcm, unsigned long n)
+{
+	unsigned long xf = j->tail_n < n ? j->tail_n : n, keep, len, i;
+	int16_t *out;
+	float w;
+
+	if (j->stopped || n == 0)
+		return;
+	len = j->tail_n + n - xf;
+	out = (int16_t *)malloc(len * sizeof(int16_t));
+	if (!out) {
+		j->stopped = 1;
+		return;
+	}
+	memcpy(out, j->tail, (j->tail_n - xf) * sizeof(int16_t));
+	for (i = 0; i < xf; i++) {
+		w = (float)(i + 1) / (xf + 1);
+		out[j->tail_n - xf + i] = (int16_t)(j->tail[j->tail_n - xf + i] * (1 - w)
+				+ pcm[i] * w);
+	}
+	memcpy(out + j->tail_n, pcm + xf, (n - xf) * sizeof(int16_t));
+
+	keep = len < XFADE ? len : XFADE;
+	if (len > keep && audio_queue_put(j->queue, (const char *)out,
+				(len - keep) * sizeof(int16_t)) != 0)
+		j->stopped = 1;
+	memcpy(j->tail, out + len - keep, keep * sizeof(int16_t));
+	j->tail_n = keep;
+	free(out);
+}
+
+static void join_end(struct joiner *j)
+{
+	if (!j->stopped && j->tail_n)
+		audio_queue_put(j->queue, (const char *)j->tail, j->tail_n * sizeof(int16_t));
+	j->tail_n = 0;
+}
+
+/* the next fragment of *tmpl into buf; returns 0 at the end */
+static int next_fragment(const char **tmpl, char *buf)
+{
+	const char *p = *tmpl, *end;
+	size_t len;
+
+	if (!*p)
+		return 0;
+	end = strchr(p, '|');
+	if (!end)
+		end = p + strlen(p);
+	len = end - p;
+	if (len >= REPLY_MAX_FRAGMENT)
+		len = REPLY_MAX_FRAGMENT - 1;
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+	*tmpl = *end ? end + 1 : end;
+	return 1;
+}
+
+/* a fragment of a reply being played */
+struct piece {
+	char text[REPLY_MAX_FRAGMENT];
+	const char *synth;	/* what to synthesize, NULL if nothing */
+	int fixed;		/* cache it once synthesized */
+	struct pcm_buf b;
+};
+
+struct reply_run {
+	struct joiner j;
+	struct piece *p;
+	int err;
+};
+
+/* gets the fragments in order from tts_synth_ordered */
+static int reply_sink(unsigned int i, const void *data, unsigned int len, int err,
+		void *user_para)
+{
+	struct reply_run *run = (struct reply_run *)user_para;
+	struct piece *p = &run->p[i];
+
+	if (data) {
+		if (buf_append(data, len, &p->b) == 0)
+			return 0;
+		run->err = MSP_ERROR_OUT_OF_MEMORY;
+		return 1;
+	}
+	if (err != MSP_SUCCESS) {
+		xlog(XLOG_WARN, "reply: \"%s\" failed: %d\n", p->text, err);
+		run->err = err;
+		return 1;
+	}
+	if (p->synth) {
+		trim(p->b.pcm, &p->b.n);
+		if (p->fixed)
+			cache_put(p->text, p->b.pcm, p->b.n);
+	}
+	join(&run->j, p->b.pcm, p->b.n);
+	free(p->b.pcm);
+	p->b.pcm = NULL;
+	return run->j.stopped;
+}
+
+int reply_play(const char *tmpl, const char *const *args, unsigned int nargs,
+		int priority)
+{
+	struct reply_run run;
+	const char **synth;
+	const char *t;
+	unsigned int i, count = 1, slot = 0;
+	int ret;
+
+	if (!tmpl)
+		return MSP_ERROR_INVALID_PARA;
+	for (t = tmpl; *t; t++)
+		count += *t == '|';
+	memset(&run, 0, sizeof(run));
+	run.p = (struct piece *)calloc(count, sizeof(struct piece));
+	synth = (const char **)calloc(count, sizeof(char *));
+	if (!run.p || !synth) {
+		free(run.p);
+		free(synth);
+		return MSP_ERROR_OUT_OF_MEMORY;
+	}
+
+	/* what is cached is copied out now; the rest, slots and misses,
+	 * is synthesized in parallel and joined in order as it comes */
+	for (i = 0; i < count && next_fragment(&tmpl, run.p[i].text); i++) {
+		if (strcmp(run.p[i].text, "{}") == 0) {
+			if (slot < nargs && args[slot] && *args[slot]) {
+				metric_inc(&m_slots);
+				synth[i] = run.p[i].synth = args[slot];
+			}
+			slot++;
+		} else if (run.p[i].text[0]) {
+			if (cache_get(run.p[i].text, &run.p[i].b.pcm, &run.p[i].b.n) == MSP_SUCCESS) {
+				metric_inc(&m_hits);
+			} else {
+				metric_inc(&m_misses);
+				synth[i] = run.p[i].synth = run.p[i].text;
+				run.p[i].fixed = 1;
+			}
+		}
+	}
+	count = i;
+
+	ret = audio_queue_begin(TTS_RATE, 1, priority, &run.j.queue);
+	if (ret == 0) {
+		ret = tts_synth_ordered(synth, count, reply_sink, &run);
+		if (run.err)
+			ret = run.err;
+		join_end(&run.j);
+		audio_queue_end(run.j.queue);
+	}
+	for (i = 0; i < count; i++)
+		free(run.p[i].b.pcm);
+	free(run.p);
+	free(synth);
+	return ret;
+}
+
+/* the cached audio of text in *pcm, synthesized if missing */
+static int cached_fragment(const char *text, int16_t **pcm, unsigned long *n)
+{
+	int ret;
+
+	if (cache_get(text, pcm, n) == MSP_SUCCESS)
+		return MSP_SUCCESS;
+	metric_inc(&m_misses);
+	ret = synth_fragment(text, pcm, n);
+	if (ret == MSP_SUCCESS)
+		cache_put(text, *pcm, *n);
+	return ret;
+}
+
+int reply_prepare(const char *tmpl)
+{
+	char text[REPLY_MAX_FRAGMENT];
+	unsigned long n;
+	int16_t *pcm;
+	int ret = MSP_SUCCESS;
+
+	while (ret == MSP_SUCCESS && next_fragment(&tmpl, text)) {
+		if (!*text || strcmp(text, "{}") == 0)
+			continue;
+		ret = cached_fragment(text, &pcm, &n);
+		if (ret == MSP_SUCCESS)
+			free(pcm);
+	}
+	return ret;
+}
@@ -0,0 +1,43 @@
+/*
+ * @file
+ * @brief spoken replies from templates of cached fragments
+ *
+ * A template is text split into fragments by '|'. Fixed fragments are
+ * synthesized once and kept in a cache of up to REPLY_CACHE_BYTES of
+ * audio, least recently used out first; a "{}" fragment is a slot,
+ * filled from args in order and synthesized on demand. Each fragment's
+ * audio has its leading and trailing silence trimmed to REPLY_PAD_MS,
+ * and consecutive fragments overlap by REPLY_XFADE_MS with a linear
+ * crossfade, so the joins are sample accurate and click free. The
+ * fragments that need synthesis go through tts_synth_ordered, so they
+ * are synthesized in parallel, and the reply goes to playback through
+ * audio_queue_put as it is assembled in order.
+ *
+ *	reply_play("能量已|增加", NULL, 0, 0);
+ *	reply_play("当前温度|{}|度", args, 1, 0);
+ */
+
+#ifndef REPLY_H
+#define REPLY_H
+
+#define REPLY_CACHE_BYTES	(4 * 1024 * 1024)
+#define REPLY_PAD_MS		30
+#define REPLY_XFADE_MS		10
+#define REPLY_MAX_FRAGMENT	256	/* bytes of text */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returns 0, an MSP error code if a fragment failed to synthesize, or
+ * the audio_queue_begin error */
+int reply_play(const char *tmpl, const char *const *args, unsigned int nargs,
+		int priority);
+/* synthesize the fixed fragments of tmpl into the cache ahead of use */
+int reply_prepare(const char *tmpl);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * @file
+ * @brief numbers and durations spoken from a bank of cached clips
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reply.h"
+#include "reply_number.h"
+#include "msp_errors.h"
+#include "xlog.h"
+
+#define REPLY_NUMBER_DBGON 1
+#if REPLY_NUMBER_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+static const char *digits[10] = {
+	"零", "一", "二", "三", "四", "五", "六", "七", "八", "九"
+};
+static const char *magnitudes[4] = { "", "十", "百", "千" };
+
+/* everything reply_number and reply_duration can put in a template */
+static const char *bank =
+	"零|一|二|两|三|四|五|六|七|八|九|十|百|千|万|负"
+	"|度|档|秒|分钟|小时";
+
+int reply_number_prepare()
+{
+	int ret = reply_prepare(bank);
+
+	if (ret != MSP_SUCCESS)
+		xlog(XLOG_WARN, "reply number: clip bank incomplete: %d\n", ret);
+	else
+		dbg("reply number: clip bank cached\n");
+	return ret;
+}
+
+/* append one fragment; on failure the caller restores its length */
+static int put(char *tmpl, unsigned int size, const char *text)
+{
+	size_t len = strlen(tmpl), n = strlen(text);
+
+	if (len + (len ? 1 : 0) + n + 1 > size)
+		return -1;
+	if (len)
+		tmpl[len++] = '|';
+	memcpy(tmpl + len, text, n + 1);
+	return 0;
+}
+
+/* 0 < v < 10000; lead: the first group of the number, where 10..19
+ * drop the 一 before 十 */
+static int put_group(char *tmpl, unsigned int size, unsigned int v, int lead)
+{
+	unsigned int div = 1000, d;
+	int pos, started = 0, zero = 0;
+
+	for (pos = 3; pos >= 0; pos--, div /= 10) {
+		d = v / div % 10;
+		if (d == 0) {
+			zero = started;
+			continue;
+		}
+		if (zero && put(tmpl, size, digits[0]) != 0)
+			return -1;
+		zero = 0;
+		if (pos == 1 && d == 1 && lead && !started) {
+			/* 十五, not 一十五 */
+		} else if (d == 2 && pos >= 2) {
+			if (put(tmpl, size, "两") != 0)
+				return -1;
+		} else if (put(tmpl, size, digits[d]) != 0) {
+			return -1;
+		}
+		if (pos && put(tmpl, size, magnitudes[pos]) != 0)
+			return -1;
+		started = 1;
+	}
+	return 0;
+}
+
+static int put_number(char *tmpl, unsigned int size, unsigned long v)
+{
+	unsigned int hi = v / 10000, lo = v % 10000;
+
+	if (v == 0)
+		return put(tmpl, size, digits[0]);
+	if (hi) {
+		if (hi == 2) {
+			if (put(tmpl, size, "两") != 0)
+				return -1;
+		} else if (put_group(tmpl, size, hi, 1) != 0) {
+			return -1;
+		}
+		if (put(tmpl, size, "万") != 0)
+			return -1;
+		if (lo && lo < 1000 && put(tmpl, size, digits[0]) != 0)
+			return -1;
+	}
+	return lo ? put_group(tmpl, size, lo, !hi) : 0;
+}
+
+int reply_number(char *tmpl, unsigned int size, long v)
+{
+	size_t len = strlen(tmpl);
+
+	if (v < -REPLY_NUMBER_LIMIT)
+		v = -REPLY_NUMBER_LIMIT;
+	if (v > REPLY_NUMBER_LIMIT)
+		v = REPLY_NUMBER_LIMIT;
+	if ((v < 0 && put(tmpl, size, "负") != 0)
+			|| put_number(tmpl, size, v < 0 ? -v : v) != 0) {
+		tmpl[len] = '\0';
+		return -1;
+	}
+	return 0;
+}
+
+/* a count of something: 两小时, not 二小时 */
+static int put_count(char *tmpl, unsigned int size, unsigned long v)
+{
+	return v == 2 ? put(tmpl, size, "两") : put_number(tmpl, size, v);
+}
+
+int reply_duration(char *tmpl, unsigned int size, unsigned long seconds)
+{
+	unsigned long h = seconds / 3600, m = seconds % 3600 / 60;
+	size_t len = strlen(tmpl);
+	int ret = 0;
+
+	if (h)
+		ret = put_count(tmpl, size, h) || put(tmpl, size, "小时");
+	if (!ret && m)
+		ret = put_count(tmpl, size, m) || put(tmpl, size, "分钟");
+	if (!ret && !h && !m)
+		ret = put_count(tmpl, size, seconds) || put(tmpl, size, "秒");
+	if (ret) {
+		tmpl[len] = '\0';
+		return -1;
+	}
+	return 0;
+}
+
+int reply_unit(char *tmpl, unsigned int size, const char *text)
+{
+	return put(tmpl, size, text);
+}
@@ -0,0 +1,47 @@
+/*
+ * @file
+ * @brief numbers and durations spoken from a bank of cached clips
+ *
+ * A number is read the Chinese way, digit by digit with its magnitude
+ * (四|十|二, 一|百|零|五, 两|万), and each syllable is a fixed fragment
+ * of a reply template. The bank of digit, magnitude and unit clips is
+ * synthesized into the reply cache once by reply_number_prepare, so a
+ * status reply like
+ *
+ *	char tmpl[REPLY_NUMBER_MAX] = "当前温度";
+ *	reply_number(tmpl, sizeof(tmpl), 42);
+ *	reply_unit(tmpl, sizeof(tmpl), "度");
+ *	reply_play(tmpl, NULL, 0, 0);
+ *
+ * plays without synthesizing anything, whatever the value.
+ */
+
+#ifndef REPLY_NUMBER_H
+#define REPLY_NUMBER_H
+
+#define REPLY_NUMBER_MAX	200	/* bytes; enough for any template below */
+#define REPLY_NUMBER_LIMIT	99999999L	/* largest |v| read in full */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* after tts_pool_start; returns 0 or the MSP error of the clip that
+ * failed to synthesize */
+int reply_number_prepare();
+
+/* these append fragments to the template in tmpl and return 0, or -1
+ * with tmpl unchanged if it would not fit in size */
+
+/* v clamped to +-REPLY_NUMBER_LIMIT */
+int reply_number(char *tmpl, unsigned int size, long v);
+/* hours and minutes, or seconds under a minute */
+int reply_duration(char *tmpl, unsigned int size, unsigned long seconds);
+/* a fixed fragment, e.g. a unit from the bank */
+int reply_unit(char *tmpl, unsigned int size, const char *text);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * @file
+ * @brief polyphase sample-rate conversion and channel downmix
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLER_NEON 1
+#endif
+#include "resampler.h"
+
+#define RESAMPLER_MAX_UP	1024	/* 44.1 kHz to 16 kHz needs 160 */
+#define RESAMPLER_TAPS		24	/* per phase per unit of decimation */
+#define RESAMPLER_CUTOFF	0.9	/* of the lower Nyquist frequency */
+
+#if defined(__SSE2__)
+static int32_t dot_s16(const int16_t *x, const int16_t *c, unsigned int n)
+{
+	__m128i acc = _mm_setzero_si128();
+	int32_t lanes[4];
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(
+				_mm_loadu_si128((const __m128i *)(x + i)),
+				_mm_loadu_si128((const __m128i *)(c + i))));
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#elif defined(RESAMPLER_NEON)
+static int32_t dot_s16(const int16_t *x, const int16_t *c, unsigned int n)
+{
+	int32x4_t acc = vdupq_n_s32(0);
+	int16x8_t a, b;
+	int64x2_t sum;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = vld1q_s16(x + i);
+		b = vld1q_s16(c + i);
+		acc = vmlal_s16(acc, vget_low_s16(a), vget_low_s16(b));
+		acc = vmlal_s16(acc, vget_high_s16(a), vget_high_s16(b));
+	}
+	sum = vpaddlq_s32(acc);
+	return (int32_t)(vgetq_lane_s64(sum, 0) + vgetq_lane_s64(sum, 1));
+}
+#else
+static int32_t dot_s16(const int16_t *x, const int16_t *c, unsigned int n)
+{
+	int32_t acc = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		acc += (int32_t)x[i] * c[i];
+	return acc;
+}
+#endif
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	unsigned int t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Blackman-windowed sinc over up * taps points, split into phases that
+ * are each normalized to unity DC gain and stored in Q15 */
+static int design_filter(struct resampler *r)
+{
+	unsigned int len = r->up * r->taps;
+	unsigned int lower = r->in_rate < r->out_rate ? r->in_rate : r->out_rate;
+	double wc = RESAMPLER_CUTOFF * lower / 2 / ((double)r->in_rate * r->up);
+	double mid = (len - 1) / 2.0;
+	double *h, t, sum, v;
+	unsigned int n, p, m;
+
+	h = (double *)malloc(len * sizeof(double));
+	if (!h)
+		return -1;
+	for (n = 0; n < len; n++) {
+		t = n - mid;
+		h[n] = t == 0 ? 2 * wc : sin(2 * M_PI * wc * t) / (M_PI * t);
+		h[n] *= 0.42 - 0.5 * cos(2 * M_PI * n / (len - 1))
+			+ 0.08 * cos(4 * M_PI * n / (len - 1));
+	}
+	for (p = 0; p < r->up; p++) {
+		sum = 0;
+		for (m = 0; m < r->taps; m++)
+			sum += h[m * r->up + p];
+		for (m = 0; m < r->taps; m++) {
+			v = floor(h[(r->taps - 1 - m) * r->up + p] / sum * 32768 + 0.5);
+			r->coefs[p * r->taps + m] = v > 32767 ? 32767 : v < -32768 ? -32768 : (int16_t)v;
+		}
+	}
+	free(h);
+	return 0;
+}
+
+int resampler_init(struct resampler *r, unsigned int in_rate,
+		unsigned int out_rate, unsigned long max_in)
+{
+	unsigned int g, decim;
+
+	memset(r, 0, sizeof(*r));
+	if (in_rate == 0 || out_rate == 0 || max_in == 0)
+		return -1;
+	g = gcd(in_rate, out_rate);
+	r->in_rate = in_rate;
+	r->out_rate = out_rate;
+	r->up = out_rate / g;
+	r->down = in_rate / g;
+	if (r->up > RESAMPLER_MAX_UP)
+		return -1;
+
+	decim = (r->down + r->up - 1) / r->up;
+	r->taps = (RESAMPLER_TAPS * decim + 7) & ~7u;
+	r->max_in = max_in;
+	r->coefs = (int16_t *)malloc(r->up * r->taps * sizeof(int16_t));
+	r->buf = (int16_t *)calloc(r->taps - 1 + max_in, sizeof(int16_t));
+	if (!r->coefs || !r->buf || design_filter(r) != 0) {
+		resampler_free(r);
+		return -1;
+	}
+	return 0;
+}
+
+void resampler_free(struct resampler *r)
+{
+	free(r->coefs);
+	free(r->buf);
+	r->coefs = NULL;
+	r->buf = NULL;
+}
+
+void resampler_reset(struct resampler *r)
+{
+	if (r->buf)
+		memset(r->buf, 0, (r->taps - 1) * sizeof(int16_t));
+	r->pos = 0;
+}
+
+unsigned long resampler_max_out(const struct resampler *r, unsigned long n)
+{
+	return (unsigned long)((uint64_t)n * r->up / r->down) + 1;
+}
+
+unsigned long resampler_process(struct resampler *r, const int16_t *in,
+		unsigned long n, int16_t *out)
+{
+	unsigned long i, count = 0;
+	int32_t acc;
+
+	if (n > r->max_in)
+		n = r->max_in;
+	memcpy(r->buf + r->taps - 1, in, n * sizeof(int16_t));
+
+	/* output k sits at input i + p / up; its window ends at in[i] */
+	while ((i = r->pos / r->up) < n) {
+		acc = dot_s16(r->buf + i, r->coefs + r->pos % r->up * r->taps, r->taps);
+		acc = (acc + (1 << 14)) >> 15;
+		out[count++] = acc > 32767 ? 32767 : acc < -32768 ? -32768 : (int16_t)acc;
+		r->pos += r->down;
+	}
+	r->pos -= n * r->up;
+	memmove(r->buf, r->buf + n, (r->taps - 1) * sizeof(int16_t));
+	return count;
+}
+
+void pcm_downmix_s16(const int16_t *in, unsigned long frames,
+		unsigned int channels, int select, int16_t *out)
+{
+	unsigned long i;
+	unsigned int c;
+	int32_t sum;
+
+	if (select >= 0 && (unsigned int)select < channels) {
+		for (i = 0; i < frames; i++)
+			out[i] = in[i * channels + select];
+		return;
+	}
+	if (channels == 2) {
+		for (i = 0; i < frames; i++)
+			out[i] = (int16_t)(((int32_t)in[2 * i] + in[2 * i + 1]) >> 1);
+		return;
+	}
+	for (i = 0; i < frames; i++) {
+		sum = 0;
+		for (c = 0; c < channels; c++)
+			sum += in[i * channels + c];
+		out[i] = (int16_t)(sum / (int32_t)channels);
+	}
+}
@@ -0,0 +1,63 @@
+/*
+ * @file
+ * @brief polyphase sample-rate conversion and channel downmix
+ *
+ * Lets the recorder open a capture device at its native format, often
+ * 48 kHz with several channels on USB arrays, and still hand the
+ * engines 16 kHz mono without going through the ALSA plug layer.
+ *
+ * The resampler converts by the rational factor out_rate / in_rate
+ * reduced to up / down, with a windowed-sinc low-pass split into `up`
+ * phases of taps_per_phase int16 taps each. Each output sample is one
+ * dot product over the input history, done with SSE2 or NEON when the
+ * compiler targets them and plain C otherwise. State carries across
+ * calls, so a stream can be fed in chunks of any size up to max_in.
+ *
+ * Only 16 bit PCM is supported.
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+
+struct resampler {
+	unsigned int in_rate;
+	unsigned int out_rate;
+	unsigned int up;
+	unsigned int down;
+	unsigned int taps;		/* per phase, a multiple of 8 */
+	int16_t *coefs;			/* up phases of taps, time reversed */
+	int16_t *buf;			/* taps - 1 history, then the new input */
+	unsigned long max_in;
+	unsigned long pos;		/* next output, in 1/up input samples */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returns 0, or -1 if the ratio is unsupported or memory runs out */
+int resampler_init(struct resampler *r, unsigned int in_rate,
+		unsigned int out_rate, unsigned long max_in);
+void resampler_free(struct resampler *r);
+/* forget the history, e.g. when capture restarts */
+void resampler_reset(struct resampler *r);
+
+/* most samples resampler_process can return for n input samples */
+unsigned long resampler_max_out(const struct resampler *r, unsigned long n);
+
+/* convert n <= max_in samples of in; returns the samples written to out */
+unsigned long resampler_process(struct resampler *r, const int16_t *in,
+		unsigned long n, int16_t *out);
+
+/* interleaved frames to mono: channel `select`, or the average of all
+ * channels if select < 0 */
+void pcm_downmix_s16(const int16_t *in, unsigned long frames,
+		unsigned int channels, int select, int16_t *out);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
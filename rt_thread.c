@@ -0,0 +1,215 @@
+/*
+ * @file
+ * @brief realtime thread configuration with graceful fallback
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "rt_thread.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define RT_DBGON 1
+#if RT_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+struct rt_start {
+	int role;
+	void *(*fn)(void *);
+	void *arg;
+};
+
+static const char *role_names[RT_ROLE_MAX] = { "capture", "playback", "music" };
+
+static struct rt_conf g_conf[RT_ROLE_MAX] = {
+	{ SCHED_FIFO, 70, -1 },
+	{ SCHED_FIFO, 60, -1 },
+	{ SCHED_OTHER, 0, -1 },
+};
+
+/* warn once per role, not on every recorder reopen */
+#define RT_WARNED_CPU	1
+#define RT_WARNED_SCHED	2
+static int g_warned[RT_ROLE_MAX];
+
+void rt_set_conf(int role, const struct rt_conf *conf)
+{
+	if (role < 0 || role >= RT_ROLE_MAX || !conf)
+		return;
+	g_conf[role] = *conf;
+}
+
+static int parse_role(const char *spec, struct rt_conf *conf)
+{
+	const char *p = spec;
+
+	if (strncmp(p, "fifo", 4) == 0) {
+		conf->policy = SCHED_FIFO;
+		p += 4;
+	} else if (strncmp(p, "rr", 2) == 0) {
+		conf->policy = SCHED_RR;
+		p += 2;
+	} else if (strncmp(p, "other", 5) == 0) {
+		conf->policy = SCHED_OTHER;
+		p += 5;
+	} else {
+		return -1;
+	}
+
+	conf->priority = conf->policy == SCHED_OTHER ? 0 : 50;
+	conf->cpu = -1;
+	if (*p == ':')
+		conf->priority = (int)strtol(p + 1, (char **)&p, 10);
+	if (*p == '@')
+		conf->cpu = (int)strtol(p + 1, (char **)&p, 10);
+	return *p == '\0' ? 0 : -1;
+}
+
+int rt_config_from_env()
+{
+	const char *env = getenv("XIUXIU_RT");
+	char buf[256];
+	char *tok, *save = NULL, *eq;
+	struct rt_conf conf;
+	int role, ret = 0;
+
+	if (!env || !*env)
+		return 0;
+
+	snprintf(buf, sizeof(buf), "%s", env);
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (strcmp(tok, "mlock") == 0) {
+			rt_lock_memory();
+			continue;
+		}
+		eq = strchr(tok, '=');
+		if (!eq) {
+			ret = -1;
+			continue;
+		}
+		*eq = '\0';
+		for (role = 0; role < RT_ROLE_MAX; role++)
+			if (strcmp(tok, role_names[role]) == 0)
+				break;
+		if (role == RT_ROLE_MAX || parse_role(eq + 1, &conf) != 0) {
+			xlog(XLOG_WARN, "XIUXIU_RT: bad entry \"%s=%s\"\n", tok, eq + 1);
+			ret = -1;
+			continue;
+		}
+		g_conf[role] = conf;
+	}
+	return ret;
+}
+
+int rt_lock_memory()
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		xlog(XLOG_WARN, "mlockall failed: %s, page faults may stall audio\n",
+				strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+static void apply_conf(int role)
+{
+	const struct rt_conf *conf = &g_conf[role];
+	struct sched_param param;
+	cpu_set_t set;
+	int err;
+
+	if (conf->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(conf->cpu, &set);
+		err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (err && !(g_warned[role] & RT_WARNED_CPU)) {
+			xlog(XLOG_WARN, "%s thread: can't pin to cpu %d: %s\n",
+					role_names[role], conf->cpu, strerror(err));
+			g_warned[role] |= RT_WARNED_CPU;
+		}
+	}
+
+	if (conf->policy == SCHED_OTHER)
+		return;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = conf->priority;
+	err = pthread_setschedparam(pthread_self(), conf->policy, &param);
+	if (err) {
+		if (!(g_warned[role] & RT_WARNED_SCHED))
+			xlog(XLOG_WARN, "%s thread: realtime priority %d refused (%s), "
+					"running with the default scheduler\n",
+					role_names[role], conf->priority, strerror(err));
+		g_warned[role] |= RT_WARNED_SCHED;
+		return;
+	}
+	dbg("%s thread: %s priority %d\n", role_names[role],
+			conf->policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR",
+			conf->priority);
+}
+
+static void *rt_trampoline(void *p)
+{
+	struct rt_start start = *(struct rt_start *)p;
+
+	free(p);
+	apply_conf(start.role);
+	return start.fn(start.arg);
+}
+
+int rt_thread_create(pthread_t *tid, int role,
+		void *(*fn)(void *), void *arg)
+{
+	struct rt_start *start;
+	int err;
+
+	if (role < 0 || role >= RT_ROLE_MAX)
+		return pthread_create(tid, NULL, fn, arg);
+
+	start = (struct rt_start *)malloc(sizeof(*start));
+	if (!start)
+		return ENOMEM;
+	start->role = role;
+	start->fn = fn;
+	start->arg = arg;
+
+	err = pthread_create(tid, NULL, rt_trampoline, start);
+	if (err)
+		free(start);
+	return err;
+}
+
+void rt_jitter_init(struct rt_jitter *j, uint64_t period_us, struct metric *hist)
+{
+	j->period_us = period_us;
+	j->last_us = 0;
+	j->max_us = 0;
+	j->hist = hist;
+}
+
+void rt_jitter_tick(struct rt_jitter *j)
+{
+	uint64_t now = metrics_now_us();
+	uint64_t delta, dev;
+
+	if (j->last_us && j->period_us) {
+		delta = now - j->last_us;
+		dev = delta > j->period_us ? delta - j->period_us : j->period_us - delta;
+		if (dev > j->max_us)
+			j->max_us = dev;
+		if (j->hist)
+			metric_observe_us(j->hist, dev);
+	}
+	j->last_us = now;
+}
@@ -0,0 +1,70 @@
+/*
+ * @file
+ * @brief realtime scheduling, CPU pinning and jitter measurement for
+ * the audio threads
+ *
+ * Each audio thread is created through rt_thread_create() with a role.
+ * The thread applies its role's policy, priority and CPU affinity to
+ * itself before running; anything the kernel refuses (no CAP_SYS_NICE,
+ * RLIMIT_RTPRIO, offline CPU) is logged once and the thread runs with
+ * the default scheduler instead of failing.
+ *
+ * By default capture runs SCHED_FIFO 70, prompt playback SCHED_FIFO 60
+ * and music playback is left alone. $XIUXIU_RT overrides that, e.g.
+ *
+ *	XIUXIU_RT="capture=fifo:70@1,playback=fifo:60@1,music=other,mlock"
+ *
+ * where each role takes other|fifo|rr, an optional :priority and an
+ * optional @cpu, and "mlock" locks all current and future pages.
+ */
+
+#ifndef RT_THREAD_H
+#define RT_THREAD_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+struct metric;
+
+enum rt_role {
+	RT_ROLE_CAPTURE,
+	RT_ROLE_PLAYBACK,
+	RT_ROLE_MUSIC,
+	RT_ROLE_MAX
+};
+
+struct rt_conf {
+	int policy;		/* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+	int priority;	/* 1..99 for FIFO/RR */
+	int cpu;		/* -1: no pinning */
+};
+
+/* wake-up jitter of a periodic loop against its nominal period */
+struct rt_jitter {
+	uint64_t period_us;
+	uint64_t last_us;
+	uint64_t max_us;
+	struct metric *hist;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void rt_set_conf(int role, const struct rt_conf *conf);
+/* parse $XIUXIU_RT; returns 0 or -1 on a malformed spec */
+int rt_config_from_env();
+int rt_lock_memory();
+
+int rt_thread_create(pthread_t *tid, int role,
+		void *(*fn)(void *), void *arg);
+
+void rt_jitter_init(struct rt_jitter *j, uint64_t period_us, struct metric *hist);
+/* call once per period, right after the blocking read/write returns */
+void rt_jitter_tick(struct rt_jitter *j);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -16,16 +16,28 @@
 #include <time.h>
 
 #include "sound_playback.h"
+#include "trace.h"
+#include "metrics.h"
+#include "xlog.h"
+#include "rt_thread.h"
+#include "echo_ref.h"
+#include "lexicon.h"
 
 #define PCM_DEVICE "default"
 
 #define sp_dbg_defined 1
 #if sp_dbg_defined
-#define dbg printf
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
 #else
 #define dbg
 #endif
 
+METRIC_COUNTER_DEFINE(m_underruns, "xiuxiu_playback_underruns_total",
+        "Playback underruns (XRUN) recovered by snd_pcm_prepare");
+METRIC_HISTOGRAM_DEFINE(m_jitter, "xiuxiu_playback_jitter_seconds",
+        "Deviation of playback period writes from the period time",
+        metric_buckets_fast);
+
 int g_init_flag = 0;
 Music g_music;
 
@@ -53,6 +65,7 @@ typedef enum {
     , AUDIO_RESUME
     , AUDIO_PAUSE
     , AUDIO_NEXT
+    , AUDIO_STOP
     , AUDIO_INIT
     , AUDIO_SETUP
     , AUDIO_PREPARE
@@ -68,14 +81,41 @@ typedef struct{
     short int channels;
     int seconds;
     int avg_bytes_per_sec;
+    unsigned int period_us;
+    unsigned int rate;
+    snd_pcm_uframes_t buffer_frames;
+    struct echo_ref_source ref;    /* what we play, for echo cancellation */
 }SoundParam;
 
 typedef struct{
     char filename[1024];
     volatile int priority;
+    int from_queue;     /*play g_queue instead of the file*/
+    unsigned int gen;   /*g_queue.gen when it was copied*/
 } Audio;
 
-Audio g_audio = {{0}, 100};
+Audio g_audio = {{0}, 100, 0, 0};
+
+/*in-memory audio of audio_queue_*, played back to back*/
+typedef struct audio_segment{
+    struct audio_segment *next;
+    unsigned long len;
+    unsigned long pos;
+    char *data;
+}AudioSegment;
+
+/*all under audio_lock*/
+typedef struct{
+    pthread_cond_t cond;    /*a segment was added or the queue ended*/
+    AudioSegment *head, *tail;
+    int rate;
+    short int channels;
+    int active;             /*accepting audio_queue_put*/
+    int ended;              /*audio_queue_end was called*/
+    unsigned int gen;       /*bumped for each new source*/
+}AudioQueue;
+
+AudioQueue g_queue = {PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, 0, 0};
 
 /* wav音频头部格式 */
 typedef struct _wave_pcm_hdr
@@ -141,14 +181,12 @@ static int get_music_specific(){
 }
 
 
+static int open_pcm(SoundParam *sp, int rate, short int channels);
+
 static int set_param(const char *filename, SoundParam* sp){
 
-	unsigned int pcm, tmp, dir;
 	int rate, seconds;
     short int channels;
-	snd_pcm_t *pcm_handle;
-	snd_pcm_hw_params_t *params;
-	snd_pcm_uframes_t frames;
 
     int wave_pcm_hdr_size = sizeof(wave_pcm_hdr);
     FILE *f = fopen(filename, "rb");
@@ -185,6 +223,20 @@ static int set_param(const char *filename, SoundParam* sp){
     free(head);
     fclose(f);
 
+    sp->seconds = seconds;
+    sp->avg_bytes_per_sec = avg_bytes_per_sec;
+    return open_pcm(sp, rate, channels);
+}
+
+/* open the device for interleaved 16 bit frames */
+static int open_pcm(SoundParam *sp, int rate, short int channels){
+
+	unsigned int pcm, tmp;
+	snd_pcm_t *pcm_handle;
+	snd_pcm_hw_params_t *params;
+	snd_pcm_sw_params_t *swparams;
+	snd_pcm_uframes_t frames, buffer_frames;
+
 	/* Open the PCM device in playback mode */
 	if (pcm = snd_pcm_open(&pcm_handle, PCM_DEVICE,
 					SND_PCM_STREAM_PLAYBACK, 0) < 0) 
@@ -215,6 +267,17 @@ static int set_param(const char *filename, SoundParam* sp){
 	if (pcm = snd_pcm_hw_params(pcm_handle, params) < 0)
 		dbg("ERROR: Can't set harware parameters. %s\n", snd_strerror(pcm));
 
+	/* CLOCK_MONOTONIC timestamps place what we play on the capture
+	 * clock, see publish_ref */
+	snd_pcm_sw_params_alloca(&swparams);
+	if (snd_pcm_sw_params_current(pcm_handle, swparams) < 0
+			|| snd_pcm_sw_params_set_tstamp_mode(pcm_handle, swparams,
+				SND_PCM_TSTAMP_ENABLE) < 0
+			|| snd_pcm_sw_params_set_tstamp_type(pcm_handle, swparams,
+				SND_PCM_TSTAMP_TYPE_MONOTONIC) < 0
+			|| snd_pcm_sw_params(pcm_handle, swparams) < 0)
+		dbg("no monotonic playback timestamps\n");
+
 	/* Resume information */
 	dbg("PCM name: '%s'\n", snd_pcm_name(pcm_handle));
 
@@ -230,21 +293,61 @@ static int set_param(const char *filename, SoundParam* sp){
 
 	snd_pcm_hw_params_get_rate(params, &tmp, 0);
 	dbg("rate: %d bps\n", tmp);
+	sp->rate = tmp;
 
-	dbg("seconds: %d\n", seconds);	
+	dbg("seconds: %d\n", sp->seconds);
 
 	/* Allocate buffer to hold single period */
 	snd_pcm_hw_params_get_period_size(params, &frames, 0);
+	snd_pcm_hw_params_get_buffer_size(params, &buffer_frames);
 
 
 	snd_pcm_hw_params_get_period_time(params, &tmp, NULL);
     sp->frames = frames;
     sp->channels = channels;
     sp->pcm_handle = pcm_handle;
-    sp->seconds = seconds;
-    sp->avg_bytes_per_sec = avg_bytes_per_sec;
+    sp->period_us = tmp;
+    sp->buffer_frames = buffer_frames;
+    if (echo_ref_enabled()
+            && echo_ref_source_open(&sp->ref, sp->rate, channels, frames) != 0)
+        dbg("no echo reference for this stream\n");
     dbg("set param, frames:%ld\n", sp->frames);
     dbg("can pause:%d\n", snd_pcm_hw_params_can_pause(params));
+    return 0;
+}
+
+/* publish the frames just written with the time the first of them
+ * will leave the speaker */
+static void publish_ref(SoundParam *sp, const char *buff, snd_pcm_uframes_t frames){
+
+    snd_pcm_uframes_t avail;
+    snd_pcm_sframes_t delay;
+    snd_htimestamp_t ts;
+    uint64_t now, us = 0;
+    int64_t queued = 0;
+
+    if(!sp->ref.ready)
+        return;
+    now = metrics_now_us();
+    if(snd_pcm_htimestamp(sp->pcm_handle, &avail, &ts) == 0){
+        us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        queued = (int64_t)sp->buffer_frames - (int64_t)avail;
+        /*zero, or on another clock*/
+        if(us > now || now - us > 1000000)
+            us = 0;
+    }
+    if(us == 0){
+        if(snd_pcm_delay(sp->pcm_handle, &delay) < 0)
+            return;
+        queued = delay;
+        us = now;
+    }
+    /*these frames are the last ones queued*/
+    queued -= frames;
+    if(queued < 0)
+        queued = 0;
+    echo_ref_publish(&sp->ref, (const int16_t*)buff, frames,
+            us + queued * 1000000 / sp->rate);
 }
 
 static void music_state_set(MUSIC_STATE music_state){
@@ -337,16 +440,17 @@ static void* music_play_internal(void *m){
 
     int cm;  /*current music id*/
     int ret;
-    char *filename;
+    char filename[512];
     snd_pcm_sframes_t pcm;
     SoundParam sp;
     FILE *file;
     int buff_size;
     char *buff;
     MUSIC_STATE music_state;
-    int type;
+    int type, num;
     Music *music;
 
+    memset(&sp, 0, sizeof(sp));
     music = (Music*)m;
     cm = music->current;
     type = music->type;
@@ -366,8 +470,19 @@ static void* music_play_internal(void *m){
         if(music->call)
             music->call(cm);
 
+        /*the list may be replaced by update_music_list meanwhile*/
+        pthread_mutex_lock(&lock);
+        if(cm >= music->num)
+            cm = 0;
+        num = music->num;
+        if(num)
+            snprintf(filename, sizeof(filename), "%s", music->list[cm]);
+        pthread_mutex_unlock(&lock);
+        if(!num){
+            music_state_set(MUSIC_PREPARE);
+            continue;
+        }
         current_music_set(cm);
-        filename = music->list[cm];
 
         dbg("filename:%s, cm:%d\n", filename, cm);
         set_param(filename, &sp);
@@ -391,6 +506,7 @@ static void* music_play_internal(void *m){
                 ret = snd_pcm_drop(sp.pcm_handle);
                 if(ret != 0)
                     dbg("drop faild:%s\n", snd_strerror(ret));
+                echo_ref_drop(&sp.ref);
                 music_state_set(MUSIC_PLAYING);
                 goto next_file;
 
@@ -432,10 +548,13 @@ static void* music_play_internal(void *m){
             /*dbg("PCM name: %s, state: %s\n", snd_pcm_name(sp.pcm_handle), snd_pcm_state_name(snd_pcm_state(sp.pcm_handle)));*/
             /*write the date to the device*/
             if ((pcm = snd_pcm_writei(sp.pcm_handle, buff, sp.frames)) == -EPIPE) {
-                dbg("XRUN.\n");
+                metric_inc(&m_underruns);
+                xlog(XLOG_WARN, "XRUN.\n");
                 snd_pcm_prepare(sp.pcm_handle);
             } else if (pcm < 0) {
                 dbg("ERROR. Can't write to PCM device. %s\n", snd_strerror(pcm));
+            } else {
+                publish_ref(&sp, buff, pcm);
             }
             if(feof(file) != 0){
                 dbg("eof\n");
@@ -484,6 +603,7 @@ static void* music_play_internal(void *m){
                 ret = snd_pcm_drop(sp.pcm_handle);
                 if(ret != 0)
                     dbg("drop faild:%s\n", snd_strerror(ret));
+                echo_ref_drop(&sp.ref);
                 music_state_set(MUSIC_PLAYING);
                 goto next_file;
             }
@@ -499,12 +619,62 @@ next_file:
 
         pthread_mutex_lock(&lock);
         type = g_music_play_type;
+        num = music->num;
         pthread_mutex_unlock(&lock);
-        cm = type_next_music(type, music_state, music->num-1, cm);
+        cm = type_next_music(type, music_state, num-1, cm);
         /*dbg("type:%d\n", type);*/
     }
 }
 
+/*call with audio_lock held*/
+static void queue_clear(){
+
+    AudioSegment *seg;
+
+    while((seg = g_queue.head) != NULL){
+        g_queue.head = seg->next;
+        free(seg);
+    }
+    g_queue.tail = NULL;
+}
+
+/*up to len bytes of queued audio for utterance gen. Waits a little for
+ * more; *done is set once all of it has been read or it was replaced*/
+static unsigned long queue_read(char *buff, unsigned long len, unsigned int gen, int *done){
+
+    AudioSegment *seg;
+    struct timespec ts;
+    unsigned long n, got = 0;
+
+    pthread_mutex_lock(&audio_lock);
+    if(!g_queue.head && !g_queue.ended && g_queue.gen == gen){
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 100 * 1000000;
+        if(ts.tv_nsec >= 1000000000){
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&g_queue.cond, &audio_lock, &ts);
+    }
+    while(g_queue.gen == gen && (seg = g_queue.head) != NULL && got < len){
+        n = seg->len - seg->pos;
+        if(n > len - got)
+            n = len - got;
+        memcpy(buff + got, seg->data + seg->pos, n);
+        seg->pos += n;
+        got += n;
+        if(seg->pos == seg->len){
+            g_queue.head = seg->next;
+            if(!g_queue.head)
+                g_queue.tail = NULL;
+            free(seg);
+        }
+    }
+    *done = g_queue.gen != gen || (!g_queue.head && g_queue.ended);
+    pthread_mutex_unlock(&audio_lock);
+    return got;
+}
+
 static void* audio_write(void* arg){
 
     SoundParam sp;
@@ -513,12 +683,18 @@ static void* audio_write(void* arg){
     char *buff = NULL;
     snd_pcm_sframes_t pcm;
     Audio audio;
+    int rate;
+    short int channels;
     AUDIO_STATE state;
     snd_pcm_state_t pcm_state;
     size_t n;
-    int ret;
+    int ret, expected, done;
+    snd_pcm_uframes_t frames;
+    struct rt_jitter jitter;
+    TRACE_TS_VAR(play_ts);
 
-    sp.pcm_handle = NULL;
+    memset(&sp, 0, sizeof(sp));
+    rt_jitter_init(&jitter, 0, &m_jitter);
     while(1){
 
         state = (AUDIO_STATE)g_audio_state;
@@ -541,7 +717,9 @@ static void* audio_write(void* arg){
                         g_audio_state = AUDIO_SETUP;
                         break;
                     }
-                    if(file){
+                    if(audio.from_queue){
+                        g_audio_state = AUDIO_PLAYING;
+                    }else if(file){
                         if(feof(file) != 0){
                             g_audio_state = AUDIO_DRAINING;
                         }else{
@@ -605,13 +783,16 @@ static void* audio_write(void* arg){
                 }
                 break;
 
+            case AUDIO_STOP:
             case AUDIO_NEXT:
+                TRACE_MARK_END(play_ts, "playback");
                 file_close(&file);
                 if(sp.pcm_handle){
                     ret = snd_pcm_drop(sp.pcm_handle);
                     if(ret != 0){
                         dbg("Drop failed:%s\n", snd_strerror(ret));
                     }
+                    echo_ref_drop(&sp.ref);
                     snd_pcm_close(sp.pcm_handle);
                     sp.pcm_handle = NULL;
                 }
@@ -619,18 +800,38 @@ static void* audio_write(void* arg){
                     free(buff);
                     buff = NULL;
                 }
+                if(state == AUDIO_STOP){
+                    /*audio_play may have queued another one meanwhile*/
+                    expected = AUDIO_STOP;
+                    __atomic_compare_exchange_n(&g_audio_state, &expected, AUDIO_SETUP,
+                            0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+                    break;
+                }
                 g_audio_state = AUDIO_PREPARE;
 
             case AUDIO_PREPARE:
+                TRACE_MARK(play_ts);
                 pthread_mutex_lock(&audio_lock);
                 strcpy(audio.filename, g_audio.filename);
+                audio.from_queue = g_audio.from_queue;
+                audio.gen = g_queue.gen;
+                rate = g_queue.rate;
+                channels = g_queue.channels;
                 pthread_mutex_unlock(&audio_lock);
-                if((file = fopen(audio.filename, "rb")) == NULL){
-                    dbg("open file failed, %s\n", strerror(errno));
-                    g_audio_state = AUDIO_SETUP;
-                    break;
+                if(audio.from_queue){
+                    if(open_pcm(&sp, rate, channels) != 0){
+                        g_audio_state = AUDIO_SETUP;
+                        break;
+                    }
+                }else{
+                    if((file = fopen(audio.filename, "rb")) == NULL){
+                        dbg("open file failed, %s\n", strerror(errno));
+                        g_audio_state = AUDIO_SETUP;
+                        break;
+                    }
+                    set_param(audio.filename, &sp);
                 }
-                set_param(audio.filename, &sp);
+                rt_jitter_init(&jitter, sp.period_us, &m_jitter);
                 buff_size = sp.frames * sp.channels *2;
                 if((buff = (char*)malloc(buff_size)) == NULL){
                     dbg("Memory error:%s\n", strerror(errno));
@@ -641,29 +842,54 @@ static void* audio_write(void* arg){
                 g_audio_state = AUDIO_PLAYING;
 
             case AUDIO_PLAYING:
-                /*we read the file data now*/
-                n = fread(buff, 1, buff_size, file);
-                if(n != buff_size){
-                    if(ferror(file) != 0){
-                        dbg("Read file error:%s\n", strerror(errno));
-                        file_close(&file);
-                        free(buff);
-                        g_audio_state = AUDIO_SETUP;
-                        break;
+                if(audio.from_queue){
+                    n = queue_read(buff, buff_size, audio.gen, &done);
+                }else{
+                    /*we read the file data now*/
+                    n = fread(buff, 1, buff_size, file);
+                    if(n != buff_size){
+                        if(ferror(file) != 0){
+                            dbg("Read file error:%s\n", strerror(errno));
+                            file_close(&file);
+                            free(buff);
+                            g_audio_state = AUDIO_SETUP;
+                            break;
+                        }
+                    }
+                    done = feof(file) != 0;
+                }
+                frames = n / (sp.channels * 2);
+                if(frames == 0){
+                    if(done){
+                        dbg("eof\n");
+                        g_audio_state = AUDIO_DRAINING;
+                    }else if(snd_pcm_state(sp.pcm_handle) == SND_PCM_STATE_XRUN){
+                        /* the next sentence is late: everything queued
+                         * was played, so the device is just stopped and
+                         * made ready for it; not an underrun */
+                        snd_pcm_prepare(sp.pcm_handle);
                     }
+                    break;
                 }
                 /*write the date to the device*/
-                if ((pcm = snd_pcm_writei(sp.pcm_handle, buff, sp.frames)) == -EPIPE) {
-                    dbg("XRUN.\n");
+                if ((pcm = snd_pcm_writei(sp.pcm_handle, buff, frames)) == -EPIPE) {
+                    metric_inc(&m_underruns);
+                    xlog(XLOG_WARN, "XRUN.\n");
                     snd_pcm_prepare(sp.pcm_handle);
-                } else if (pcm < 0) {
+                    /* the period was not played: write it again */
+                    pcm = snd_pcm_writei(sp.pcm_handle, buff, frames);
+                }
+                if (pcm < 0) {
                     dbg("ERROR. Can't write to PCM device. %s\n", snd_strerror(pcm));
                     file_close(&file);
                     free(buff);
                     g_audio_state = AUDIO_SETUP;
                     break;
                 }
-                if(feof(file) != 0){
+                if (pcm > 0)
+                    publish_ref(&sp, buff, pcm);
+                rt_jitter_tick(&jitter);
+                if(done){
                     dbg("eof\n");
                     g_audio_state = AUDIO_DRAINING;
                 }
@@ -671,6 +897,7 @@ static void* audio_write(void* arg){
 
             case AUDIO_DRAINING:
                 if(snd_pcm_avail(sp.pcm_handle) < 0){
+                    TRACE_MARK_END(play_ts, "playback");
                     file_close(&file);
                     snd_pcm_close(sp.pcm_handle);
                     sp.pcm_handle = NULL;
@@ -704,6 +931,39 @@ exit:
     dbg("exit\n");
 }
 
+/*the titles of the list as the words of the <song> grammar slot*/
+static void publish_titles(char *const *list, int num){
+
+    const char *name, *dot;
+    char *words;
+    size_t size = 0, n;
+    int i;
+
+    for(i = 0; i < num; i++)
+        size += strlen(list[i]) + 1;
+    if((words = (char*)malloc(size + 1)) == NULL){
+        dbg("memory error, %s", strerror(errno));
+        return;
+    }
+    size = 0;
+    for(i = 0; i < num; i++){
+        name = strrchr(list[i], '/');
+        name = name ? name + 1 : list[i];
+        dot = strrchr(name, '.');
+        n = dot && dot != name ? (size_t)(dot - name) : strlen(name);
+        if(n == 0)
+            continue;
+        if(size)
+            words[size++] = '\n';
+        memcpy(words + size, name, n);
+        size += n;
+    }
+    words[size] = '\0';
+    if(lexicon_set(LEXICON_MUSIC_SLOT, words, size) != 0)
+        dbg("song titles not updated\n");
+    free(words);
+}
+
 static int music_copy(Music *music_dst, Music *music_src){
 
     if(!music_dst || !music_src){
@@ -739,13 +999,14 @@ int music_init(Music* music){
 
     if(music_copy(&g_music, music) != 0)
         return -1;
+    publish_titles(g_music.list, g_music.num);
 
     if(pthread_mutex_init(&lock, NULL) != 0){
         dbg("mutex init failed\n");
         return -1;
     }
 
-    if((ret = pthread_create(&g_music_pt, NULL,music_play_internal,(void*) &g_music)) != 0){
+    if((ret = rt_thread_create(&g_music_pt, RT_ROLE_MUSIC, music_play_internal,(void*) &g_music)) != 0){
         dbg("create thread error:%s", strerror(errno));
         return -1;
     }
@@ -787,16 +1048,39 @@ int music_play_type(MUSIC_PLAY_TYPE type){
     return 0;
 }
 
-int audio_play(const char *filename, int priority){
+/*make filename, or g_queue if NULL, the next thing to play; returns
+ *the generation it gets*/
+static unsigned int set_source(const char *filename, int rate, short int channels, int priority){
+
+    unsigned int gen;
+
+    pthread_mutex_lock(&audio_lock);
+    queue_clear();
+    g_queue.gen++;
+    g_queue.ended = 0;
+    if(filename){
+        strcpy(g_audio.filename, filename);
+        g_audio.from_queue = 0;
+        g_queue.active = 0;
+    }else{
+        g_audio.from_queue = 1;
+        g_queue.rate = rate;
+        g_queue.channels = channels;
+        g_queue.active = 1;
+    }
+    pthread_cond_broadcast(&g_queue.cond);
+    gen = g_queue.gen;
+    pthread_mutex_unlock(&audio_lock);
+    g_audio.priority = priority;
+    return gen;
+}
 
-    int ret = 0;
+/*gen, if not NULL, gets the generation of the new source*/
+static int request_play(const char *filename, int rate, short int channels, int priority,
+        unsigned int *gen){
 
-    if(!filename){
-        dbg("File name is invalid.\n");
-        /*! TODO: error code definition
-         */
-        return -3;
-    }
+    int ret = 0;
+    unsigned int g = 0;
 
     switch (g_audio_state) {
         case AUDIO_INVALID:
@@ -806,10 +1090,7 @@ int audio_play(const char *filename, int priority){
 
         case AUDIO_INIT:
         case AUDIO_SETUP:
-            pthread_mutex_lock(&audio_lock);
-            strcpy(g_audio.filename, filename);
-            pthread_mutex_unlock(&audio_lock);
-            g_audio.priority = priority;
+            g = set_source(filename, rate, channels, priority);
             g_audio_state = AUDIO_PREPARE;
             break;
 
@@ -822,10 +1103,7 @@ int audio_play(const char *filename, int priority){
                 ret = AUDIO_LOW_PRIORITY;
                 break;
             }
-            pthread_mutex_lock(&audio_lock);
-            strcpy(g_audio.filename, filename);
-            pthread_mutex_unlock(&audio_lock);
-            g_audio.priority = priority;
+            g = set_source(filename, rate, channels, priority);
             g_audio_state = AUDIO_NEXT;
             break;
 
@@ -835,9 +1113,114 @@ int audio_play(const char *filename, int priority){
             break;
     }
 
+    if(gen)
+        *gen = g;
+    return ret;
+}
+
+int audio_play(const char *filename, int priority){
+
+    if(!filename){
+        dbg("File name is invalid.\n");
+        /*! TODO: error code definition
+         */
+        return -3;
+    }
+    return request_play(filename, 0, 0, priority, NULL);
+}
+
+int audio_queue_begin(int rate, int channels, int priority, unsigned int *queue){
+
+    if(rate <= 0 || channels <= 0 || !queue)
+        return -3;
+    return request_play(NULL, rate, channels, priority, queue);
+}
+
+int audio_queue_put(unsigned int queue, const char *pcm, unsigned long len){
+
+    AudioSegment *seg;
+
+    seg = (AudioSegment*)malloc(sizeof(AudioSegment) + len);
+    if(!seg)
+        return -1;
+    seg->next = NULL;
+    seg->pos = 0;
+    seg->data = (char*)(seg + 1);
+    pthread_mutex_lock(&audio_lock);
+    if(g_queue.gen != queue || !g_queue.active || g_queue.ended){
+        pthread_mutex_unlock(&audio_lock);
+        free(seg);
+        return -1;
+    }
+    /*whole frames only, the player writes no partial ones*/
+    seg->len = len - len % (g_queue.channels * 2);
+    memcpy(seg->data, pcm, seg->len);
+    if(g_queue.tail)
+        g_queue.tail->next = seg;
+    else
+        g_queue.head = seg;
+    g_queue.tail = seg;
+    pthread_cond_broadcast(&g_queue.cond);
+    pthread_mutex_unlock(&audio_lock);
+    return 0;
+}
+
+int audio_queue_end(unsigned int queue){
+
+    int ret = 0;
+
+    pthread_mutex_lock(&audio_lock);
+    if(g_queue.gen == queue && g_queue.active){
+        g_queue.ended = 1;
+        g_queue.active = 0;
+        pthread_cond_broadcast(&g_queue.cond);
+    }else{
+        ret = -1;
+    }
+    pthread_mutex_unlock(&audio_lock);
     return ret;
 }
 
+/*drop the current audio at once, e.g. when the user talks over it*/
+int audio_stop(){
+
+    /*producers of a queued one learn it from audio_queue_put*/
+    pthread_mutex_lock(&audio_lock);
+    if(g_audio.from_queue){
+        queue_clear();
+        g_queue.active = 0;
+        pthread_cond_broadcast(&g_queue.cond);
+    }
+    pthread_mutex_unlock(&audio_lock);
+
+    switch (g_audio_state) {
+        case AUDIO_PREPARE:
+        case AUDIO_PLAYING:
+        case AUDIO_DRAINING:
+        case AUDIO_PAUSED:
+        case AUDIO_NEXT:
+            g_audio_state = AUDIO_STOP;
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+int audio_playing(){
+
+    switch (g_audio_state) {
+        case AUDIO_PREPARE:
+        case AUDIO_PLAYING:
+        case AUDIO_DRAINING:
+        case AUDIO_NEXT:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
 int audio_init(){
 
     int ret;
@@ -855,7 +1238,7 @@ int audio_init(){
         return -1;
     }
 
-    if((ret = pthread_create(&g_audio_pt, NULL, audio_write, NULL)) != 0){
+    if((ret = rt_thread_create(&g_audio_pt, RT_ROLE_PLAYBACK, audio_write, NULL)) != 0){
         dbg("create thread error:%s", strerror(errno));
         return -1;
     }
@@ -947,6 +1330,34 @@ int music_specify(int id){
 
 int update_music_list(const char** music_list, int num){
 
+    char **list, **old;
+    int i, old_num;
+
+    if(num < 0 || (num && !music_list))
+        return -1;
+    if((list = (char**)calloc(num ? num : 1, sizeof(char*))) == NULL)
+        return -1;
+    for(i = 0; i < num; i++){
+        if((list[i] = strdup(music_list[i])) == NULL){
+            while(i--)
+                free(list[i]);
+            free(list);
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&lock);
+    old = g_music.list;
+    old_num = g_music.num;
+    g_music.list = list;
+    g_music.num = num;
+    pthread_mutex_unlock(&lock);
+
+    for(i = 0; i < old_num; i++)
+        free(old[i]);
+    free(old);
+
+    publish_titles(list, num);
     return 0;
 }
 
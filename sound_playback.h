@@ -32,13 +32,28 @@ int music_play_type(MUSIC_PLAY_TYPE type);
 int get_music_play_type();
 int music_specify(int id);
 
-//int update_music_list(const char** music_list, int num);
+/* replace the music list; the titles, the file names without
+ * directory and extension, become the words of the <song> slot */
+int update_music_list(const char** music_list, int num);
 
 void volume_init(int volume);
 void toggle_volume(int volume);
 
 int audio_init();
 int audio_play(const char *filename, int priority);
+/* play in-memory 16 bit interleaved audio, e.g. while it is being
+ * synthesized: begin replaces what plays the way audio_play does and
+ * gives the queue's handle in *queue, put appends whole frames and
+ * returns -1 once that queue was stopped or replaced, end lets it
+ * drain after the last put and returns -1 if it was. Playback waits
+ * for puts that come late. */
+int audio_queue_begin(int rate, int channels, int priority, unsigned int *queue);
+int audio_queue_put(unsigned int queue, const char *pcm, unsigned long len);
+int audio_queue_end(unsigned int queue);
+/* drop what is playing now, returns -1 if nothing was */
+int audio_stop();
+/* 1 from audio_play until the audio has drained */
+int audio_playing();
 int audio_destroy();
 
 #endif
@@ -10,16 +10,20 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include "speech_recognizer.h"
 #include "qisr.h"
 #include "msp_cmn.h"
 #include "msp_errors.h"
 #include "linuxrec.h"
+#include "trace.h"
+#include "metrics.h"
+#include "xlog.h"
 
 
 #define SR_DBGON 1
 #if SR_DBGON == 1
-#	define sr_dbg printf
+#	define sr_dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
 #else
 #	define sr_dbg
 #endif
@@ -42,9 +46,31 @@
 enum {
 	SR_STATE_INIT,
 	SR_STATE_STARTED,
-    SR_STATE_STOPPED
+    SR_STATE_STOPPED,
+	SR_STATE_ENDING		/* SR_USER: end_thread collects the result */
 };
 
+/* end_pending */
+enum {
+	SR_END_NONE,
+	SR_END_VAD,		/* the engine VAD ended the utterance */
+	SR_END_CLIENT,		/* our endpointer did */
+	SR_END_QUIT
+};
+
+
+METRIC_HISTOGRAM_DEFINE(m_isr_write, "xiuxiu_isr_audio_write_seconds",
+		"Time spent in QISRAudioWrite per capture period", metric_buckets_fast);
+METRIC_COUNTER_DEFINE(m_early, "xiuxiu_isr_early_commits_total",
+		"Utterances ended on their results before the VAD end");
+METRIC_HISTOGRAM_DEFINE(m_eos_vad, "xiuxiu_isr_eos_result_vad_seconds",
+		"End of speech to final result, utterances ended by the engine VAD",
+		metric_buckets_slow);
+METRIC_HISTOGRAM_DEFINE(m_eos_client, "xiuxiu_isr_eos_result_client_seconds",
+		"End of speech to final result, utterances ended by the client endpointer",
+		metric_buckets_slow);
+
+#define SR_POLL_MS		10	/* final result polling */
 
 #define SR_MALLOC malloc
 #define SR_MFREE  free
@@ -56,45 +82,168 @@ static void Sleep(size_t ms)
 	usleep(ms*1000);
 }
 
+/* the session of sr no longer counts as open in its config */
+static void config_leave(struct speech_rec *sr)
+{
+	struct sr_config *c = sr->config;
+
+	if (!sr->config_session)
+		return;
+	sr->config_session = 0;
+	pthread_mutex_lock(&c->lock);
+	if (--c->sessions == 0)
+		pthread_cond_broadcast(&c->idle);
+	pthread_mutex_unlock(&c->lock);
+}
+
+static void end_session(struct speech_rec *sr, const char *hints)
+{
+	QISRSessionEnd(sr->session_id, hints);
+	sr->session_id = NULL;
+	config_leave(sr);
+}
 
 static void end_sr_on_error(struct speech_rec *sr, int errcode)
 {
-    stop_record(sr->recorder);
+	if (sr->aud_src == SR_MIC)
+		stop_record(sr->recorder);
 	
 	if (sr->session_id) {
 		if (sr->notif.on_speech_end)
 			sr->notif.on_speech_end(errcode);
 
-		QISRSessionEnd(sr->session_id, "err");
-		sr->session_id = NULL;
+		end_session(sr, "err");
 	}
 	sr->state = SR_STATE_STOPPED;
 }
 
-static void end_sr_on_vad(struct speech_rec *sr)
+/* client: our endpointer ended the utterance, the engine still has to
+ * be told the audio is over */
+static void end_sr_on_vad(struct speech_rec *sr, int client)
 {
 	int errcode;
 	const char *rslt;
-
-    stop_record(sr->recorder);	
+	uint64_t eos_us = sr->eos_us;
+
+	if (sr->aud_src == SR_MIC)
+		stop_record(sr->recorder);
+	if (client) {
+		errcode = QISRAudioWrite(sr->session_id, NULL, 0, MSP_AUDIO_SAMPLE_LAST,
+				&sr->ep_stat, &sr->rec_stat);
+		if (errcode) {
+			sr_dbg("write LAST_SAMPLE failed: %d\n", errcode);
+			end_sr_on_error(sr, errcode);
+			return;
+		}
+	}
 	sr->rec_stat = MSP_AUDIO_SAMPLE_CONTINUE;
+	TRACE_MARK(sr->poll_ts);
 	while(sr->rec_stat != MSP_REC_STATUS_COMPLETE ){
 		rslt = QISRGetResult(sr->session_id, &sr->rec_stat, 0, &errcode);
+		if (MSP_SUCCESS != errcode) {
+			sr_dbg("\nQISRGetResult failed! error code: %d\n", errcode);
+			end_sr_on_error(sr, errcode);
+			return;
+		}
 		if (rslt && sr->notif.on_result)
 			sr->notif.on_result(rslt, sr->rec_stat == MSP_REC_STATUS_COMPLETE ? 1 : 0);
 
-		Sleep(100); /* for cpu occupy, should sleep here */
+		if (sr->rec_stat != MSP_REC_STATUS_COMPLETE)
+			Sleep(SR_POLL_MS); /* for cpu occupy, should sleep here */
 	}
+	TRACE_MARK_END(sr->poll_ts, "result_poll");
+	if (sr->ep_speech_ms >= SR_EP_MIN_SPEECH_MS)
+		metric_observe_us(client ? &m_eos_client : &m_eos_vad,
+				metrics_now_us() - eos_us);
 
 	if (sr->session_id) {
 		if (sr->notif.on_speech_end)
 			sr->notif.on_speech_end(END_REASON_VAD_DETECT);
-		QISRSessionEnd(sr->session_id, "VAD Normal");
-		sr->session_id = NULL;
+		end_session(sr, "VAD Normal");
+	}
+	sr->state = SR_STATE_STOPPED;
+}
+
+static void *end_proc(void *arg)
+{
+	struct speech_rec *sr = (struct speech_rec *)arg;
+	int client;
+
+	pthread_mutex_lock(&sr->end_lock);
+	while (1) {
+		while (sr->end_pending == SR_END_NONE)
+			pthread_cond_wait(&sr->end_cond, &sr->end_lock);
+		if (sr->end_pending == SR_END_QUIT)
+			break;
+		client = sr->end_pending == SR_END_CLIENT;
+		sr->end_pending = SR_END_NONE;
+		pthread_mutex_unlock(&sr->end_lock);
+
+		end_sr_on_vad(sr, client);
+
+		pthread_mutex_lock(&sr->end_lock);
+		pthread_cond_broadcast(&sr->end_cond);
+	}
+	pthread_mutex_unlock(&sr->end_lock);
+	return NULL;
+}
+
+/* the utterance is over. The audio of SR_USER comes from a callback of
+ * someone else's capture thread, which must not sit in the result
+ * polling: it is handed to end_thread */
+static void end_utterance(struct speech_rec *sr, int client)
+{
+	/* the speech ended ep_silence_ms of audio ago */
+	sr->eos_us = metrics_now_us() - (uint64_t)sr->ep_silence_ms * 1000;
+	if (sr->aud_src != SR_USER) {
+		end_sr_on_vad(sr, client);
+		return;
+	}
+	sr->state = SR_STATE_ENDING;
+	pthread_mutex_lock(&sr->end_lock);
+	sr->end_pending = client ? SR_END_CLIENT : SR_END_VAD;
+	pthread_cond_broadcast(&sr->end_cond);
+	pthread_mutex_unlock(&sr->end_lock);
+}
+
+/* on_partial had all it needs: the rest of the utterance and the
+ * trailing silence the VAD would wait for are not listened to */
+static void end_sr_on_commit(struct speech_rec *sr)
+{
+	metric_inc(&m_early);
+	TRACE_MARK_END(sr->vad_ts, "vad");
+	TRACE_INSTANT("early_commit");
+	if (sr->aud_src == SR_MIC)
+		stop_record(sr->recorder);
+
+	if (sr->session_id) {
+		if (sr->notif.on_speech_end)
+			sr->notif.on_speech_end(END_REASON_EARLY_COMMIT);
+		end_session(sr, "early commit");
 	}
 	sr->state = SR_STATE_STOPPED;
 }
 
+/* run the endpointer over data just written; 1 if the utterance is over */
+static int endpoint_reached(struct speech_rec *sr, const char *data, unsigned int len)
+{
+	unsigned long frame = sr->ep_vad.frame_samples * sizeof(int16_t), off, n;
+	unsigned int tail;
+
+	for (off = 0; off < len; off += n) {
+		n = len - off < frame ? len - off : frame;
+		if (vad_gate_frame_voice(&sr->ep_vad, data + off, n)) {
+			sr->ep_speech_ms += VAD_GATE_FRAME_MS;
+			sr->ep_silence_ms = 0;
+		} else if (sr->ep_speech_ms) {
+			sr->ep_silence_ms += VAD_GATE_FRAME_MS;
+		}
+	}
+	tail = sr->ep_complete ? sr->endpoint.complete_tail_ms : sr->endpoint.tail_ms;
+	return sr->ep_enabled && tail && sr->ep_speech_ms >= SR_EP_MIN_SPEECH_MS
+		&& sr->ep_silence_ms >= tail;
+}
+
 /* the record call back */
 static void iat_cb(char *data, unsigned long len, void *user_para)
 {
@@ -108,7 +257,7 @@ static void iat_cb(char *data, unsigned long len, void *user_para)
 
 	if(sr == NULL || sr->ep_stat >= MSP_EP_AFTER_SPEECH)
 		return;
-	if (sr->state < SR_STATE_STARTED)
+	if (sr->state != SR_STATE_STARTED)
 		return; /* ignore the data if error/vad happened */
 	
 	errcode = sr_write_audio_data(sr, data, len);
@@ -118,13 +267,25 @@ static void iat_cb(char *data, unsigned long len, void *user_para)
 	}
 }
 
+void sr_feed_audio(char *data, unsigned long len, void *user_para)
+{
+	iat_cb(data, len, user_para);
+}
+
 int sr_init(struct speech_rec * sr, const char * session_begin_params, 
 			    struct speech_rec_notifier * notify)
+{
+	return sr_init_ex(sr, session_begin_params, SR_MIC, notify);
+}
+
+int sr_init_ex(struct speech_rec * sr, const char * session_begin_params,
+			    enum sr_audsrc aud_src, struct speech_rec_notifier * notify)
 {
 	int errcode;
 	size_t param_size;
+	const char *env;
 
-	if (get_input_dev_num() == 0) {
+	if (aud_src == SR_MIC && get_input_dev_num() == 0) {
 		return -E_SR_NOACTIVEDEVICE;
 	}
 
@@ -136,6 +297,14 @@ int sr_init(struct speech_rec * sr, const char * session_begin_params,
 	}
 
 	SR_MEMSET(sr, 0, sizeof(struct speech_rec));
+	/* XIUXIU_ENDPOINT=0 leaves the end of speech to the engine VAD */
+	env = getenv("XIUXIU_ENDPOINT");
+	sr->ep_enabled = !(env && strcmp(env, "0") == 0);
+	sr->ep_next.tail_ms = SR_EP_TAIL_MS;
+	sr->ep_next.complete_tail_ms = SR_EP_COMPLETE_TAIL_MS;
+	if (vad_gate_init(&sr->ep_vad, 16000, 0, 0) != 0)
+		return -E_SR_NOMEM;
+	sr->aud_src = aud_src;
 	sr->state = SR_STATE_INIT;
 	sr->ep_stat = MSP_EP_LOOKING_FOR_SPEECH;
 	sr->rec_stat = MSP_REC_STATUS_SUCCESS;
@@ -150,6 +319,16 @@ int sr_init(struct speech_rec * sr, const char * session_begin_params,
 	strncpy(sr->session_begin_params, session_begin_params, param_size);
 
 	sr->notif = *notify;
+	if (aud_src == SR_USER) {
+		pthread_mutex_init(&sr->end_lock, NULL);
+		pthread_cond_init(&sr->end_cond, NULL);
+		if (pthread_create(&sr->end_thread, NULL, end_proc, sr) != 0) {
+			errcode = -E_SR_NOMEM;
+			goto fail;
+		}
+		sr->end_running = 1;
+		return 0;
+	}
 	
     errcode = create_recorder(&sr->recorder, iat_cb, (void*)sr);
     if (sr->recorder == NULL || errcode != 0) {
@@ -175,34 +354,175 @@ fail:
 	return errcode;
 }
 
+void sr_set_endpoint(struct speech_rec *sr, const struct sr_endpoint *ep)
+{
+	sr->ep_next = *ep;
+}
+
+int sr_config_init(struct sr_config *c, const char *params)
+{
+	if (strlen(params) >= SR_CONFIG_LEN)
+		return -E_SR_INVAL;
+	SR_MEMSET(c, 0, sizeof(*c));
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_mutex_init(&c->build, NULL);
+	pthread_cond_init(&c->idle, NULL);
+	strcpy(c->buf[0], params);
+	c->generation = 1;
+	return 0;
+}
+
+void sr_config_free(struct sr_config *c)
+{
+	pthread_mutex_destroy(&c->lock);
+	pthread_mutex_destroy(&c->build);
+	pthread_cond_destroy(&c->idle);
+}
+
+int sr_config_rebuild(struct sr_config *c, sr_config_build build, void *arg)
+{
+	int back, len;
+
+	pthread_mutex_lock(&c->build);
+	/* only rebuilds move the front, and they hold build */
+	back = !c->front;
+	len = build(c->buf[back], SR_CONFIG_LEN, arg);
+	if (len < 0 || len >= SR_CONFIG_LEN) {
+		pthread_mutex_unlock(&c->build);
+		return len < 0 ? len : -E_SR_INVAL;
+	}
+	pthread_mutex_lock(&c->lock);
+	c->front = back;
+	c->generation++;
+	pthread_mutex_unlock(&c->lock);
+	pthread_mutex_unlock(&c->build);
+	sr_dbg("session params %u published\n", c->generation);
+	return 0;
+}
+
+unsigned int sr_config_get(struct sr_config *c, char *buf, size_t size)
+{
+	unsigned int generation;
+
+	pthread_mutex_lock(&c->lock);
+	snprintf(buf, size, "%s", c->buf[c->front]);
+	generation = c->generation;
+	pthread_mutex_unlock(&c->lock);
+	return generation;
+}
+
+int sr_config_hold(struct sr_config *c, unsigned int timeout_ms)
+{
+	struct timespec ts;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&c->lock);
+	while ((c->sessions || c->held) && ret == 0)
+		ret = pthread_cond_timedwait(&c->idle, &c->lock, &ts);
+	if (!c->sessions && !c->held) {
+		c->held = 1;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&c->lock);
+	return ret ? -1 : 0;
+}
+
+void sr_config_release(struct sr_config *c)
+{
+	pthread_mutex_lock(&c->lock);
+	c->held = 0;
+	pthread_cond_broadcast(&c->idle);
+	pthread_mutex_unlock(&c->lock);
+}
+
+void sr_use_config(struct speech_rec *sr, struct sr_config *config)
+{
+	sr->config = config;
+	sr->config_generation = 0;
+}
+
+/* the params of the session about to begin, which counts as open
+ * from here on; waits while the config is held */
+static int config_params(struct speech_rec *sr)
+{
+	struct sr_config *c = sr->config;
+	unsigned int generation;
+	char *params;
+
+	if (!sr->config)
+		return 0;
+	if (!sr->config_generation) {
+		params = (char *)SR_MALLOC(SR_CONFIG_LEN);
+		if (!params)
+			return -E_SR_NOMEM;
+		SR_MFREE(sr->session_begin_params);
+		sr->session_begin_params = params;
+	}
+	pthread_mutex_lock(&c->lock);
+	if (c->held)
+		sr_dbg("session params held, waiting\n");
+	while (c->held)
+		pthread_cond_wait(&c->idle, &c->lock);
+	snprintf(sr->session_begin_params, SR_CONFIG_LEN, "%s", c->buf[c->front]);
+	generation = c->generation;
+	c->sessions++;
+	sr->config_session = 1;
+	pthread_mutex_unlock(&c->lock);
+	if (generation != sr->config_generation) {
+		if (sr->config_generation)
+			sr_dbg("new session params, generation %u\n", generation);
+		sr->config_generation = generation;
+	}
+	return 0;
+}
+
 int sr_start_listening(struct speech_rec *sr)
 {
 	int ret;
 	const char*		session_id = NULL;
 	int				errcode = MSP_SUCCESS;
 	WAVEFORMATEX wavfmt = DEFAULT_FORMAT;
+	TRACE_SPAN_BEGIN(ts);
 
-	if (sr->state == SR_STATE_STARTED) {
+	if (sr->state == SR_STATE_STARTED || sr->state == SR_STATE_ENDING) {
 		sr_dbg("already STARTED.\n");
 		return -E_SR_ALREADY;
 	}
+	ret = config_params(sr);
+	if (ret != 0)
+		return ret;
 
 	session_id = QISRSessionBegin(NULL, sr->session_begin_params, &errcode); //дҪ﷨һΪNULL
 	if (MSP_SUCCESS != errcode)
 	{
 		sr_dbg("\nQISRSessionBegin failed! error code:%d\n", errcode);
+		config_leave(sr);
 		return errcode;
 	}
 	sr->session_id = session_id;
 	sr->ep_stat = MSP_EP_LOOKING_FOR_SPEECH;
 	sr->rec_stat = MSP_REC_STATUS_SUCCESS;
 	sr->audio_status = MSP_AUDIO_SAMPLE_FIRST;
+	sr->endpoint = sr->ep_next;
+	vad_gate_reset(&sr->ep_vad);
+	sr->ep_speech_ms = 0;
+	sr->ep_silence_ms = 0;
+	sr->ep_complete = 0;
 
+	if (sr->aud_src == SR_USER)
+		goto started;
 
     errcode = open_recorder(sr->recorder, get_default_input_dev(), &wavfmt);
     if (errcode != 0) {
         sr_dbg("recorder open failed: %d\n", errcode);
-        QISRSessionEnd(session_id, "open record failed");
+        end_session(sr, "open record failed");
         return -E_SR_RECORDFAIL;
     }
 
@@ -210,12 +530,14 @@ int sr_start_listening(struct speech_rec *sr)
     if (ret != 0) {
         sr_dbg("start record failed: %d\n", ret);
         close_recorder(sr->recorder);
-        QISRSessionEnd(session_id, "start record failed");
-        sr->session_id = NULL;
+        end_session(sr, "start record failed");
         return -E_SR_RECORDFAIL;
     }
 
+started:
 	sr->state = SR_STATE_STARTED;
+	TRACE_SPAN_END(ts, "sr_open");
+	TRACE_MARK(sr->vad_ts);
 
 	if (sr->notif.on_speech_begin)
 		sr->notif.on_speech_begin();
@@ -244,27 +566,40 @@ int sr_stop_listening(struct speech_rec *sr)
 		return 0;
 	}
 
+	/* the result is being collected: let that finish */
+	if (sr->state == SR_STATE_ENDING) {
+		pthread_mutex_lock(&sr->end_lock);
+		while (sr->state == SR_STATE_ENDING)
+			pthread_cond_wait(&sr->end_cond, &sr->end_lock);
+		pthread_mutex_unlock(&sr->end_lock);
+	}
+
     if(sr->state == SR_STATE_STOPPED){
-        close_recorder(sr->recorder);
+        if (sr->aud_src == SR_MIC) {
+            close_recorder(sr->recorder);
+        }
 	    sr->state = SR_STATE_INIT;
         return 0;
     }
 
-    ret = stop_record(sr->recorder);
-    if (ret != 0) {
-        sr_dbg("Stop failed! \n");
-        return -E_SR_RECORDFAIL;
-    }
-    wait_for_rec_stop(sr->recorder, (unsigned int)-1);
-    close_recorder(sr->recorder);
+	if (sr->aud_src == SR_MIC) {
+	    ret = stop_record(sr->recorder);
+	    if (ret != 0) {
+	        sr_dbg("Stop failed! \n");
+	        return -E_SR_RECORDFAIL;
+	    }
+	    wait_for_rec_stop(sr->recorder, (unsigned int)-1);
+	    close_recorder(sr->recorder);
+	}
 	sr->state = SR_STATE_INIT;
 	ret = QISRAudioWrite(sr->session_id, NULL, 0, MSP_AUDIO_SAMPLE_LAST, &sr->ep_stat, &sr->rec_stat);
 	if (ret != 0) {
 		sr_dbg("write LAST_SAMPLE failed: %d\n", ret);
-		QISRSessionEnd(sr->session_id, "write err");
+		end_session(sr, "write err");
 		return ret;
 	}
 	sr->rec_stat = 2;
+	TRACE_MARK(sr->poll_ts);
 	while (sr->rec_stat != MSP_REC_STATUS_COMPLETE) {
 		rslt = QISRGetResult(sr->session_id, &sr->rec_stat, 0, &ret);
 		if (MSP_SUCCESS != ret)	{
@@ -276,22 +611,25 @@ int sr_stop_listening(struct speech_rec *sr)
 			sr->notif.on_result(rslt, sr->rec_stat == MSP_REC_STATUS_COMPLETE ? 1 : 0);
 		Sleep(100);
 	}
+	TRACE_MARK_END(sr->poll_ts, "result_poll");
 
-	QISRSessionEnd(sr->session_id, "normal");
-	sr->session_id = NULL;
+	end_session(sr, "normal");
 	return 0;
 }
 
 int sr_write_audio_data(struct speech_rec *sr, char *data, unsigned int len)
 {
 	const char *rslt = NULL;
-	int ret = 0;
+	int ret = 0, partial, reached;
+	uint64_t t0;
 	if (!sr )
 		return -E_SR_INVAL;
 	if (!data || !len)
 		return 0;
 
+	t0 = metrics_now_us();
 	ret = QISRAudioWrite(sr->session_id, data, len, sr->audio_status, &sr->ep_stat, &sr->rec_stat);
+	metric_observe_us(&m_isr_write, metrics_now_us() - t0);
 	if (ret) {
 		end_sr_on_error(sr, ret);
 		return ret;
@@ -307,16 +645,54 @@ int sr_write_audio_data(struct speech_rec *sr, char *data, unsigned int len)
 		}
 		if (NULL != rslt && sr->notif.on_result)
 			sr->notif.on_result(rslt, sr->rec_stat == MSP_REC_STATUS_COMPLETE ? 1 : 0);
+		if (NULL != rslt && sr->ep_stat < MSP_EP_AFTER_SPEECH
+				&& sr->notif.on_partial) {
+			partial = sr->notif.on_partial();
+			if (partial == SR_PARTIAL_COMMIT) {
+				end_sr_on_commit(sr);
+				return 0;
+			}
+			sr->ep_complete = partial == SR_PARTIAL_COMPLETE;
+		}
 	}
 
-	if (MSP_EP_AFTER_SPEECH == sr->ep_stat)
-		end_sr_on_vad(sr);
+	reached = endpoint_reached(sr, data, len);
+	if (MSP_EP_AFTER_SPEECH == sr->ep_stat) {
+		TRACE_MARK_END(sr->vad_ts, "vad");
+		end_utterance(sr, 0);
+	} else if (reached) {
+		TRACE_MARK_END(sr->vad_ts, "vad");
+		sr_dbg("client endpoint after %u ms of silence\n", sr->ep_silence_ms);
+		end_utterance(sr, 1);
+	} else if (MSP_EP_MAX_SPEECH == sr->ep_stat) {
+		/* too long to go on, but what was said still counts */
+		end_utterance(sr, 1);
+	} else if (sr->ep_stat > MSP_EP_AFTER_SPEECH) {
+		/* no speech before the engine's timeout, or it failed: the
+		 * session ends here, as it does on an error */
+		sr_dbg("engine endpointer ended at %d\n", sr->ep_stat);
+		end_sr_on_error(sr, sr->ep_stat == MSP_EP_TIMEOUT
+				? MSP_ERROR_TIME_OUT : MSP_ERROR_FAIL);
+	}
 
 	return 0;
 }
 
 void sr_uninit(struct speech_rec * sr)
 {
+	if (sr->end_running) {
+		pthread_mutex_lock(&sr->end_lock);
+		/* after a result still being collected */
+		while (sr->state == SR_STATE_ENDING)
+			pthread_cond_wait(&sr->end_cond, &sr->end_lock);
+		sr->end_pending = SR_END_QUIT;
+		pthread_cond_broadcast(&sr->end_cond);
+		pthread_mutex_unlock(&sr->end_lock);
+		pthread_join(sr->end_thread, NULL);
+		pthread_mutex_destroy(&sr->end_lock);
+		pthread_cond_destroy(&sr->end_cond);
+		sr->end_running = 0;
+	}
 	if (sr->recorder) {
 		if(!is_record_stopped(sr->recorder))
 			stop_record(sr->recorder);
@@ -328,4 +704,5 @@ void sr_uninit(struct speech_rec * sr)
 		SR_MFREE(sr->session_begin_params);
 		sr->session_begin_params = NULL;
 	}
+	vad_gate_free(&sr->ep_vad);
 }
@@ -6,6 +6,11 @@
 @date		2016/05/27
 */
 
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "trace.h"
+#include "vad_gate.h"
 
 enum sr_audsrc
 {
@@ -27,9 +32,60 @@ struct speech_rec_notifier {
 	void (*on_result)(const char *result, char is_last);
 	void (*on_speech_begin)();
 	void (*on_speech_end)(int reason);	/* 0 if VAD.  others, error : see E_SR_xxx and msp_errors.h  */
+	/* optional, called after on_result while still listening; returns
+	 * SR_PARTIAL_xxx. On SR_PARTIAL_COMMIT the session ends at once,
+	 * without waiting for the end of speech, and on_speech_end gets
+	 * END_REASON_EARLY_COMMIT */
+	int (*on_partial)();
 };
 
+#define SR_PARTIAL_LISTEN	0	/* the utterance may go on */
+#define SR_PARTIAL_COMPLETE	1	/* a whole command: end on complete_tail_ms */
+#define SR_PARTIAL_COMMIT	2	/* all that is needed, stop now */
+
+/* client side endpointing. Audio is classified in 10 ms frames as it
+ * is written, and once SR_EP_MIN_SPEECH_MS of speech was heard the
+ * utterance ends after tail_ms of silence, or complete_tail_ms once
+ * on_partial said the results form a whole command, without waiting
+ * for the engine VAD's longer trailing silence. 0 leaves the end to
+ * the engine. Set per dialog state with sr_set_endpoint */
+struct sr_endpoint {
+	unsigned int tail_ms;
+	unsigned int complete_tail_ms;
+};
+
+#define SR_EP_MIN_SPEECH_MS	100
+#define SR_EP_TAIL_MS		600
+#define SR_EP_COMPLETE_TAIL_MS	250
+
+/* session params that can change under a running recognizer, e.g. for
+ * a new grammar. Double buffered: sr_config_rebuild writes the back
+ * buffer without blocking anyone, then publishes it by swapping it to
+ * the front; sessions copy the front at sr_start_listening. One
+ * sr_config can be shared by several speech_recs.
+ * It also counts the sessions open with it, so that whatever the
+ * params name, e.g. the grammar, can be changed while none is:
+ * sr_config_hold waits for that and makes sessions wait to begin
+ * until sr_config_release */
+#define SR_CONFIG_LEN		1024
+
+struct sr_config {
+	pthread_mutex_t lock;		/* front, generation, sessions, held */
+	pthread_mutex_t build;		/* one rebuild at a time */
+	pthread_cond_t idle;		/* sessions down to 0, or released */
+	char buf[2][SR_CONFIG_LEN];
+	int front;
+	unsigned int generation;
+	unsigned int sessions;
+	int held;
+};
+
+/* writes params of at most size bytes to buf; returns their length or
+ * a negative error, like snprintf */
+typedef int (*sr_config_build)(char *buf, size_t size, void *arg);
+
 #define END_REASON_VAD_DETECT	0	/* detected speech done  */
+#define END_REASON_EARLY_COMMIT	END_REASON_VAD_DETECT	/* on_partial said done */
 
 struct speech_rec {
 	enum sr_audsrc aud_src;  /* from mic or manual  stream write */
@@ -41,6 +97,26 @@ struct speech_rec {
 	struct recorder *recorder;
 	volatile int state;
 	char * session_begin_params;
+	struct sr_config *config;	/* if set, params come from here */
+	unsigned int config_generation;
+	int config_session;	/* the session open is counted in config */
+	struct sr_endpoint endpoint;	/* of this session */
+	struct sr_endpoint ep_next;	/* from sr_set_endpoint */
+	int ep_enabled;		/* 0 if $XIUXIU_ENDPOINT=0 */
+	struct vad_gate ep_vad;
+	unsigned int ep_speech_ms;
+	unsigned int ep_silence_ms;	/* since the last speech */
+	int ep_complete;
+	uint64_t eos_us;	/* when the utterance ended */
+	/* SR_USER: the final result is collected on end_thread, never on
+	 * the thread feeding the audio */
+	pthread_t end_thread;
+	pthread_mutex_t end_lock;
+	pthread_cond_t end_cond;	/* end_pending set, or a session ended */
+	int end_pending;
+	int end_running;
+	TRACE_TS_FIELD(vad_ts)	/* session open until VAD end */
+	TRACE_TS_FIELD(poll_ts)
 };
 
 
@@ -51,10 +127,38 @@ extern "C" {
 /* must init before start . is aud_src is SR_MIC, the default capture device
  * will be used. see sr_init_ex */
 int sr_init(struct speech_rec * sr, const char * session_begin_params, struct speech_rec_notifier * notifier);
+/* SR_USER opens no recorder; audio comes from sr_write_audio_data or
+ * sr_feed_audio, e.g. routed from the wake-word capture */
+int sr_init_ex(struct speech_rec * sr, const char * session_begin_params,
+		enum sr_audsrc aud_src, struct speech_rec_notifier * notifier);
+/* takes effect at the next sr_start_listening */
+void sr_set_endpoint(struct speech_rec *sr, const struct sr_endpoint *ep);
+/* take the session params from config from the next
+ * sr_start_listening on, instead of the ones given to sr_init */
+void sr_use_config(struct speech_rec *sr, struct sr_config *config);
+
+int sr_config_init(struct sr_config *c, const char *params);
+void sr_config_free(struct sr_config *c);
+/* build the next params into the back buffer and publish them; safe on
+ * any thread while sessions start. Returns 0, the build error, or
+ * -E_SR_INVAL if they did not fit */
+int sr_config_rebuild(struct sr_config *c, sr_config_build build, void *arg);
+/* copy the published params to buf; returns their generation */
+unsigned int sr_config_get(struct sr_config *c, char *buf, size_t size);
+/* wait up to timeout_ms for no session of c to be open, then keep new
+ * ones from beginning; returns 0, or -1 on timeout. Every 0 must be
+ * followed by sr_config_release */
+int sr_config_hold(struct sr_config *c, unsigned int timeout_ms);
+void sr_config_release(struct sr_config *c);
 int sr_start_listening(struct speech_rec *sr);
 int sr_stop_listening(struct speech_rec *sr);
 /* only used for the manual write way. */
 int sr_write_audio_data(struct speech_rec *sr, char *data, unsigned int len);
+/* recorder-style callback: writes while listening, drops data otherwise.
+ * user_para is the speech_rec. It never waits for the final result:
+ * for SR_USER that is polled on a thread of the recognizer, which then
+ * calls on_speech_end */
+void sr_feed_audio(char *data, unsigned long len, void *user_para);
 /* must call uninit after you don't use it */
 void sr_uninit(struct speech_rec * sr);
 
@@ -0,0 +1,776 @@
+/*
+ * @file
+ * @brief multi-stream recognition server over Unix/TCP sockets
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "qivw.h"
+#include "qisr.h"
+#include "msp_cmn.h"
+#include "msp_errors.h"
+#include "stream_server.h"
+#include "vad_gate.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define SS_DBGON 1
+#if SS_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+#define SS_SAMPLE_RATE		16000
+#define SS_READ_SIZE		6400	/* 200 ms */
+#define SS_READS_PER_TURN	4	/* then yield the worker to other streams */
+#define SS_POLL_MS		10
+#define SS_POLL_MAX		500	/* give up on a final result after 5 s */
+#define SS_REPORT_MS		10000
+#define SS_EVENT_LEN		256
+#define SS_GATE_PREROLL_MS	300
+#define SS_GATE_HANGOVER_MS	500
+
+enum {
+	SS_EP_LISTEN,
+	SS_EP_STREAM,
+	SS_EP_STOP
+};
+
+enum {
+	SS_STATE_WAKE,		/* audio goes to the wake-word session */
+	SS_STATE_ASR		/* audio goes to the recognizer session */
+};
+
+/* first member of everything registered with epoll */
+struct ss_ep {
+	int kind;
+	int fd;
+};
+
+struct stream_server;
+
+struct ss_stream {
+	struct ss_ep ep;
+	struct stream_server *srv;
+	struct ss_stream *next_free;
+	int state;
+	int failed;
+	int woke;			/* set by the IVW notify callback */
+
+	const char *ivw_sid;
+	int ivw_status;
+	struct vad_gate gate;
+
+	const char *isr_sid;
+	int isr_status;
+	int ep_stat;
+	int rec_stat;
+	char *result;
+	size_t result_len;
+	size_t result_cap;
+
+	char carry;			/* odd byte left over from the last read */
+	int has_carry;
+};
+
+struct stream_server {
+	const struct stream_server_conf *conf;
+	int epfd;
+	struct ss_ep listen[2];
+	int nlisten;
+	struct ss_ep stop;
+
+	struct ss_stream *streams;
+	struct ss_stream *free_list;
+	pthread_mutex_t pool_lock;
+	int active;
+
+	uint64_t samples;
+};
+
+METRIC_GAUGE_DEFINE(m_active, "xiuxiu_server_streams_active",
+		"Streams currently holding a session slot");
+METRIC_COUNTER_DEFINE(m_streams, "xiuxiu_server_streams_total",
+		"Streams accepted by the server");
+METRIC_COUNTER_DEFINE(m_rejected, "xiuxiu_server_streams_rejected_total",
+		"Connections turned away because the session pool was full");
+METRIC_COUNTER_DEFINE(m_audio_ms, "xiuxiu_server_audio_milliseconds_total",
+		"Audio received over all streams");
+METRIC_COUNTER_DEFINE(m_cpu_ms, "xiuxiu_server_cpu_milliseconds_total",
+		"Process CPU time while serving; audio over CPU is streams per core");
+
+static int g_stop_fd = -1;
+
+static void on_stop_signal(int sig)
+{
+	uint64_t one = 1;
+
+	if (write(g_stop_fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static int env_int(const char *name, int def)
+{
+	const char *env = getenv(name);
+
+	return env && *env ? atoi(env) : def;
+}
+
+void stream_server_conf_init(struct stream_server_conf *conf,
+		const char *ivw_params, const char *asr_params)
+{
+	const char *env = getenv("XIUXIU_SERVER_SOCK");
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (ncpu < 1)
+		ncpu = 1;
+	memset(conf, 0, sizeof(*conf));
+	conf->unix_path = env ? (*env ? env : NULL) : STREAM_SERVER_DEFAULT_SOCK;
+	conf->tcp_port = env_int("XIUXIU_SERVER_PORT", 0);
+	conf->workers = env_int("XIUXIU_SERVER_WORKERS", (int)ncpu);
+	conf->sessions = env_int("XIUXIU_SERVER_SESSIONS", (int)ncpu * 4);
+	conf->ivw_params = ivw_params;
+	conf->asr_params = asr_params;
+}
+
+/* events are small; a client that stops reading loses them */
+static void send_str(struct ss_stream *st, const char *s, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(st->ep.fd, s, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			dbg("stream %d: event dropped: %s\n", st->ep.fd,
+					n < 0 ? strerror(errno) : "short write");
+			return;
+		}
+		s += n;
+		len -= n;
+	}
+}
+
+static void send_event(struct ss_stream *st, const char *fmt, ...)
+{
+	char buf[SS_EVENT_LEN];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+	send_str(st, buf, len);
+}
+
+static void send_result(struct ss_stream *st)
+{
+	static const char head[] = "{\"event\":\"result\",\"text\":\"";
+	static const char tail[] = "\"}\n";
+	char *out, *p;
+	size_t i;
+
+	out = (char *)malloc(sizeof(head) + st->result_len * 6 + sizeof(tail));
+	if (!out)
+		return;
+	p = out + sprintf(out, "%s", head);
+	for (i = 0; i < st->result_len; i++) {
+		unsigned char c = st->result[i];
+
+		if (c == '"' || c == '\\') {
+			*p++ = '\\';
+			*p++ = c;
+		} else if (c < 0x20) {
+			p += sprintf(p, "\\u%04x", c);
+		} else {
+			*p++ = c;
+		}
+	}
+	p += sprintf(p, "%s", tail);
+	send_str(st, out, p - out);
+	free(out);
+}
+
+static void result_append(struct ss_stream *st, const char *rslt)
+{
+	size_t len = strlen(rslt);
+	size_t cap;
+	char *p;
+
+	if (st->result_len + len + 1 > st->result_cap) {
+		cap = st->result_cap ? st->result_cap : 1024;
+		while (cap < st->result_len + len + 1)
+			cap *= 2;
+		p = (char *)realloc(st->result, cap);
+		if (!p)
+			return;
+		st->result = p;
+		st->result_cap = cap;
+	}
+	memcpy(st->result + st->result_len, rslt, len + 1);
+	st->result_len += len;
+}
+
+static int ivw_notify(const char *sessionID, int msg, int param1, int param2,
+		const void *info, void *userData)
+{
+	struct ss_stream *st = (struct ss_stream *)userData;
+
+	if (MSP_IVW_MSG_WAKEUP == msg)
+		__atomic_store_n(&st->woke, 1, __ATOMIC_RELEASE);
+	else if (MSP_IVW_MSG_ERROR == msg)
+		__atomic_store_n(&st->failed, param1 ? param1 : -1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void ivw_write(const char *data, unsigned long len, void *user_para)
+{
+	struct ss_stream *st = (struct ss_stream *)user_para;
+	int ret;
+
+	if (st->failed)
+		return;
+	ret = QIVWAudioWrite(st->ivw_sid, data, len, st->ivw_status);
+	if (ret != MSP_SUCCESS) {
+		st->failed = ret;
+		return;
+	}
+	st->ivw_status = MSP_AUDIO_SAMPLE_CONTINUE;
+}
+
+static void isr_end(struct ss_stream *st, const char *hints)
+{
+	if (st->isr_sid) {
+		QISRSessionEnd(st->isr_sid, hints);
+		st->isr_sid = NULL;
+	}
+	st->state = SS_STATE_WAKE;
+	vad_gate_reset(&st->gate);
+}
+
+static void isr_begin(struct ss_stream *st)
+{
+	int err = MSP_SUCCESS;
+
+	st->isr_sid = QISRSessionBegin(NULL, st->srv->conf->asr_params, &err);
+	if (err != MSP_SUCCESS) {
+		st->isr_sid = NULL;
+		send_event(st, "{\"event\":\"error\",\"code\":%d}\n", err);
+		return;
+	}
+	st->isr_status = MSP_AUDIO_SAMPLE_FIRST;
+	st->ep_stat = MSP_EP_LOOKING_FOR_SPEECH;
+	st->rec_stat = MSP_REC_STATUS_SUCCESS;
+	st->result_len = 0;
+	st->state = SS_STATE_ASR;
+}
+
+/* end of speech or end of stream: flush and collect the final result.
+ * Polling holds this worker, which is why there are several. */
+static void isr_finish(struct ss_stream *st)
+{
+	const char *rslt;
+	int ret, tries;
+
+	ret = QISRAudioWrite(st->isr_sid, NULL, 0, MSP_AUDIO_SAMPLE_LAST,
+			&st->ep_stat, &st->rec_stat);
+	for (tries = 0; ret == MSP_SUCCESS && st->rec_stat != MSP_REC_STATUS_COMPLETE
+			&& tries < SS_POLL_MAX; tries++) {
+		rslt = QISRGetResult(st->isr_sid, &st->rec_stat, 0, &ret);
+		if (rslt)
+			result_append(st, rslt);
+		if (st->rec_stat != MSP_REC_STATUS_COMPLETE)
+			usleep(SS_POLL_MS * 1000);
+	}
+	if (ret != MSP_SUCCESS)
+		send_event(st, "{\"event\":\"error\",\"code\":%d}\n", ret);
+	else
+		send_result(st);
+	isr_end(st, ret == MSP_SUCCESS ? "normal" : "err");
+}
+
+static void isr_write(struct ss_stream *st, const char *data, unsigned long len)
+{
+	const char *rslt;
+	int ret;
+
+	ret = QISRAudioWrite(st->isr_sid, data, len, st->isr_status,
+			&st->ep_stat, &st->rec_stat);
+	if (ret != MSP_SUCCESS) {
+		send_event(st, "{\"event\":\"error\",\"code\":%d}\n", ret);
+		isr_end(st, "err");
+		return;
+	}
+	st->isr_status = MSP_AUDIO_SAMPLE_CONTINUE;
+
+	if (st->rec_stat == MSP_REC_STATUS_SUCCESS) {
+		rslt = QISRGetResult(st->isr_sid, &st->rec_stat, 0, &ret);
+		if (ret != MSP_SUCCESS) {
+			send_event(st, "{\"event\":\"error\",\"code\":%d}\n", ret);
+			isr_end(st, "err");
+			return;
+		}
+		if (rslt)
+			result_append(st, rslt);
+	}
+	/* as in speech_recognizer.c: too long still gives a result, no
+	 * speech before the timeout or an endpointer error gives none */
+	if (st->ep_stat == MSP_EP_AFTER_SPEECH || st->ep_stat == MSP_EP_MAX_SPEECH) {
+		isr_finish(st);
+	} else if (st->ep_stat > MSP_EP_AFTER_SPEECH) {
+		send_event(st, "{\"event\":\"error\",\"code\":%d}\n",
+				st->ep_stat == MSP_EP_TIMEOUT ? MSP_ERROR_TIME_OUT : MSP_ERROR_FAIL);
+		isr_end(st, "err");
+	}
+}
+
+static void stream_audio(struct ss_stream *st, const char *data, unsigned long len)
+{
+	__atomic_add_fetch(&st->srv->samples, len / 2, __ATOMIC_RELAXED);
+
+	if (st->state == SS_STATE_ASR) {
+		isr_write(st, data, len);
+		return;
+	}
+
+	vad_gate_process(&st->gate, data, len, ivw_write, st);
+	if (__atomic_exchange_n(&st->woke, 0, __ATOMIC_ACQ_REL)) {
+		send_event(st, "{\"event\":\"wake\"}\n");
+		isr_begin(st);
+	}
+}
+
+/* returns -1 when the stream is finished */
+static int stream_service(struct ss_stream *st, char *buf)
+{
+	ssize_t r;
+	size_t len;
+	int i;
+
+	for (i = 0; i < SS_READS_PER_TURN; i++) {
+		if (st->has_carry)
+			buf[0] = st->carry;
+		r = read(st->ep.fd, buf + st->has_carry, SS_READ_SIZE - st->has_carry);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0 && errno == EAGAIN)
+			return 0;
+		if (r <= 0)
+			return -1;
+
+		len = r + st->has_carry;
+		st->has_carry = len & 1;
+		if (st->has_carry)
+			st->carry = buf[--len];
+		stream_audio(st, buf, len);
+
+		if (st->failed) {
+			send_event(st, "{\"event\":\"error\",\"code\":%d}\n", st->failed);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static struct ss_stream *pool_get(struct stream_server *srv)
+{
+	struct ss_stream *st;
+
+	pthread_mutex_lock(&srv->pool_lock);
+	st = srv->free_list;
+	if (st) {
+		srv->free_list = st->next_free;
+		srv->active++;
+		metric_set(&m_active, srv->active);
+	}
+	pthread_mutex_unlock(&srv->pool_lock);
+	return st;
+}
+
+static void pool_put(struct stream_server *srv, struct ss_stream *st)
+{
+	pthread_mutex_lock(&srv->pool_lock);
+	st->next_free = srv->free_list;
+	srv->free_list = st;
+	srv->active--;
+	metric_set(&m_active, srv->active);
+	pthread_mutex_unlock(&srv->pool_lock);
+}
+
+static void stream_release(struct ss_stream *st)
+{
+	if (st->state == SS_STATE_ASR && !st->failed)
+		isr_finish(st);
+	isr_end(st, "closed");
+	if (st->ivw_sid) {
+		QIVWSessionEnd(st->ivw_sid, "closed");
+		st->ivw_sid = NULL;
+	}
+	/* closing drops it from the epoll set */
+	close(st->ep.fd);
+	st->ep.fd = -1;
+	pool_put(st->srv, st);
+}
+
+static int stream_open(struct ss_stream *st, int fd)
+{
+	struct epoll_event ev;
+	int err = MSP_SUCCESS;
+
+	st->ep.fd = fd;
+	st->state = SS_STATE_WAKE;
+	st->failed = 0;
+	st->woke = 0;
+	st->has_carry = 0;
+	st->result_len = 0;
+	vad_gate_reset(&st->gate);
+
+	st->ivw_sid = QIVWSessionBegin(NULL, st->srv->conf->ivw_params, &err);
+	if (err != MSP_SUCCESS) {
+		st->ivw_sid = NULL;
+		goto fail;
+	}
+	err = QIVWRegisterNotify(st->ivw_sid, ivw_notify, st);
+	if (err != MSP_SUCCESS) {
+		QIVWSessionEnd(st->ivw_sid, "QIVWRegisterNotify failed");
+		st->ivw_sid = NULL;
+		goto fail;
+	}
+	st->ivw_status = MSP_AUDIO_SAMPLE_FIRST;
+
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = &st->ep;
+	if (epoll_ctl(st->srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		err = -errno;
+		QIVWSessionEnd(st->ivw_sid, "epoll failed");
+		st->ivw_sid = NULL;
+		goto fail;
+	}
+	return 0;
+
+fail:
+	/* the caller closes fd; shutdown must not release the slot again */
+	st->ep.fd = -1;
+	return err;
+}
+
+static void accept_all(struct stream_server *srv, int lfd)
+{
+	static const char busy[] = "{\"event\":\"busy\"}\n";
+	char msg[SS_EVENT_LEN];
+	struct ss_stream *st;
+	int fd, err, len;
+
+	while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		st = pool_get(srv);
+		if (!st) {
+			metric_inc(&m_rejected);
+			if (send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL) < 0)
+				dbg("busy reply failed: %s\n", strerror(errno));
+			close(fd);
+			continue;
+		}
+		err = stream_open(st, fd);
+		if (err) {
+			len = snprintf(msg, sizeof(msg),
+					"{\"event\":\"error\",\"code\":%d}\n", err);
+			if (send(fd, msg, len, MSG_NOSIGNAL) < 0)
+				dbg("error reply failed: %s\n", strerror(errno));
+			close(fd);
+			pool_put(srv, st);
+			continue;
+		}
+		metric_inc(&m_streams);
+		dbg("stream %d: accepted, %d active\n", fd, srv->active);
+	}
+}
+
+static void *worker_proc(void *arg)
+{
+	struct stream_server *srv = (struct stream_server *)arg;
+	struct epoll_event ev;
+	struct ss_ep *ep;
+	struct ss_stream *st;
+	char *buf;
+	int n;
+
+	buf = (char *)malloc(SS_READ_SIZE);
+	if (!buf)
+		return NULL;
+
+	while (1) {
+		n = epoll_wait(srv->epfd, &ev, 1, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		ep = (struct ss_ep *)ev.data.ptr;
+		/* level-triggered, so every worker sees it */
+		if (ep->kind == SS_EP_STOP)
+			break;
+		if (ep->kind == SS_EP_LISTEN) {
+			accept_all(srv, ep->fd);
+			continue;
+		}
+
+		st = (struct ss_stream *)ep;
+		if (stream_service(st, buf) < 0) {
+			dbg("stream %d: closed\n", st->ep.fd);
+			stream_release(st);
+			continue;
+		}
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.ptr = &st->ep;
+		epoll_ctl(srv->epfd, EPOLL_CTL_MOD, st->ep.fd, &ev);
+	}
+	free(buf);
+	return NULL;
+}
+
+static int listen_add(struct stream_server *srv, int fd)
+{
+	struct ss_ep *ep = &srv->listen[srv->nlisten];
+	struct epoll_event ev;
+
+	if (listen(fd, 64) < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+		return -errno;
+	ep->kind = SS_EP_LISTEN;
+	ep->fd = fd;
+	ev.events = EPOLLIN;
+	ev.data.ptr = ep;
+	if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return -errno;
+	srv->nlisten++;
+	return 0;
+}
+
+static int listen_unix(struct stream_server *srv, const char *path)
+{
+	struct sockaddr_un addr;
+	int fd, err;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -EINVAL;
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	err = listen_add(srv, fd);
+	if (err)
+		close(fd);
+	return err;
+}
+
+/* localhost only: the audio is not authenticated */
+static int listen_tcp(struct stream_server *srv, int port)
+{
+	struct sockaddr_in addr;
+	int fd, err, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	err = listen_add(srv, fd);
+	if (err)
+		close(fd);
+	return err;
+}
+
+static uint64_t cpu_us()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+		+ ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/* audio seconds handled per CPU second is how many real-time streams
+ * one core sustains */
+static void log_rate(const char *what, int active, uint64_t samples, uint64_t cpu)
+{
+	double audio_s = (double)samples / SS_SAMPLE_RATE;
+	double cpu_s = cpu / 1e6;
+
+	if (samples)
+		xlog(XLOG_INFO, "[server] %s: %d active, %.1f s audio in %.2f s cpu, "
+				"%.1f streams/core\n", what, active, audio_s, cpu_s,
+				cpu_s > 0 ? audio_s / cpu_s : 0.0);
+}
+
+static void report(struct stream_server *srv, uint64_t *last_samples,
+		uint64_t *last_cpu)
+{
+	uint64_t samples = __atomic_load_n(&srv->samples, __ATOMIC_RELAXED);
+	uint64_t cpu = cpu_us();
+
+	metric_add(&m_audio_ms, (samples - *last_samples) * 1000 / SS_SAMPLE_RATE);
+	metric_add(&m_cpu_ms, (cpu - *last_cpu) / 1000);
+	log_rate("last 10 s", srv->active, samples - *last_samples, cpu - *last_cpu);
+	*last_samples = samples;
+	*last_cpu = cpu;
+}
+
+int stream_server_run(const struct stream_server_conf *conf)
+{
+	struct stream_server srv;
+	struct sigaction sa, old_int, old_term;
+	struct epoll_event ev;
+	struct pollfd pfd;
+	pthread_t *workers = NULL;
+	uint64_t last_samples = 0, last_cpu, start_cpu;
+	int i, nworkers = 0, err = 0;
+
+	if (conf->sessions <= 0 || conf->workers <= 0
+			|| (!conf->unix_path && !conf->tcp_port))
+		return -EINVAL;
+
+	memset(&srv, 0, sizeof(srv));
+	srv.conf = conf;
+	pthread_mutex_init(&srv.pool_lock, NULL);
+
+	srv.streams = (struct ss_stream *)calloc(conf->sessions, sizeof(struct ss_stream));
+	if (!srv.streams)
+		return -ENOMEM;
+	for (i = conf->sessions - 1; i >= 0; i--) {
+		srv.streams[i].ep.kind = SS_EP_STREAM;
+		srv.streams[i].ep.fd = -1;
+		srv.streams[i].srv = &srv;
+		if (vad_gate_init(&srv.streams[i].gate, SS_SAMPLE_RATE,
+					SS_GATE_PREROLL_MS, SS_GATE_HANGOVER_MS) != 0) {
+			err = -ENOMEM;
+			goto out;
+		}
+		srv.streams[i].next_free = srv.free_list;
+		srv.free_list = &srv.streams[i];
+	}
+
+	srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+	g_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (srv.epfd < 0 || g_stop_fd < 0) {
+		err = -errno;
+		goto out;
+	}
+	srv.stop.kind = SS_EP_STOP;
+	srv.stop.fd = g_stop_fd;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &srv.stop;
+	epoll_ctl(srv.epfd, EPOLL_CTL_ADD, g_stop_fd, &ev);
+
+	if (conf->unix_path && (err = listen_unix(&srv, conf->unix_path)) != 0) {
+		xlog(XLOG_ERROR, "server: can't listen on %s: %s\n",
+				conf->unix_path, strerror(-err));
+		goto out;
+	}
+	if (conf->tcp_port && (err = listen_tcp(&srv, conf->tcp_port)) != 0) {
+		xlog(XLOG_ERROR, "server: can't listen on 127.0.0.1:%d: %s\n",
+				conf->tcp_port, strerror(-err));
+		goto out;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_stop_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, &old_int);
+	sigaction(SIGTERM, &sa, &old_term);
+
+	workers = (pthread_t *)calloc(conf->workers, sizeof(pthread_t));
+	if (!workers) {
+		err = -ENOMEM;
+		goto restore;
+	}
+	for (nworkers = 0; nworkers < conf->workers; nworkers++)
+		if (pthread_create(&workers[nworkers], NULL, worker_proc, &srv) != 0)
+			break;
+	if (nworkers == 0) {
+		err = -EAGAIN;
+		goto restore;
+	}
+
+	xlog(XLOG_INFO, "server: unix %s, tcp port %d, %d workers, %d sessions\n",
+			conf->unix_path ? conf->unix_path : "-", conf->tcp_port,
+			nworkers, conf->sessions);
+
+	start_cpu = last_cpu = cpu_us();
+	pfd.fd = g_stop_fd;
+	pfd.events = POLLIN;
+	while ((i = poll(&pfd, 1, SS_REPORT_MS)) <= 0) {
+		if (i == 0) {
+			report(&srv, &last_samples, &last_cpu);
+		} else if (errno != EINTR) {
+			xlog(XLOG_ERROR, "server: poll failed: %s\n", strerror(errno));
+			/* the workers stop on the same eventfd */
+			on_stop_signal(0);
+			break;
+		}
+	}
+
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	for (i = 0; i < conf->sessions; i++)
+		if (srv.streams[i].ep.fd >= 0)
+			stream_release(&srv.streams[i]);
+
+	log_rate("total", 0, srv.samples, cpu_us() - start_cpu);
+
+restore:
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+out:
+	free(workers);
+	for (i = 0; i < srv.nlisten; i++)
+		close(srv.listen[i].fd);
+	if (conf->unix_path && srv.nlisten)
+		unlink(conf->unix_path);
+	if (srv.epfd > 0)
+		close(srv.epfd);
+	if (g_stop_fd >= 0) {
+		close(g_stop_fd);
+		g_stop_fd = -1;
+	}
+	for (i = 0; i < conf->sessions; i++) {
+		vad_gate_free(&srv.streams[i].gate);
+		free(srv.streams[i].result);
+	}
+	free(srv.streams);
+	pthread_mutex_destroy(&srv.pool_lock);
+	return err;
+}
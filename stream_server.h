@@ -0,0 +1,56 @@
+/*
+ * @file
+ * @brief recognize many PCM streams at once over local sockets
+ *
+ * Each client connects to the Unix socket or to 127.0.0.1:port and
+ * sends raw 16 kHz, 16 bit mono PCM. Every connection gets a slot from
+ * a bounded session pool with its own wake-word session; after a wake
+ * the audio goes to a recognizer session until the endpoint, then back
+ * to wake detection. Events come back on the same socket, one JSON
+ * object per line:
+ *
+ *	{"event":"wake"}
+ *	{"event":"result","text":"<xml result>"}
+ *	{"event":"error","code":10108}
+ *	{"event":"busy"}		pool full, the server closes
+ *
+ * Closing the write side of the socket ends the stream. Connections
+ * are served by a fixed worker pool over a shared epoll set with
+ * EPOLLONESHOT, so a stream is only ever handled by one worker at a
+ * time and no thread is tied to an idle client.
+ *
+ * While running the server logs the sustained streams-per-core, the
+ * audio time processed over the CPU time spent.
+ */
+
+#ifndef STREAM_SERVER_H
+#define STREAM_SERVER_H
+
+#define STREAM_SERVER_DEFAULT_SOCK	"/tmp/xiuxiu.sock"
+
+struct stream_server_conf {
+	const char *unix_path;		/* NULL: no Unix socket */
+	int tcp_port;			/* 0: no TCP socket */
+	int workers;
+	int sessions;			/* pool size, concurrent streams */
+	const char *ivw_params;		/* QIVWSessionBegin params */
+	const char *asr_params;		/* QISRSessionBegin params */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* defaults overridden by $XIUXIU_SERVER_SOCK, $XIUXIU_SERVER_PORT,
+ * $XIUXIU_SERVER_WORKERS and $XIUXIU_SERVER_SESSIONS */
+void stream_server_conf_init(struct stream_server_conf *conf,
+		const char *ivw_params, const char *asr_params);
+
+/* serve until SIGINT/SIGTERM; returns 0 or a negative errno */
+int stream_server_run(const struct stream_server_conf *conf);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -14,12 +14,23 @@
 #include "qisr.h"
 #include "speech_recognizer.h"
 #include "sound_playback.h"
+#include "trace.h"
+#include "metrics.h"
+#include "xlog.h"
+#include "rt_thread.h"
+#include "stream_server.h"
+#include "grammar.h"
+#include "barge_in.h"
+#include "tts.h"
+#include "tts_pool.h"
+#include "reply.h"
+#include "reply_number.h"
+#include "asr_result.h"
+#include "intent.h"
+#include "lexicon.h"
 
 #define	BUFFER_SIZE	4096
-#define SAMPLE_RATE_16K     (16000)
-#define MAX_GRAMMARID_LEN   (32)
-#define MAX_PARAMS_LEN      (1024)
-#define dbg printf
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
 
 enum{
     XIUXIU_STATUS_INIT
@@ -27,25 +38,39 @@ enum{
    ,XIUXIU_STATUS_AWAKEN
    ,XIUXIU_STATUS_RECOGNIZING
    ,XIUXIU_STATUS_RECOGNIZED
+   ,XIUXIU_STATUS_FAILED       /* recognizer error or timeout */
 };
 
 volatile int g_status;
 static char *g_result = NULL;
 static unsigned int g_buffersize = BUFFER_SIZE;
-
-const char * ASR_RES_PATH        = "fo|res/asr/common.jet"; //离线语法识别资源路径
-const char * GRM_BUILD_PATH      = "res/asr/GrmBuilld"; //构建离线语法识别网络生成数据保存路径
-const char * GRM_FILE            = "call.bnf"; //构建离线识别语法网络所用的语法文件
-const char * LEX_NAME            = "contact"; //更新离线识别语法的contact槽（语法文件为此示例中使用的call.bnf）
-
-typedef struct _UserData {
-	int     build_fini; //标识语法构建是否完成
-	int     update_fini; //标识更新词典是否完成
-	int     errcode; //记录语法构建或更新词典回调错误码
-	char    grammar_id[MAX_GRAMMARID_LEN]; //保存语法构建返回的语法ID
-}UserData;
-
-extern int text_to_speech(const char* text);
+static int g_early_commit = 1;
+static int g_reprompted;
+static struct sr_config g_asr_config;
+
+/* trailing silence that ends a command, per dialog state: right after
+ * the greeting commands are short and quick, after a re-prompt people
+ * hesitate more */
+static const struct sr_endpoint ep_command = { 500, 200 };
+static const struct sr_endpoint ep_reprompt = { 800, 300 };
+
+/* what the asking commands report, CHAIR_UNKNOWN until the chair
+ * controller has told us; nothing sets them yet */
+#define CHAIR_UNKNOWN   -1
+static struct {
+    int energy;             /* 档 */
+    int strength;           /* 档 */
+    int speed;              /* 档 */
+    int amplitude;          /* 档 */
+    int temperature;        /* 度 */
+    long remaining;         /* seconds left of the program */
+} g_chair = { CHAIR_UNKNOWN, CHAIR_UNKNOWN, CHAIR_UNKNOWN, CHAIR_UNKNOWN,
+    CHAIR_UNKNOWN, CHAIR_UNKNOWN };
+
+
+METRIC_COUNTER_DEFINE(m_wakeups, "xiuxiu_wakeups_total", "Wake-word detections");
+METRIC_COUNTER_DEFINE(m_commands, "xiuxiu_commands_total", "Recognized and executed commands");
+METRIC_COUNTER_DEFINE(m_rejects, "xiuxiu_rejects_total", "Recognitions answered with a re-prompt");
 
 
 int cb_ivw_msg_proc( const char *sessionID, int msg, int param1, int param2, const void *info, void *userData )
@@ -55,6 +80,9 @@ int cb_ivw_msg_proc( const char *sessionID, int msg, int param1, int param2, con
 		dbg("\n\nMSP_IVW_MSG_ERROR errCode = %d\n\n", param1);
         return -1;
 	}else if (MSP_IVW_MSG_WAKEUP == msg){
+        TRACE_TURN_BEGIN();
+        TRACE_INSTANT("wake");
+        metric_inc(&m_wakeups);
         dbg("wake up\n");
         g_status = XIUXIU_STATUS_AWAKEN;
 	}
@@ -90,82 +118,64 @@ void on_speech_begin()
 
 	dbg("Start Listening...\n");
 }
-void on_speech_end(int reason)
+static int build_asr_params(char *buf, size_t size, void *grammar_id)
 {
-	if (reason == 0){
-		dbg("\nSpeaking done \n");
-        dbg("Result:%s\n", g_result);
-        g_status = XIUXIU_STATUS_RECOGNIZED;
-    }
-	else
-		dbg("\nRecognizer error %d\n", reason);
+	return grammar_asr_params(buf, size, (const char *)grammar_id);
 }
 
-int build_grm_cb(int ecode, const char *info, void *udata)
+/* on the lexicon thread: sessions from the next one on use grammar_id */
+void on_grammar(const char *grammar_id, void *arg)
 {
-	UserData *grm_data = (UserData *)udata;
+	int ret = sr_config_rebuild(&g_asr_config, build_asr_params,
+			(void *)grammar_id);
 
-	if (NULL != grm_data) {
-		grm_data->build_fini = 1;
-		grm_data->errcode = ecode;
-	}
-
-	if (MSP_SUCCESS == ecode && NULL != info) {
-		dbg("构建语法成功！ 语法ID:%s\n", info);
-		if (NULL != grm_data)
-			snprintf(grm_data->grammar_id, MAX_GRAMMARID_LEN - 1, info);
-	}
-	else
-		dbg("构建语法失败！%d\n", ecode);
-
-	return 0;
+	if (ret != 0)
+		dbg("grammar %s not taken up: %d\n", grammar_id, ret);
 }
 
-int build_grammar(UserData *udata)
+/* on the lexicon thread: no recognition session while the words change */
+int on_lexicon_hold(int hold, void *arg)
 {
-	FILE *grm_file                           = NULL;
-	char *grm_content                        = NULL;
-	unsigned int grm_cnt_len                 = 0;
-	char grm_build_params[MAX_PARAMS_LEN];
-	int ret                                  = 0;
-
-	grm_file = fopen(GRM_FILE, "rb");	
-	if(NULL == grm_file) {
-		dbg("打开\"%s\"文件失败！[%s]\n", GRM_FILE, strerror(errno));
-		return -1; 
+	if (!hold) {
+		sr_config_release(&g_asr_config);
+		return 0;
 	}
+	return sr_config_hold(&g_asr_config, LEXICON_HOLD_MS);
+}
 
-	fseek(grm_file, 0, SEEK_END);
-	grm_cnt_len = ftell(grm_file);
-	fseek(grm_file, 0, SEEK_SET);
-
-	grm_content = (char *)malloc(grm_cnt_len + 1);
-	if (NULL == grm_content)
-	{
-		dbg("内存分配失败!\n");
-		fclose(grm_file);
-		grm_file = NULL;
-		return -1;
+/* a short command is acted on as soon as its result is in, rather than
+ * after the trailing silence the VAD waits for */
+int on_partial()
+{
+	struct asr_result result;
+	struct intent it;
+
+	if (!g_result)
+		return SR_PARTIAL_LISTEN;
+	/* not a whole result document yet */
+	if (asr_result_parse(g_result, &result) != 0)
+		return SR_PARTIAL_LISTEN;
+	if (g_early_commit && intent_early(&result, &it) == 0) {
+		dbg("early commit: %d/%d at %d\n", it.kind, it.target, it.confidence);
+		return SR_PARTIAL_COMMIT;
 	}
-	fread((void*)grm_content, 1, grm_cnt_len, grm_file);
-	grm_content[grm_cnt_len] = '\0';
-	fclose(grm_file);
-	grm_file = NULL;
-
-	snprintf(grm_build_params, MAX_PARAMS_LEN - 1, 
-		"engine_type = local, \
-		asr_res_path = %s, sample_rate = %d, \
-		grm_build_path = %s, ",
-		ASR_RES_PATH,
-		SAMPLE_RATE_16K,
-		GRM_BUILD_PATH
-		);
-	ret = QISRBuildGrammar("bnf", grm_content, grm_cnt_len, grm_build_params, build_grm_cb, udata);
-
-	free(grm_content);
-	grm_content = NULL;
-
-	return ret;
+	/* a command already, more speech is unlikely: end on a short tail */
+	if (intent_resolve(&result, &it) == 0)
+		return SR_PARTIAL_COMPLETE;
+	return SR_PARTIAL_LISTEN;
+}
+void on_speech_end(int reason)
+{
+	if (reason == 0){
+		dbg("\nSpeaking done \n");
+        dbg("Result:%s\n", g_result);
+        g_status = XIUXIU_STATUS_RECOGNIZED;
+    }
+	else{
+		dbg("\nRecognizer error %d\n", reason);
+        /* the session is over: back to the wake word */
+        g_status = XIUXIU_STATUS_FAILED;
+    }
 }
 
 static void print_elements(xmlNode *a_node){
@@ -183,24 +193,6 @@ static void print_elements(xmlNode *a_node){
     }
 }
 
-static xmlChar* get_element_content(xmlNode *root, const char* node_name){
-
-    xmlNode *cur_node;
-    xmlChar *content;
-
-    for(cur_node = root; cur_node; cur_node = cur_node->next){
-        if(cur_node->type == XML_ELEMENT_NODE && strcmp((const char*)cur_node->name, node_name) == 0){
-            if(cur_node->children){
-                return cur_node->children->content;
-            }
-        }
-        if(content = get_element_content(cur_node->children, node_name))
-            return content;
-    }
-
-    return NULL;
-}
-
 static void random_init(){
 
     struct timespec ttime = {0, 0};
@@ -227,156 +219,144 @@ void not_recognized(){
     const char* sorry = asorry[random_constructor(2)];
     const char* please = aplease[random_constructor(2)];
 
+    /* fixed fragments, each synthesized once */
     char response[200];
-    response[0] = '\0';
-    strcat(strcat(strcat(strcat(response, sorry), not_catched), please), say_again) ;
-    ret = text_to_speech(response);
+    snprintf(response, sizeof(response), "%s|%s|%s|%s",
+            sorry, not_catched, please, say_again);
+    ret = reply_play(response, NULL, 0, 0);
     if(MSP_SUCCESS != ret){
         dbg("text to speech failed:%d", ret);
         return;
     }
-    audio_play("tmp.wav", 0);
 }
 
 void greeting(){
 
     int ret;
+    TRACE_SPAN_BEGIN(ts);
 
-    ret = text_to_speech("你好");
+    ret = reply_play("你好", NULL, 0, 0);
     if(MSP_SUCCESS != ret){
         dbg("text to speech failed:%d", ret);
         return;
     }
-    audio_play("tmp.wav", 0);
+    TRACE_SPAN_END(ts, "greeting");
+}
+
+/* the reply to a query, from the number clip bank; a value the chair
+ * has not reported is said to be unknown rather than made up */
+static int query_reply(const struct intent *it, char *response, unsigned int size){
+
+    int level;
+
+    switch(it->target){
+    case INTENT_TIME:
+        if(g_chair.remaining == CHAIR_UNKNOWN){
+            snprintf(response, size, "剩余时间|暂时无法获取");
+            return 0;
+        }
+        strcpy(response, "还剩");
+        return reply_duration(response, size, g_chair.remaining);
+    case INTENT_TEMPERATURE:
+        strcpy(response, "当前温度");
+        if(g_chair.temperature == CHAIR_UNKNOWN)
+            return reply_unit(response, size, "暂时无法获取");
+        return reply_number(response, size, g_chair.temperature)
+            || reply_unit(response, size, "度");
+    case INTENT_ENERGY:
+        strcpy(response, "当前能量");
+        level = g_chair.energy;
+        break;
+    case INTENT_STRENGTH:
+        strcpy(response, "当前力度");
+        level = g_chair.strength;
+        break;
+    case INTENT_SPEED:
+        strcpy(response, "当前速度");
+        level = g_chair.speed;
+        break;
+    case INTENT_AMPLITUDE:
+        strcpy(response, "当前幅度");
+        level = g_chair.amplitude;
+        break;
+    default:
+        return -1;
+    }
+    if(level == CHAIR_UNKNOWN)
+        return reply_unit(response, size, "暂时无法获取");
+    return reply_number(response, size, level)
+        || reply_unit(response, size, "档");
 }
 
 void cmd_pro(){
 
-    xmlDocPtr doc = NULL;
-    xmlNode *root;
+    struct asr_result result;
+    struct intent it;
     char response[200];
     response[0] = '\0';
-    int ret, confidence_i;
+    int ret;
     int success = 1;
-    char *confidence, *something, *dopre, *value, *time;
+    TRACE_SPAN_BEGIN(ts);
 
     if(!g_result || *g_result == 0){
         success = 0;
         goto exit;
     }
-    doc = xmlReadMemory(g_result, strlen(g_result), "noname.xml", NULL, 0);
-    if(doc == NULL){
-        dbg("Failed to parse document\n");
-        success = 0;
-        goto exit;
-    }
-    root = xmlDocGetRootElement(doc);
-    confidence = (char*)get_element_content(root, "confidence");
-    if(!confidence){
-        dbg("Error:no confidence:%s\n", confidence);
-        success = 0;
-        goto exit;
-    }
-    confidence_i = atoi(confidence);
-    if(confidence_i == 0){
-        perror("Convert confidence to integer failed\n");
+    if(asr_result_parse(g_result, &result) != 0){
+        dbg("Failed to parse result\n");
         success = 0;
         goto exit;
     }
-
-    if(confidence_i < 20){
-        dbg("Confidence smallar than 50.\n");
+    /* the best command of all the candidates, not just the first */
+    ret = intent_resolve(&result, &it);
+    if(ret != 0){
+        dbg("No command in %u candidates:%d\n", result.count, ret);
         success = 0;
         goto exit;
     }
-    something = (char*)get_element_content(root, "something");
-    if(!something){
-        time = (char*)get_element_content(root, "time");
-        if(time && (strcmp(time, "下一首") == 0 || strcmp(time, "上一首") == 0)){
-            /*! TODO: play music
-             */
-            if(strcmp(time, "下一首") == 0){
-            }else{
-            }
-        }else{
-            success = 0;
-        }
-        goto exit;
-    }
 
-    dopre = (char*)get_element_content(root, "dopre");
-    if(dopre){
+    switch(it.kind){
+    case INTENT_ADJUST:
         /*operation-command*/
-        if(strcmp(something, "最大能量") == 0
-                || strcmp(something, "能量") == 0
-                || strcmp(something, "温度") == 0
-                || strcmp(something, "温") == 0){
-            strcat(response, "能量已");
-        }else if(strcmp(something, "力度") == 0){
-            strcat(response, "力度已");
-        }else if(strcmp(something, "歌") == 0
-                || strcmp(something, "歌曲") == 0
-                || strcmp(something, "音乐") == 0){
-            if(strcmp(dopre, "播放") == 0 
-                    || strcmp(dopre, "播") == 0){
-            }else if(strcmp(dopre, "停止") == 0
-                    || strcmp(dopre, "暂停") == 0
-                    || strcmp(dopre, "停止播放") == 0
-                    || strcmp(dopre, "暂停播放") == 0){
-            }else{
-                dbg("Error:Unexpected grammer:%s\n", dopre);
-                success = 0;
-            }
-            /*! TODO: play music
-             */
-            goto exit;
-        }else{
-            dbg("Error:Unexpected grammer:%s\n", something);
-            success = 0;
-            goto exit;
-        }
-        if(strcmp(dopre, "增") == 0
-                || strcmp(dopre, "增加") == 0
-                || strcmp(dopre, "提高") == 0
-                || strcmp(dopre, "升") == 0
-                || strcmp(dopre, "加大") == 0){
-            strcat(response, "增加");
-        }else if(strcmp(dopre, "降低") == 0
-                || strcmp(dopre, "降") == 0
-                || strcmp(dopre, "减") == 0
-                || strcmp(dopre, "减少") == 0
-                || strcmp(dopre, "减小") == 0){
-            strcat(response, "减小");
-        }else{
-            dbg("Error:Unexpected grammer:%s\n", dopre);
-            success = 0;
-            goto exit;
-        }
-        ret = text_to_speech(response);
-        if(MSP_SUCCESS != ret){
-            dbg("text to speech failed:%d", ret);
-            success = 0;
-            goto exit;
-        }
-        audio_play("tmp.wav", 0);
-    }else{
+        strcat(response, it.target == INTENT_STRENGTH ? "力度已" : "能量已");
+        strcat(response, it.delta > 0 ? "|增加" : "|减小");
+        ret = reply_play(response, NULL, 0, 0);
+        break;
+    case INTENT_QUERY:
         /*asking-command*/
-        value = (char*)get_element_content(root, "value");
-        if(!value){
-            dbg("Grammer error:no value\n");
-            success = 0;
-            goto exit;
+        ret = query_reply(&it, response, sizeof(response));
+        if(ret == 0){
+            ret = reply_play(response, NULL, 0, 0);
         }
+        break;
+    case INTENT_PLAY:
+    case INTENT_STOP:
+    case INTENT_NEXT:
+    case INTENT_PREVIOUS:
+        /*! TODO: play music
+         */
+        ret = MSP_SUCCESS;
+        break;
+    default:
+        ret = -1;
+        break;
+    }
+    if(MSP_SUCCESS != ret){
+        dbg("text to speech failed:%d", ret);
+        success = 0;
+        goto exit;
     }
-    /*print_elements(root);*/
 
 exit:
-    if(doc)
-        xmlFreeDoc(doc);
+    TRACE_SPAN_END(ts, "cmd_pro");
     if(success){
+        metric_inc(&m_commands);
+        g_reprompted = 0;
         g_status = XIUXIU_STATUS_INIT;
     }else{
+        metric_inc(&m_rejects);
         not_recognized();
+        g_reprompted = 1;
         g_status = XIUXIU_STATUS_RECOGNIZING;
     }
 }
@@ -389,60 +369,117 @@ int main(int argc, char *argv[])
 	const char *ssb_param = "ivw_threshold=0:1450,sst=wakeup,ivw_res_path =fo|res/ivw/wakeupresource.jet";
 	char asr_params[MAX_PARAMS_LEN];
 	int errcode;
+	const char *env;
+	int persistent;
+	int config = 0;
+	int barge_in = 0;
+	struct barge_in bi;
+	int server = argc > 1 && strcmp(argv[1], "--server") == 0;
+	struct stream_server_conf server_conf;
 	awaken_rec ak_iat;
     struct speech_rec sr_iat;
 	struct speech_rec_notifier sr_notify= {
 		on_result,
 		on_speech_begin,
-		on_speech_end
+		on_speech_end,
+		on_partial
 	};
     UserData asr_data;
 
+    xlog_init();
+    if(rt_config_from_env() != 0){
+        dbg("XIUXIU_RT partly ignored\n");
+    }
     audio_init();
 
+    metric_register(&m_wakeups);
+    metric_register(&m_commands);
+    metric_register(&m_rejects);
+    if(metrics_serve(NULL) != 0){
+        dbg("metrics exporter not started\n");
+    }
+
 	ret = MSPLogin(NULL, NULL, lgi_param);
 	if (MSP_SUCCESS != ret)
 	{
 		printf("MSPLogin failed, error code: %d.\n", ret);
 		goto exit ;//登录失败，退出登录
 	}
+    /* warm TTS sessions for the replies; XIUXIU_TTS_POOL=0 turns it off */
+    tts_pool_start();
+    if(reply_prepare("你好|我没有听清|你再说一遍") != MSP_SUCCESS
+            || reply_prepare("还剩|剩余时间|当前温度|当前能量|当前力度|当前速度|当前幅度") != MSP_SUCCESS
+            || reply_prepare("暂时无法获取") != MSP_SUCCESS
+            || reply_number_prepare() != MSP_SUCCESS){
+        dbg("reply fragments not cached\n");
+    }
 
-	errcode = ak_init(&ak_iat, ssb_param, cb_ivw_msg_proc);
-	if (errcode != 0) {
-		printf("speech recognizer init failed\n");
-		return errcode;
-	}
+    /* XIUXIU_IVW_PERSISTENT=0 tears the wake session down on every wake */
+    env = getenv("XIUXIU_IVW_PERSISTENT");
+    persistent = !(env && strcmp(env, "0") == 0);
+    /* XIUXIU_EARLY_COMMIT=0 always waits for the VAD end */
+    env = getenv("XIUXIU_EARLY_COMMIT");
+    g_early_commit = !(env && strcmp(env, "0") == 0);
+
+    /* the server has no local microphone */
+    if(!server){
+        errcode = ak_init(&ak_iat, ssb_param, cb_ivw_msg_proc);
+        if (errcode != 0) {
+            printf("speech recognizer init failed\n");
+            return errcode;
+        }
+        ak_set_persistent(&ak_iat, persistent);
+    }
 
 #if 1
     memset(&asr_data, 0, sizeof(UserData));
-    ret = build_grammar(&asr_data);
+    ret = build_grammar_wait(&asr_data);
     if(MSP_SUCCESS != ret){
         printf("build grammer failed:%d\n", ret);
         goto exit;
     }
-    while(1 != asr_data.build_fini)
-        usleep(300 * 1000);
+    grammar_asr_params(asr_params, sizeof(asr_params), asr_data.grammar_id);
 
-    if(MSP_SUCCESS != asr_data.errcode){
+    if(server){
+        stream_server_conf_init(&server_conf, ssb_param, asr_params);
+        ret = stream_server_run(&server_conf);
+        if(ret != 0)
+            printf("stream server failed: %d\n", ret);
         goto exit;
     }
 
-	snprintf(asr_params, MAX_PARAMS_LEN - 1, 
-		"engine_type = local, \
-		asr_res_path = %s, sample_rate = %d, \
-		grm_build_path = %s, local_grammar = %s, \
-		result_type = xml, result_encoding = UTF-8, ",
-		ASR_RES_PATH,
-		SAMPLE_RATE_16K,
-		GRM_BUILD_PATH,
-		asr_data.grammar_id
-		);
-
-    errcode = sr_init(&sr_iat, asr_params, &sr_notify);
+    if(persistent)
+        errcode = sr_init_ex(&sr_iat, asr_params, SR_USER, &sr_notify);
+    else
+        errcode = sr_init(&sr_iat, asr_params, &sr_notify);
     if(errcode){
         printf("speech recognizer init failed\n");
         return -1;
     }
+    if(sr_config_init(&g_asr_config, asr_params) == 0){
+        sr_use_config(&sr_iat, &g_asr_config);
+        config = 1;
+    }
+
+    /* song titles follow the music list (update_music_list) without
+     * rebuilding the grammar; the words change between two sessions,
+     * never under one */
+    if(!config || lexicon_start(asr_data.grammar_id, on_grammar, on_lexicon_hold,
+                NULL) != 0){
+        dbg("lexicon updates off\n");
+    }
+
+    /* XIUXIU_BARGE_IN=1 lets the user speak over the prompts; the
+     * audio has to come through the wake capture for that */
+    env = getenv("XIUXIU_BARGE_IN");
+    if(env && strcmp(env, "1") == 0){
+        if(!persistent)
+            dbg("barge-in needs XIUXIU_IVW_PERSISTENT, off\n");
+        else if(barge_in_init(&bi, sr_feed_audio, &sr_iat) != 0)
+            dbg("barge-in init failed, off\n");
+        else
+            barge_in = 1;
+    }
 
 #endif
     g_status = XIUXIU_STATUS_INIT;
@@ -450,8 +487,10 @@ int main(int argc, char *argv[])
 	while(1){
         switch (g_status) {
             case XIUXIU_STATUS_INIT:
+                TRACE_TURN_END();
+                /* persistent: still running, only the route changes */
                 errcode = ak_starting_listening(&ak_iat);
-                if (errcode) {
+                if (errcode && errcode != -E_SR_ALREADY) {
                     printf("Awaken start listening failed %d\n", errcode);
                 }
                 printf("ak start listening\n");
@@ -459,27 +498,49 @@ int main(int argc, char *argv[])
                 break;
 
             case XIUXIU_STATUS_SLEEPING:
-                sleep(1);
+                /* short naps: a recognized command is acted on at once,
+                 * not up to a second later */
+                usleep(10 * 1000);
                 break;
 
             case XIUXIU_STATUS_AWAKEN:
-                ak_stop_listening(&ak_iat);
+                if(!persistent)
+                    ak_stop_listening(&ak_iat);
                 g_status = XIUXIU_STATUS_RECOGNIZING;
+                g_reprompted = 0;
                 greeting();
                 break;
 
             case XIUXIU_STATUS_RECOGNIZING:
+                sr_set_endpoint(&sr_iat, g_reprompted ? &ep_reprompt : &ep_command);
+                /* before the audio is routed: on_speech_end may change it */
+                g_status = XIUXIU_STATUS_SLEEPING;
                 errcode = sr_start_listening(&sr_iat);
                 if(errcode){
                     printf("Speech recognizer start listening failed:%d\n", errcode);
+                    g_status = XIUXIU_STATUS_INIT;
+                }else if(barge_in){
+                    /* the prompt was queued before we got here */
+                    barge_in_reset(&bi);
+                    ak_route(&ak_iat, barge_in_feed, &bi);
+                }else if(persistent){
+                    ak_route(&ak_iat, sr_feed_audio, &sr_iat);
                 }
-                g_status = XIUXIU_STATUS_SLEEPING;
                 break;
 
             case XIUXIU_STATUS_RECOGNIZED:
+                if(persistent)
+                    ak_route(&ak_iat, NULL, NULL);
                 sr_stop_listening(&sr_iat);
                 cmd_pro();
                 break;
+
+            case XIUXIU_STATUS_FAILED:
+                if(persistent)
+                    ak_route(&ak_iat, NULL, NULL);
+                sr_stop_listening(&sr_iat);
+                g_status = XIUXIU_STATUS_INIT;
+                break;
         }
     }
     /*! TODO: check the status
@@ -491,10 +552,17 @@ int main(int argc, char *argv[])
 	/*}*/
 
     ak_uninit(&ak_iat);
+    lexicon_stop();
     sr_uninit(&sr_iat);
+    if(config)
+        sr_config_free(&g_asr_config);
+    if(barge_in)
+        barge_in_free(&bi);
 
 exit:
+    metrics_stop();
     audio_destroy();
+    tts_pool_stop();
 	MSPLogout(); //退出登录
 	return 0;
 
@@ -0,0 +1,280 @@
+/*
+ * @file
+ * @brief per-thread span buffers, turn summary and Chrome trace dump
+ */
+
+#ifdef XIUXIU_TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+#define TRACE_BUF_EVENTS    4096    /* per thread, power of 2 */
+#define TRACE_SUMMARY_NAMES 32
+
+struct trace_event {
+    const char *name;
+    uint64_t start;
+    uint64_t dur;
+    uint32_t turn;
+    uint32_t tid;
+    char phase;             /* 'X' span, 'i' instant */
+};
+
+/* written only by the owning thread; readers snapshot head with acquire */
+struct trace_buf {
+    struct trace_buf *next;
+    int in_use;
+    uint32_t tid;
+    uint64_t head;
+    struct trace_event ev[TRACE_BUF_EVENTS];
+};
+
+struct trace_sum {
+    const char *name;
+    uint64_t first;
+    uint64_t total;
+    unsigned int count;
+};
+
+static struct trace_buf *g_bufs = NULL;
+static uint32_t g_turn = 0;
+static uint64_t g_turn_start = 0;
+static pthread_key_t g_key;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+static __thread struct trace_buf *t_buf = NULL;
+
+/* threads come and go with every open_recorder, so recycle their rings */
+static void buf_release(void *p)
+{
+    struct trace_buf *b = (struct trace_buf *)p;
+    __atomic_store_n(&b->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void key_init()
+{
+    pthread_key_create(&g_key, buf_release);
+}
+
+static struct trace_buf *get_buf()
+{
+    struct trace_buf *b;
+    int expected;
+
+    if (t_buf)
+        return t_buf;
+
+    pthread_once(&g_key_once, key_init);
+
+    for (b = __atomic_load_n(&g_bufs, __ATOMIC_ACQUIRE); b; b = b->next) {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&b->in_use, &expected, 1, 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (!b) {
+        b = (struct trace_buf *)calloc(1, sizeof(struct trace_buf));
+        if (!b)
+            return NULL;
+        b->in_use = 1;
+        b->next = __atomic_load_n(&g_bufs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&g_bufs, &b->next, b, 1,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+    b->tid = (uint32_t)syscall(SYS_gettid);
+    pthread_setspecific(g_key, b);
+    t_buf = b;
+    return b;
+}
+
+static void record(const char *name, uint64_t start, uint64_t dur, char phase)
+{
+    struct trace_buf *b = get_buf();
+    struct trace_event *e;
+    uint64_t h;
+
+    if (!b)
+        return;
+
+    h = b->head;
+    e = &b->ev[h & (TRACE_BUF_EVENTS - 1)];
+    e->name = name;
+    e->start = start;
+    e->dur = dur;
+    e->turn = __atomic_load_n(&g_turn, __ATOMIC_RELAXED);
+    e->tid = b->tid;
+    e->phase = phase;
+    __atomic_store_n(&b->head, h + 1, __ATOMIC_RELEASE);
+}
+
+/* copy out the events of b that are still intact; returns the count */
+static size_t snapshot(struct trace_buf *b, struct trace_event *out)
+{
+    uint64_t head, tail, lo, i;
+    size_t n = 0;
+
+    head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+    lo = head > TRACE_BUF_EVENTS ? head - TRACE_BUF_EVENTS : 0;
+    for (i = lo; i < head; i++)
+        out[n++] = b->ev[i & (TRACE_BUF_EVENTS - 1)];
+
+    /* drop whatever the owner overwrote while we were copying */
+    tail = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+    if (tail > lo + TRACE_BUF_EVENTS) {
+        size_t lost = tail - (lo + TRACE_BUF_EVENTS);
+        if (lost >= n)
+            return 0;
+        memmove(out, out + lost, (n - lost) * sizeof(*out));
+        n -= lost;
+    }
+    return n;
+}
+
+uint64_t trace_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void trace_span(const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+    record(name, start_ns, end_ns - start_ns, 'X');
+}
+
+void trace_instant(const char *name)
+{
+    record(name, trace_now(), 0, 'i');
+}
+
+void trace_turn_begin()
+{
+    g_turn_start = trace_now();
+    __atomic_add_fetch(&g_turn, 1, __ATOMIC_RELAXED);
+    trace_instant("turn");
+}
+
+static void print_summary(uint32_t turn, uint64_t total)
+{
+    struct trace_sum sums[TRACE_SUMMARY_NAMES];
+    struct trace_event *evs;
+    struct trace_buf *b;
+    struct trace_sum tmp;
+    size_t n, i, j, nsums = 0;
+    char line[1024];
+    int off;
+
+    evs = (struct trace_event *)malloc(sizeof(*evs) * TRACE_BUF_EVENTS);
+    if (!evs)
+        return;
+
+    for (b = __atomic_load_n(&g_bufs, __ATOMIC_ACQUIRE); b; b = b->next) {
+        n = snapshot(b, evs);
+        for (i = 0; i < n; i++) {
+            if (evs[i].turn != turn || evs[i].phase != 'X')
+                continue;
+            for (j = 0; j < nsums; j++)
+                if (strcmp(sums[j].name, evs[i].name) == 0)
+                    break;
+            if (j == nsums) {
+                if (nsums == TRACE_SUMMARY_NAMES)
+                    continue;
+                sums[j].name = evs[i].name;
+                sums[j].first = evs[i].start;
+                sums[j].total = 0;
+                sums[j].count = 0;
+                nsums++;
+            }
+            if (evs[i].start < sums[j].first)
+                sums[j].first = evs[i].start;
+            sums[j].total += evs[i].dur;
+            sums[j].count++;
+        }
+    }
+    free(evs);
+
+    /* pipeline order */
+    for (i = 1; i < nsums; i++) {
+        tmp = sums[i];
+        for (j = i; j > 0 && sums[j - 1].first > tmp.first; j--)
+            sums[j] = sums[j - 1];
+        sums[j] = tmp;
+    }
+
+    off = snprintf(line, sizeof(line), "[trace] turn %u %.1fms:",
+            turn, total / 1e6);
+    for (i = 0; i < nsums && off < (int)sizeof(line); i++) {
+        off += snprintf(line + off, sizeof(line) - off, " %s=%.1fms",
+                sums[i].name, sums[i].total / 1e6);
+        if (sums[i].count > 1 && off < (int)sizeof(line))
+            off += snprintf(line + off, sizeof(line) - off, "(x%u)",
+                    sums[i].count);
+    }
+    printf("%s\n", line);
+}
+
+void trace_turn_end()
+{
+    uint32_t turn = __atomic_load_n(&g_turn, __ATOMIC_RELAXED);
+    const char *path;
+
+    if (turn == 0)
+        return;
+
+    print_summary(turn, trace_now() - g_turn_start);
+
+    path = getenv("XIUXIU_TRACE_JSON");
+    if (path && *path)
+        trace_dump_json(path);
+}
+
+int trace_dump_json(const char *path)
+{
+    struct trace_event *evs;
+    struct trace_buf *b;
+    size_t n, i;
+    int first = 1;
+    int pid = (int)getpid();
+    FILE *f;
+
+    f = fopen(path, "w");
+    if (!f)
+        return -1;
+    evs = (struct trace_event *)malloc(sizeof(*evs) * TRACE_BUF_EVENTS);
+    if (!evs) {
+        fclose(f);
+        return -1;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (b = __atomic_load_n(&g_bufs, __ATOMIC_ACQUIRE); b; b = b->next) {
+        n = snapshot(b, evs);
+        for (i = 0; i < n; i++) {
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,",
+                    first ? "" : ",\n", evs[i].name, evs[i].phase,
+                    evs[i].start / 1e3);
+            if (evs[i].phase == 'X')
+                fprintf(f, "\"dur\":%.3f,", evs[i].dur / 1e3);
+            else
+                fprintf(f, "\"s\":\"t\",");
+            fprintf(f, "\"pid\":%d,\"tid\":%u,\"args\":{\"turn\":%u}}",
+                    pid, evs[i].tid, evs[i].turn);
+            first = 0;
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    free(evs);
+    fclose(f);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * @file
+ * @brief lightweight latency tracing of a dialog turn
+ *
+ * Spans are stamped with CLOCK_MONOTONIC and appended to a per-thread
+ * ring that only its owner writes, so recording takes no lock. A turn
+ * runs from the wake-up callback to the return to XIUXIU_STATUS_INIT;
+ * at its end a one-line summary is printed and, if XIUXIU_TRACE_JSON
+ * names a file, every buffered span is dumped there as Chrome trace
+ * JSON (load it in chrome://tracing or Perfetto).
+ *
+ * Build with "make TRACE=1". Without XIUXIU_TRACE every macro below
+ * expands to nothing.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifdef XIUXIU_TRACE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t trace_now();
+void trace_span(const char *name, uint64_t start_ns, uint64_t end_ns);
+void trace_instant(const char *name);
+void trace_turn_begin();
+void trace_turn_end();
+int trace_dump_json(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* declare a timestamp inside a struct, for spans crossing functions */
+#define TRACE_TS_FIELD(ts)          uint64_t ts;
+#define TRACE_TS_VAR(ts)            uint64_t ts = 0
+#define TRACE_SPAN_BEGIN(ts)        uint64_t ts = trace_now()
+#define TRACE_SPAN_END(ts, name)    trace_span(name, ts, trace_now())
+#define TRACE_MARK(ts)              ((ts) = trace_now())
+#define TRACE_MARK_END(ts, name)    \
+    do { if (ts) { trace_span(name, ts, trace_now()); (ts) = 0; } } while (0)
+#define TRACE_INSTANT(name)         trace_instant(name)
+#define TRACE_TURN_BEGIN()          trace_turn_begin()
+#define TRACE_TURN_END()            trace_turn_end()
+
+#else
+
+#define TRACE_TS_FIELD(ts)
+#define TRACE_TS_VAR(ts)
+#define TRACE_SPAN_BEGIN(ts)
+#define TRACE_SPAN_END(ts, name)
+#define TRACE_MARK(ts)
+#define TRACE_MARK_END(ts, name)
+#define TRACE_INSTANT(name)
+#define TRACE_TURN_BEGIN()
+#define TRACE_TURN_END()
+
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * @file
+ * @brief offline text to speech, to a wav file or straight to playback
+ *
+ * text_to_speech() synthesizes the whole text into tmp.wav in one
+ * session. text_to_speech_play() splits the text into sentences at
+ * punctuation, synthesizes them on up to $XIUXIU_TTS_WORKERS (default
+ * TTS_WORKERS, at most TTS_MAX_WORKERS) sessions in parallel and hands
+ * the audio to playback in order through audio_queue_put as it comes
+ * out, so the first sound only waits for the first sentence. It
+ * returns once everything is synthesized, or early if the playback was
+ * stopped (barge-in) or replaced. tts_synth_ordered() is the same
+ * pipeline for any list of texts and sink, e.g. reply fragments.
+ */
+
+#ifndef TTS_H
+#define TTS_H
+
+#define TTS_SESSION_PARAMS \
+	"engine_type = local,voice_name=xiaoyan, text_encoding = UTF8, tts_res_path = fo|res/tts/xiaoyan.jet;fo|res/tts/common.jet, sample_rate = 16000, speed = 50, volume = 50, pitch = 50, rdn = 2"
+#define TTS_RATE		16000	/* mono 16 bit, as in TTS_SESSION_PARAMS */
+
+/* the engine allows a few local sessions at a time */
+#define TTS_WORKERS		2
+#define TTS_MAX_WORKERS		4
+
+/* gets each block of synthesized audio; nonzero stops the synthesis */
+typedef int (*tts_audio_sink)(const void *data, unsigned int len, void *user_para);
+/* gets the audio of text i in the order of i: each block as it comes,
+ * then data NULL with the MSP result of text i. Called with the
+ * pipeline's lock held, one call at a time; nonzero stops it */
+typedef int (*tts_ordered_sink)(unsigned int i, const void *data, unsigned int len,
+		int err, void *user_para);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* one session for all of text; returns an MSP error code */
+int tts_synth(const char *text, const char *params, tts_audio_sink sink,
+		void *user_para);
+int text_to_speech(const char *text);
+int text_to_speech_play(const char *text, int priority);
+/* synthesize texts on parallel sessions, as text_to_speech_play does,
+ * into sink; a NULL text only gets its end call. Returns the first
+ * MSP error */
+int tts_synth_ordered(const char *const *texts, unsigned int count,
+		tts_ordered_sink sink, void *user_para);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -12,6 +12,10 @@
 #include "qtts.h"
 #include "msp_cmn.h"
 #include "msp_errors.h"
+#include "trace.h"
+#include "metrics.h"
+#include "tts.h"
+#include "tts_pool.h"
 typedef int SR_DWORD;
 typedef short int SR_WORD ;
 
@@ -52,92 +56,155 @@ wave_pcm_hdr default_wav_hdr =
 	{'d', 'a', 't', 'a'},
 	0  
 };
-/* 文本合成 */
-int text_to_speech_internal(const char* src_text, const char* des_path, const char* params)
+METRIC_HISTOGRAM_DEFINE(m_synth, "xiuxiu_tts_synth_seconds",
+		"Wall time of one text_to_speech synthesis", metric_buckets_slow);
+
+/* 结束会话; 池里的会话交还给池 */
+static int end_session(const char* sessionID, int pooled, int clean, const char* hints)
+{
+	if (!pooled)
+		return QTTSSessionEnd(sessionID, hints);
+	tts_pool_put(sessionID, clean);
+	return MSP_SUCCESS;
+}
+
+/* 合成 src_text, 音频分块交给 sink; sink 返回非0时中止 */
+int tts_synth(const char* src_text, const char* params, tts_audio_sink sink, void* user_para)
 {
 	int          ret          = -1;
-	FILE*        fp           = NULL;
 	const char*  sessionID    = NULL;
 	unsigned int audio_len    = 0;
-	wave_pcm_hdr wav_hdr      = default_wav_hdr;
 	int          synth_status = MSP_TTS_FLAG_STILL_HAVE_DATA;
+	int          pooled       = 0;
+	int          recycled     = 0;
 
-	if (NULL == src_text || NULL == des_path)
+	if (NULL == src_text || NULL == sink || NULL == params)
 	{
 		printf("params is error!\n");
 		return ret;
 	}
-	fp = fopen(des_path, "wb");
-	if (NULL == fp)
+	/* 常用参数先从会话池取 */
+	if (strcmp(params, TTS_SESSION_PARAMS) == 0)
 	{
-		printf("open %s error.\n", des_path);
-		return ret;
+		pooled = 1;
+		sessionID = tts_pool_get(&recycled);
+	}
+	if (NULL != sessionID)
+	{
+		ret = QTTSTextPut(sessionID, src_text, (unsigned int)strlen(src_text), NULL);
+		if (MSP_SUCCESS == ret)
+			goto synth;
+		if (recycled)
+			tts_pool_no_recycle();
+		QTTSSessionEnd(sessionID, "TextPutError");
 	}
 	/* 开始合成 */
 	sessionID = QTTSSessionBegin(params, &ret);
 	if (MSP_SUCCESS != ret)
 	{
 		printf("QTTSSessionBegin failed, error code: %d.\n", ret);
-		fclose(fp);
+		if (pooled)
+			tts_pool_put(NULL, 0);
 		return ret;
 	}
 	ret = QTTSTextPut(sessionID, src_text, (unsigned int)strlen(src_text), NULL);
 	if (MSP_SUCCESS != ret)
 	{
 		printf("QTTSTextPut failed, error code: %d.\n",ret);
-		QTTSSessionEnd(sessionID, "TextPutError");
-		fclose(fp);
+		end_session(sessionID, pooled, 0, "TextPutError");
 		return ret;
 	}
-	printf("正在合成 ...\n");
-	fwrite(&wav_hdr, sizeof(wav_hdr) ,1, fp); //添加wav音频头，使用采样率为16000
+synth:
 	while (1) 
 	{
 		/* 获取合成音频 */
 		const void* data = QTTSAudioGet(sessionID, &audio_len, &synth_status, &ret);
 		if (MSP_SUCCESS != ret)
 			break;
-		if (NULL != data)
+		if (NULL != data && audio_len > 0 && sink(data, audio_len, user_para) != 0)
 		{
-			fwrite(data, audio_len, 1, fp);
-		    wav_hdr.data_size += audio_len; //计算data_size大小
+			end_session(sessionID, pooled, 0, "Stopped");
+			return MSP_SUCCESS;
 		}
 		if (MSP_TTS_FLAG_DATA_END == synth_status)
 			break;
 	}
-	printf("\n");
 	if (MSP_SUCCESS != ret)
 	{
 		printf("QTTSAudioGet failed, error code: %d.\n",ret);
-		QTTSSessionEnd(sessionID, "AudioGetError");
-		fclose(fp);
+		end_session(sessionID, pooled, 0, "AudioGetError");
 		return ret;
 	}
-	/* 修正wav文件头数据的大小 */
-	wav_hdr.size_8 += wav_hdr.data_size + (sizeof(wav_hdr) - 8);
-	
-	/* 将修正过的数据写回文件头部,音频文件为wav格式 */
-	fseek(fp, 4, 0);
-	fwrite(&wav_hdr.size_8,sizeof(wav_hdr.size_8), 1, fp); //写入size_8的值
-	fseek(fp, 40, 0); //将文件指针偏移到存储data_size值的位置
-	fwrite(&wav_hdr.data_size,sizeof(wav_hdr.data_size), 1, fp); //写入data_size的值
-	fclose(fp);
-	fp = NULL;
-	/* 合成完毕 */
-	ret = QTTSSessionEnd(sessionID, "Normal");
+	ret = end_session(sessionID, pooled, 1, "Normal");
 	if (MSP_SUCCESS != ret)
 	{
 		printf("QTTSSessionEnd failed, error code: %d.\n",ret);
 	}
+	return ret;
+}
+
+struct wav_sink {
+	FILE*        fp;
+	wave_pcm_hdr hdr;
+};
+
+static int wav_write(const void* data, unsigned int len, void* user_para)
+{
+	struct wav_sink* ws = (struct wav_sink*)user_para;
+
+	fwrite(data, len, 1, ws->fp);
+	ws->hdr.data_size += len; //计算data_size大小
+	return 0;
+}
 
+/* 文本合成 */
+int text_to_speech_internal(const char* src_text, const char* des_path, const char* params)
+{
+	int            ret = -1;
+	struct wav_sink ws;
+	uint64_t       t0  = metrics_now_us();
+	TRACE_SPAN_BEGIN(ts);
+
+	if (NULL == src_text || NULL == des_path)
+	{
+		printf("params is error!\n");
+		return ret;
+	}
+	ws.hdr = default_wav_hdr;
+	ws.fp = fopen(des_path, "wb");
+	if (NULL == ws.fp)
+	{
+		printf("open %s error.\n", des_path);
+		return ret;
+	}
+	printf("正在合成 ...\n");
+	fwrite(&ws.hdr, sizeof(ws.hdr) ,1, ws.fp); //添加wav音频头，使用采样率为16000
+	ret = tts_synth(src_text, params, wav_write, &ws);
+	printf("\n");
+	if (MSP_SUCCESS != ret)
+	{
+		fclose(ws.fp);
+		return ret;
+	}
+	/* 修正wav文件头数据的大小 */
+	ws.hdr.size_8 += ws.hdr.data_size + (sizeof(ws.hdr) - 8);
+	
+	/* 将修正过的数据写回文件头部,音频文件为wav格式 */
+	fseek(ws.fp, 4, 0);
+	fwrite(&ws.hdr.size_8,sizeof(ws.hdr.size_8), 1, ws.fp); //写入size_8的值
+	fseek(ws.fp, 40, 0); //将文件指针偏移到存储data_size值的位置
+	fwrite(&ws.hdr.data_size,sizeof(ws.hdr.data_size), 1, ws.fp); //写入data_size的值
+	fclose(ws.fp);
+	TRACE_SPAN_END(ts, "tts_synth");
+	metric_observe_us(&m_synth, metrics_now_us() - t0);
+	/* 合成完毕 */
 	return ret;
 }
 
 int text_to_speech(const char* text){
 
-	const char* session_begin_params = "engine_type = local,voice_name=xiaoyan, text_encoding = UTF8, tts_res_path = fo|res/tts/xiaoyan.jet;fo|res/tts/common.jet, sample_rate = 16000, speed = 50, volume = 50, pitch = 50, rdn = 2";
 	const char* filename             = "tmp.wav"; //合成的语音文件名称
-    return text_to_speech_internal(text, filename, session_begin_params);
+    return text_to_speech_internal(text, filename, TTS_SESSION_PARAMS);
 }
 
 #if 0
@@ -0,0 +1,305 @@
+/*
+ * @file
+ * @brief sentence-pipelined text to speech into the playback queue
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "tts.h"
+#include "sound_playback.h"
+#include "msp_errors.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define TTS_DBGON 1
+#if TTS_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+METRIC_HISTOGRAM_DEFINE(m_first_audio, "xiuxiu_tts_first_audio_seconds",
+		"Time from text_to_speech_play to its first audio queued for playback",
+		metric_buckets_slow);
+
+struct tts_piece {
+	const char *text;
+	char *pcm;		/* synthesized, not yet handed on beyond sent */
+	unsigned long len;
+	unsigned long cap;
+	unsigned long sent;
+	int done;
+	int err;
+};
+
+struct tts_run {
+	pthread_mutex_t lock;
+	struct tts_piece *p;
+	unsigned int count;
+	unsigned int next;	/* next piece to synthesize */
+	unsigned int head;	/* next piece to hand to the sink */
+	int stopped;		/* the sink said stop, synthesize no more */
+	tts_ordered_sink sink;
+	void *user_para;
+	int err;
+};
+
+/* length of the punctuation mark at p that ends a sentence, 0 if none */
+static int sentence_end(const char *p)
+{
+	static const char *marks[] = { "。", "！", "？", "；", "，", "、", "…" };
+	unsigned int i;
+
+	if (*p == '!' || *p == '?' || *p == ';' || *p == ',')
+		return 1;
+	/* not a decimal point */
+	if (*p == '.' && (p[1] == ' ' || p[1] == '\0' || p[1] == '\n'))
+		return 1;
+	for (i = 0; i < sizeof(marks) / sizeof(marks[0]); i++)
+		if (strncmp(p, marks[i], strlen(marks[i])) == 0)
+			return strlen(marks[i]);
+	return 0;
+}
+
+/* split text after each sentence end, skipping empty pieces */
+static unsigned int split_sentences(const char *text, char **s, unsigned int max)
+{
+	const char *start = text, *p = text;
+	unsigned int count = 0;
+	int n;
+
+	while (*start && count < max) {
+		while (*start == ' ' || *start == '\n' || *start == '\t')
+			start++;
+		for (p = start; *p && (n = sentence_end(p)) == 0; p++)
+			;
+		if (*p)
+			p += n;
+		/* the last one takes whatever is left */
+		if (count == max - 1)
+			p = start + strlen(start);
+		if (p > start && sentence_end(start) == 0) {
+			s[count] = strndup(start, p - start);
+			if (!s[count])
+				break;
+			count++;
+		}
+		start = p;
+	}
+	return count;
+}
+
+/* hand on what the pieces in order have ready; call with the lock held */
+static void hand_over(struct tts_run *run)
+{
+	struct tts_piece *p;
+
+	while (!run->stopped && run->head < run->count) {
+		p = &run->p[run->head];
+		if (p->len > p->sent) {
+			if (run->sink(run->head, p->pcm + p->sent, p->len - p->sent,
+					MSP_SUCCESS, run->user_para) != 0) {
+				run->stopped = 1;
+				break;
+			}
+			p->sent = p->len;
+		}
+		if (!p->done)
+			break;
+		free(p->pcm);
+		p->pcm = NULL;
+		p->len = p->cap = p->sent = 0;
+		if (run->sink(run->head, NULL, 0, p->err, run->user_para) != 0)
+			run->stopped = 1;
+		run->head++;
+	}
+}
+
+struct tts_sink_ctx {
+	struct tts_run *run;
+	struct tts_piece *p;
+};
+
+static int collect(const void *data, unsigned int len, void *user_para)
+{
+	struct tts_sink_ctx *ctx = (struct tts_sink_ctx *)user_para;
+	struct tts_piece *p = ctx->p;
+	struct tts_run *run = ctx->run;
+	unsigned long cap;
+	char *pcm;
+	int stopped;
+
+	pthread_mutex_lock(&run->lock);
+	if (p->len + len > p->cap) {
+		cap = p->cap ? p->cap * 2 : TTS_RATE * 2;
+		while (cap < p->len + len)
+			cap *= 2;
+		pcm = (char *)realloc(p->pcm, cap);
+		if (!pcm) {
+			run->stopped = 1;
+			if (!run->err)
+				run->err = MSP_ERROR_OUT_OF_MEMORY;
+			pthread_mutex_unlock(&run->lock);
+			return -1;
+		}
+		p->pcm = pcm;
+		p->cap = cap;
+	}
+	memcpy(p->pcm + p->len, data, len);
+	p->len += len;
+	hand_over(run);
+	stopped = run->stopped;
+	pthread_mutex_unlock(&run->lock);
+	return stopped;
+}
+
+static void *worker(void *arg)
+{
+	struct tts_run *run = (struct tts_run *)arg;
+	struct tts_sink_ctx ctx;
+	unsigned int i;
+	int ret;
+
+	ctx.run = run;
+	while (1) {
+		pthread_mutex_lock(&run->lock);
+		/* nothing to say goes straight to done */
+		while (run->next < run->count && !run->p[run->next].text)
+			run->p[run->next++].done = 1;
+		hand_over(run);
+		if (run->stopped || run->next == run->count) {
+			pthread_mutex_unlock(&run->lock);
+			break;
+		}
+		i = run->next++;
+		pthread_mutex_unlock(&run->lock);
+
+		ctx.p = &run->p[i];
+		ret = tts_synth(run->p[i].text, TTS_SESSION_PARAMS, collect, &ctx);
+
+		pthread_mutex_lock(&run->lock);
+		if (ret != MSP_SUCCESS) {
+			xlog(XLOG_WARN, "tts: piece %u failed: %d\n", i, ret);
+			if (!run->err)
+				run->err = ret;
+		}
+		run->p[i].err = ret;
+		run->p[i].done = 1;
+		hand_over(run);
+		pthread_mutex_unlock(&run->lock);
+	}
+	return NULL;
+}
+
+int tts_synth_ordered(const char *const *texts, unsigned int count,
+		tts_ordered_sink sink, void *user_para)
+{
+	struct tts_run run;
+	pthread_t threads[TTS_MAX_WORKERS];
+	unsigned int i, workers = TTS_WORKERS, started = 0, todo = 0;
+	const char *env = getenv("XIUXIU_TTS_WORKERS");
+
+	if (!sink || (count && !texts))
+		return MSP_ERROR_INVALID_PARA;
+	if (count == 0)
+		return MSP_SUCCESS;
+
+	memset(&run, 0, sizeof(run));
+	run.p = (struct tts_piece *)calloc(count, sizeof(struct tts_piece));
+	if (!run.p)
+		return MSP_ERROR_OUT_OF_MEMORY;
+	run.count = count;
+	run.sink = sink;
+	run.user_para = user_para;
+	for (i = 0; i < count; i++) {
+		run.p[i].text = texts[i];
+		todo += texts[i] != NULL;
+	}
+
+	if (env && atoi(env) > 0)
+		workers = atoi(env);
+	if (workers > TTS_MAX_WORKERS)
+		workers = TTS_MAX_WORKERS;
+	if (workers > todo)
+		workers = todo ? todo : 1;
+	dbg("tts: %u pieces, %u to synthesize on %u sessions\n", count, todo, workers);
+
+	pthread_mutex_init(&run.lock, NULL);
+	/* this thread is one of the workers */
+	for (i = 1; i < workers; i++)
+		if (pthread_create(&threads[started], NULL, worker, &run) == 0)
+			started++;
+	worker(&run);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&run.lock);
+
+	for (i = 0; i < count; i++)
+		free(run.p[i].pcm);
+	free(run.p);
+	return run.err;
+}
+
+struct tts_play {
+	unsigned int queue;	/* from audio_queue_begin */
+	uint64_t t0;
+};
+
+static int play_sink(unsigned int i, const void *data, unsigned int len, int err,
+		void *user_para)
+{
+	struct tts_play *play = (struct tts_play *)user_para;
+
+	/* a failed sentence is left out */
+	if (!data)
+		return 0;
+	if (play->t0) {
+		metric_observe_us(&m_first_audio, metrics_now_us() - play->t0);
+		play->t0 = 0;
+	}
+	if (audio_queue_put(play->queue, (const char *)data, len) != 0) {
+		dbg("tts: playback stopped, dropping the rest\n");
+		return 1;
+	}
+	return 0;
+}
+
+int text_to_speech_play(const char *text, int priority)
+{
+	struct tts_play play;
+	char **s;
+	unsigned int i, count, max = 1;
+	const char *p;
+	int ret;
+
+	if (!text)
+		return MSP_ERROR_INVALID_PARA;
+	for (p = text; *p; p++)
+		max += sentence_end(p) != 0;
+
+	s = (char **)calloc(max, sizeof(char *));
+	if (!s)
+		return MSP_ERROR_OUT_OF_MEMORY;
+	count = split_sentences(text, s, max);
+	if (count == 0) {
+		free(s);
+		return MSP_SUCCESS;
+	}
+
+	memset(&play, 0, sizeof(play));
+	ret = audio_queue_begin(TTS_RATE, 1, priority, &play.queue);
+	if (ret != 0) {
+		dbg("tts: playback refused: %d\n", ret);
+	} else {
+		play.t0 = metrics_now_us();
+		ret = tts_synth_ordered((const char *const *)s, count, play_sink, &play);
+		/* a stopped queue, or one replaced since, ignores this */
+		audio_queue_end(play.queue);
+	}
+	for (i = 0; i < count; i++)
+		free(s[i]);
+	free(s);
+	return ret;
+}
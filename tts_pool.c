@@ -0,0 +1,200 @@
+/*
+ * @file
+ * @brief pool of warm TTS sessions for TTS_SESSION_PARAMS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "qtts.h"
+#include "msp_errors.h"
+#include "tts.h"
+#include "tts_pool.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define TTS_POOL_DBGON 1
+#if TTS_POOL_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+METRIC_HISTOGRAM_DEFINE(m_wait, "xiuxiu_tts_pool_wait_seconds",
+		"Time tts_pool_get waited for a warm session", metric_buckets_fast);
+METRIC_HISTOGRAM_DEFINE(m_begin, "xiuxiu_tts_session_begin_seconds",
+		"Time QTTSSessionBegin took for a pooled session", metric_buckets_slow);
+METRIC_COUNTER_DEFINE(m_hits, "xiuxiu_tts_pool_hits_total",
+		"Syntheses that started on a warm session");
+METRIC_COUNTER_DEFINE(m_misses, "xiuxiu_tts_pool_misses_total",
+		"Syntheses that had to begin their own session");
+METRIC_GAUGE_DEFINE(m_idle, "xiuxiu_tts_pool_idle_sessions",
+		"Warm TTS sessions waiting in the pool");
+
+struct warm_session {
+	const char *id;
+	int recycled;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* a session came or a slot freed */
+	struct warm_session idle[TTS_MAX_WORKERS];
+	unsigned int count;
+	unsigned int size;
+	unsigned int busy;		/* handed out, not put back */
+	unsigned int beginning;		/* QTTSSessionBegin in flight */
+	int recycle;
+	int running;
+	pthread_t refill;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static int need_session()
+{
+	return pool.running && pool.count + pool.beginning < pool.size
+		&& pool.count + pool.beginning + pool.busy < TTS_MAX_WORKERS;
+}
+
+static void *refill_proc(void *arg)
+{
+	const char *id;
+	uint64_t t0;
+	int ret;
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.running) {
+		if (!need_session()) {
+			pthread_cond_wait(&pool.cond, &pool.lock);
+			continue;
+		}
+		pool.beginning++;
+		pthread_mutex_unlock(&pool.lock);
+
+		t0 = metrics_now_us();
+		id = QTTSSessionBegin(TTS_SESSION_PARAMS, &ret);
+		metric_observe_us(&m_begin, metrics_now_us() - t0);
+
+		pthread_mutex_lock(&pool.lock);
+		pool.beginning--;
+		if (ret != MSP_SUCCESS || !id) {
+			xlog(XLOG_WARN, "tts pool: QTTSSessionBegin failed: %d\n", ret);
+			/* don't spin on a broken engine; the next put retries */
+			pthread_cond_broadcast(&pool.cond);
+			pthread_cond_wait(&pool.cond, &pool.lock);
+			continue;
+		}
+		if (!pool.running) {
+			QTTSSessionEnd(id, "pool stopped");
+			break;
+		}
+		pool.idle[pool.count].id = id;
+		pool.idle[pool.count].recycled = 0;
+		pool.count++;
+		metric_set(&m_idle, pool.count);
+		pthread_cond_broadcast(&pool.cond);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+int tts_pool_start()
+{
+	const char *env = getenv("XIUXIU_TTS_POOL");
+	unsigned int size = TTS_POOL_SIZE;
+
+	if (env)
+		size = atoi(env) > 0 ? atoi(env) : 0;
+	if (size > TTS_MAX_WORKERS)
+		size = TTS_MAX_WORKERS;
+	if (size == 0) {
+		dbg("tts pool off\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.size = size;
+	pool.recycle = 1;
+	pool.running = 1;
+	pthread_mutex_unlock(&pool.lock);
+	if (pthread_create(&pool.refill, NULL, refill_proc, NULL) != 0) {
+		pool.running = 0;
+		return -1;
+	}
+	metric_register(&m_hits);
+	metric_register(&m_misses);
+	dbg("tts pool: %u warm sessions\n", size);
+	return 0;
+}
+
+void tts_pool_stop()
+{
+	pthread_mutex_lock(&pool.lock);
+	if (!pool.running) {
+		pthread_mutex_unlock(&pool.lock);
+		return;
+	}
+	pool.running = 0;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+	pthread_join(pool.refill, NULL);
+
+	while (pool.count)
+		QTTSSessionEnd(pool.idle[--pool.count].id, "pool stopped");
+	metric_set(&m_idle, 0);
+}
+
+const char *tts_pool_get(int *recycled)
+{
+	const char *id = NULL;
+	uint64_t t0 = metrics_now_us();
+
+	*recycled = 0;
+	pthread_mutex_lock(&pool.lock);
+	/* one that is already beginning beats beginning another */
+	while (pool.running && pool.count == 0 && pool.beginning)
+		pthread_cond_wait(&pool.cond, &pool.lock);
+	if (pool.count) {
+		pool.count--;
+		id = pool.idle[pool.count].id;
+		*recycled = pool.idle[pool.count].recycled;
+		metric_set(&m_idle, pool.count);
+	}
+	pool.busy++;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+
+	metric_observe_us(&m_wait, metrics_now_us() - t0);
+	metric_inc(id ? &m_hits : &m_misses);
+	return id;
+}
+
+void tts_pool_put(const char *session_id, int clean)
+{
+	pthread_mutex_lock(&pool.lock);
+	if (pool.busy)
+		pool.busy--;
+	if (session_id && clean && pool.recycle && pool.running
+			&& pool.count < pool.size) {
+		pool.idle[pool.count].id = session_id;
+		pool.idle[pool.count].recycled = 1;
+		pool.count++;
+		metric_set(&m_idle, pool.count);
+		session_id = NULL;
+	}
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+
+	if (session_id)
+		QTTSSessionEnd(session_id, clean ? "Normal" : "Error");
+}
+
+void tts_pool_no_recycle()
+{
+	pthread_mutex_lock(&pool.lock);
+	if (pool.recycle)
+		xlog(XLOG_INFO, "tts pool: engine refused a recycled session, "
+				"ending sessions after use\n");
+	pool.recycle = 0;
+	pthread_mutex_unlock(&pool.lock);
+}
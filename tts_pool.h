@@ -0,0 +1,43 @@
+/*
+ * @file
+ * @brief pool of warm TTS sessions for TTS_SESSION_PARAMS
+ *
+ * QTTSSessionBegin loads the voice resources named in the params, which
+ * costs more than synthesizing a short reply. The pool keeps
+ * $XIUXIU_TTS_POOL (default TTS_POOL_SIZE, 0 turns it off) sessions
+ * begun ahead of time and a background thread begins new ones as they
+ * are taken, never holding more than TTS_MAX_WORKERS sessions in use
+ * and idle together. A session that synthesized its text to the end is
+ * recycled for the next text; if the engine refuses text on a recycled
+ * session once, recycling is switched off and used sessions are ended.
+ */
+
+#ifndef TTS_POOL_H
+#define TTS_POOL_H
+
+#define TTS_POOL_SIZE		2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* after MSPLogin; returns 0, or -1 if the pool is off */
+int tts_pool_start();
+/* before MSPLogout; ends the idle sessions */
+void tts_pool_stop();
+
+/* a warm session for TTS_SESSION_PARAMS or NULL, then begin one
+ * yourself. Either way hand it back with tts_pool_put. *recycled tells
+ * whether it synthesized before */
+const char *tts_pool_get(int *recycled);
+/* clean: the text was synthesized to the end, the session can be
+ * reused. NULL just returns the slot of a failed session */
+void tts_pool_put(const char *session_id, int clean);
+/* a recycled session refused new text; it is ended by the caller */
+void tts_pool_no_recycle();
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
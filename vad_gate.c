@@ -0,0 +1,333 @@
+/*
+ * @file
+ * @brief energy / zero-crossing voice activity gate
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VAD_GATE_NEON 1
+#endif
+#include "vad_gate.h"
+#include "metrics.h"
+#include "xlog.h"
+
+#define VAD_DBGON 1
+#if VAD_DBGON == 1
+#define dbg(...) xlog(XLOG_DEBUG, __VA_ARGS__)
+#else
+#define dbg
+#endif
+
+/* mean square thresholds, full scale is 32768^2 */
+#define VAD_MIN_ENERGY		10000	/* about -50 dBFS, quieter is never voice */
+#define VAD_FLOOR_MIN		1000
+#define VAD_SPEECH_RATIO	6	/* voiced: this far above the noise floor */
+#define VAD_LOUD_RATIO		24	/* loud enough to skip the ZCR check */
+/* zero crossings per 256 samples; voiced speech stays well below,
+ * hiss and fan noise sit above */
+#define VAD_ZCR_MAX		96
+
+METRIC_COUNTER_DEFINE(m_gated, "xiuxiu_vad_gate_gated_samples_total",
+		"Samples held back by the voice activity gate and never forwarded");
+METRIC_COUNTER_DEFINE(m_passed, "xiuxiu_vad_gate_passed_samples_total",
+		"Samples forwarded by the voice activity gate, pre-roll included");
+
+#if defined(__SSE2__)
+static uint64_t sum_squares(const int16_t *x, unsigned int n)
+{
+	__m128i acc = _mm_setzero_si128();
+	__m128i zero = _mm_setzero_si128();
+	__m128i v, m;
+	uint64_t lanes[2], sum;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm_loadu_si128((const __m128i *)(x + i));
+		/* pairs of squares fit 32 bits unsigned */
+		m = _mm_madd_epi16(v, v);
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(m, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(m, zero));
+	}
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	sum = lanes[0] + lanes[1];
+	for (; i < n; i++)
+		sum += (int32_t)x[i] * x[i];
+	return sum;
+}
+
+static unsigned int zero_crossings(const int16_t *x, unsigned int n)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i a, b;
+	unsigned int i, count = 0;
+
+	for (i = 1; i + 8 <= n; i += 8) {
+		a = _mm_cmplt_epi16(_mm_loadu_si128((const __m128i *)(x + i)), zero);
+		b = _mm_cmplt_epi16(_mm_loadu_si128((const __m128i *)(x + i - 1)), zero);
+		/* two mask bits per differing lane */
+		count += __builtin_popcount(_mm_movemask_epi8(_mm_xor_si128(a, b))) / 2;
+	}
+	for (; i < n; i++)
+		count += (x[i] < 0) != (x[i - 1] < 0);
+	return count;
+}
+#elif defined(VAD_GATE_NEON)
+static uint64_t sum_squares(const int16_t *x, unsigned int n)
+{
+	int64x2_t acc = vdupq_n_s64(0);
+	int16x8_t v;
+	uint64_t sum;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = vld1q_s16(x + i);
+		acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+		acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(v), vget_high_s16(v)));
+	}
+	sum = vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+	for (; i < n; i++)
+		sum += (int32_t)x[i] * x[i];
+	return sum;
+}
+
+static unsigned int zero_crossings(const int16_t *x, unsigned int n)
+{
+	uint16x8_t acc = vdupq_n_u16(0);
+	uint16x8_t a, b;
+	uint64x2_t total;
+	unsigned int i, count;
+
+	for (i = 1; i + 8 <= n; i += 8) {
+		a = vcltq_s16(vld1q_s16(x + i), vdupq_n_s16(0));
+		b = vcltq_s16(vld1q_s16(x + i - 1), vdupq_n_s16(0));
+		acc = vaddq_u16(acc, vshrq_n_u16(veorq_u16(a, b), 15));
+	}
+	total = vpaddlq_u32(vpaddlq_u16(acc));
+	count = (unsigned int)(vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1));
+	for (; i < n; i++)
+		count += (x[i] < 0) != (x[i - 1] < 0);
+	return count;
+}
+#else
+static uint64_t sum_squares(const int16_t *x, unsigned int n)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum += (int32_t)x[i] * x[i];
+	return sum;
+}
+
+static unsigned int zero_crossings(const int16_t *x, unsigned int n)
+{
+	unsigned int i, count = 0;
+
+	for (i = 1; i < n; i++)
+		count += (x[i] < 0) != (x[i - 1] < 0);
+	return count;
+}
+#endif
+
+int vad_gate_init(struct vad_gate *g, unsigned int sample_rate,
+		unsigned int preroll_ms, unsigned int hangover_ms)
+{
+	const char *env = getenv("XIUXIU_IVW_GATE");
+
+	memset(g, 0, sizeof(*g));
+	g->enabled = !(env && strcmp(env, "0") == 0);
+	g->frame_samples = sample_rate * VAD_GATE_FRAME_MS / 1000;
+	if (g->frame_samples == 0)
+		return -1;
+	g->hangover_frames = hangover_ms / VAD_GATE_FRAME_MS;
+	g->onset_frames = 1;
+
+	g->preroll_size = (unsigned long)sample_rate * preroll_ms / 1000 * sizeof(int16_t);
+	if (g->preroll_size) {
+		g->preroll = (char *)malloc(g->preroll_size);
+		if (!g->preroll)
+			return -1;
+	}
+	if (!g->enabled)
+		dbg("vad gate disabled by XIUXIU_IVW_GATE\n");
+	return 0;
+}
+
+void vad_gate_free(struct vad_gate *g)
+{
+	if (g->preroll) {
+		free(g->preroll);
+		g->preroll = NULL;
+	}
+	g->preroll_size = 0;
+}
+
+void vad_gate_reset(struct vad_gate *g)
+{
+	g->open = 0;
+	g->hang_left = 0;
+	g->voiced_run = 0;
+	g->noise_floor = 0;
+	g->preroll_head = 0;
+	g->preroll_len = 0;
+}
+
+void vad_gate_set_onset(struct vad_gate *g, unsigned int onset_ms)
+{
+	g->onset_frames = onset_ms / VAD_GATE_FRAME_MS;
+	if (g->onset_frames == 0)
+		g->onset_frames = 1;
+}
+
+static int frame_is_voice(struct vad_gate *g, const int16_t *x, unsigned int n)
+{
+	uint64_t energy = sum_squares(x, n) / n;
+	unsigned int zcr = n > 1 ? zero_crossings(x, n) * 256 / (n - 1) : 0;
+	uint64_t floor = g->noise_floor;
+	int voice;
+
+	if (floor == 0)
+		floor = energy;
+	if (floor < VAD_FLOOR_MIN)
+		floor = VAD_FLOOR_MIN;
+
+	voice = energy >= VAD_MIN_ENERGY
+		&& (energy > floor * VAD_LOUD_RATIO
+			|| (energy > floor * VAD_SPEECH_RATIO && zcr < VAD_ZCR_MAX));
+
+	/* follow the floor down quickly, up slowly and never during voice */
+	if (energy < floor)
+		floor -= (floor - energy) / 8;
+	else if (!voice)
+		floor += (energy - floor) / 64;
+	g->noise_floor = floor;
+	return voice;
+}
+
+/* keep the newest preroll_size bytes; whatever falls out is gated for good */
+static void preroll_push(struct vad_gate *g, const char *data, unsigned long len)
+{
+	unsigned long evicted = 0, tail, n;
+
+	if (len >= g->preroll_size) {
+		evicted = g->preroll_len + len - g->preroll_size;
+		data += len - g->preroll_size;
+		len = g->preroll_size;
+		g->preroll_head = 0;
+		g->preroll_len = 0;
+	} else if (g->preroll_len + len > g->preroll_size) {
+		evicted = g->preroll_len + len - g->preroll_size;
+		g->preroll_head = (g->preroll_head + evicted) % g->preroll_size;
+		g->preroll_len -= evicted;
+	}
+
+	while (len) {
+		tail = (g->preroll_head + g->preroll_len) % g->preroll_size;
+		n = g->preroll_size - tail;
+		if (n > len)
+			n = len;
+		memcpy(g->preroll + tail, data, n);
+		g->preroll_len += n;
+		data += n;
+		len -= n;
+	}
+
+	if (evicted) {
+		g->gated_bytes += evicted;
+		metric_add(&m_gated, evicted / sizeof(int16_t));
+	}
+}
+
+static void preroll_flush(struct vad_gate *g, vad_gate_emit emit, void *user_para)
+{
+	unsigned long n;
+
+	while (g->preroll_len) {
+		n = g->preroll_size - g->preroll_head;
+		if (n > g->preroll_len)
+			n = g->preroll_len;
+		emit(g->preroll + g->preroll_head, n, user_para);
+		g->passed_bytes += n;
+		metric_add(&m_passed, n / sizeof(int16_t));
+		g->preroll_head = (g->preroll_head + n) % g->preroll_size;
+		g->preroll_len -= n;
+	}
+	g->preroll_head = 0;
+}
+
+static void emit_span(struct vad_gate *g, const char *data, unsigned long len,
+		vad_gate_emit emit, void *user_para)
+{
+	if (!len)
+		return;
+	emit(data, len, user_para);
+	g->passed_bytes += len;
+	metric_add(&m_passed, len / sizeof(int16_t));
+}
+
+void vad_gate_process(struct vad_gate *g, const char *data, unsigned long len,
+		vad_gate_emit emit, void *user_para)
+{
+	unsigned long frame_bytes = g->frame_samples * sizeof(int16_t);
+	unsigned long off, n, span = 0;
+	int voice;
+
+	if (!g->enabled) {
+		emit_span(g, data, len, emit, user_para);
+		return;
+	}
+
+	/* consecutive passing frames go out in one emit call */
+	for (off = 0; off < len; off += n) {
+		n = len - off < frame_bytes ? len - off : frame_bytes;
+
+		voice = frame_is_voice(g, (const int16_t *)(data + off), n / sizeof(int16_t));
+		g->voiced_run = voice ? g->voiced_run + 1 : 0;
+		if (voice && (g->open || g->voiced_run >= g->onset_frames)) {
+			if (!g->open) {
+				g->open = 1;
+				preroll_flush(g, emit, user_para);
+			}
+			g->hang_left = g->hangover_frames;
+		} else if (g->open && g->hang_left) {
+			g->hang_left--;
+		} else {
+			g->open = 0;
+		}
+
+		if (g->open) {
+			span += n;
+			continue;
+		}
+		emit_span(g, data + off - span, span, emit, user_para);
+		span = 0;
+		if (g->preroll_size) {
+			preroll_push(g, data + off, n);
+		} else {
+			g->gated_bytes += n;
+			metric_add(&m_gated, n / sizeof(int16_t));
+		}
+	}
+	emit_span(g, data + len - span, span, emit, user_para);
+}
+
+int vad_gate_frame_voice(struct vad_gate *g, const char *data, unsigned long len)
+{
+	unsigned int n = len / sizeof(int16_t);
+
+	if (n > g->frame_samples)
+		n = g->frame_samples;
+	return n ? frame_is_voice(g, (const int16_t *)data, n) : 0;
+}
+
+double vad_gate_gated_fraction(const struct vad_gate *g)
+{
+	uint64_t total = g->gated_bytes + g->passed_bytes;
+
+	return total ? (double)g->gated_bytes / total : 0.0;
+}
@@ -0,0 +1,76 @@
+/*
+ * @file
+ * @brief energy / zero-crossing voice activity gate
+ *
+ * A cheap front gate for always-on consumers such as the wake engine.
+ * Audio is classified in 10 ms frames by RMS energy against a tracked
+ * noise floor, with the zero-crossing rate used to reject broadband
+ * hiss. Frames judged silent are held back instead of forwarded; the
+ * last preroll_ms of them are replayed when the gate opens so onsets
+ * are not clipped, and the gate stays open for hangover_ms after the
+ * last voiced frame so word tails and short pauses pass through.
+ *
+ * Only 16 bit mono PCM is supported. The inner loops use SSE2 or NEON
+ * when the compiler targets them and plain C otherwise.
+ */
+
+#ifndef VAD_GATE_H
+#define VAD_GATE_H
+
+#include <stdint.h>
+
+#define VAD_GATE_FRAME_MS	10
+
+typedef void (*vad_gate_emit)(const char *data, unsigned long len, void *user_para);
+
+struct vad_gate {
+	int enabled;
+	int open;
+	unsigned int frame_samples;
+	unsigned int hangover_frames;
+	unsigned int hang_left;
+	unsigned int onset_frames;	/* voiced frames in a row that open it */
+	unsigned int voiced_run;
+	uint64_t noise_floor;	/* mean square, tracked while closed */
+
+	/* pre-roll ring of the most recent gated audio */
+	char *preroll;
+	unsigned long preroll_size;
+	unsigned long preroll_head;
+	unsigned long preroll_len;
+
+	uint64_t gated_bytes;
+	uint64_t passed_bytes;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* $XIUXIU_IVW_GATE=0 creates a gate that forwards everything */
+int vad_gate_init(struct vad_gate *g, unsigned int sample_rate,
+		unsigned int preroll_ms, unsigned int hangover_ms);
+void vad_gate_free(struct vad_gate *g);
+/* forget the stream state, e.g. when a new session starts */
+void vad_gate_reset(struct vad_gate *g);
+/* open only after onset_ms of consecutive voice instead of one frame;
+ * the frames before are replayed with the pre-roll */
+void vad_gate_set_onset(struct vad_gate *g, unsigned int onset_ms);
+
+/* classify data and call emit for everything that passes, pre-roll
+ * first; emit may be called several times per call */
+void vad_gate_process(struct vad_gate *g, const char *data, unsigned long len,
+		vad_gate_emit emit, void *user_para);
+
+/* classify one frame of at most frame_samples without gating it,
+ * tracking the noise floor as vad_gate_process does; 1 if voice */
+int vad_gate_frame_voice(struct vad_gate *g, const char *data, unsigned long len);
+
+/* fraction of audio held back since init, 0..1 */
+double vad_gate_gated_fraction(const struct vad_gate *g);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
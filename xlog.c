@@ -0,0 +1,289 @@
+/*
+ * @file
+ * @brief bounded MPSC log ring drained by a background thread
+ *
+ * The ring is the classic sequence-numbered bounded queue: a producer
+ * claims a slot by advancing enqueue_pos with CAS, formats into it and
+ * publishes it by bumping the slot sequence. Only the drain thread
+ * consumes, so dequeue needs no CAS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "xlog.h"
+#include "metrics.h"
+
+#define XLOG_IDLE_WAIT_MS	100
+
+struct xlog_slot {
+	uint64_t seq;
+	int level;
+	char msg[XLOG_MSG_LEN];
+};
+
+METRIC_COUNTER_DEFINE(m_dropped, "xiuxiu_log_dropped_total",
+		"Log messages dropped because the async log ring was full");
+
+int xlog_level = XLOG_DEBUG;
+
+static struct xlog_slot g_ring[XLOG_RING_SIZE];
+static uint64_t g_enqueue_pos;
+static uint64_t g_dequeue_pos;
+static uint64_t g_dropped;
+static int g_sleeping;
+static int g_running;
+static int g_efd = -1;
+static pthread_t g_drain_pt;
+
+static void efd_signal()
+{
+	uint64_t one = 1;
+
+	/* only fails when the counter saturates, which still wakes the reader */
+	if (write(g_efd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static void efd_clear()
+{
+	uint64_t v;
+
+	if (read(g_efd, &v, sizeof(v)) < 0)
+		return;
+}
+
+static int parse_level(const char *s)
+{
+	static const char *names[] = { "error", "warn", "info", "debug" };
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (strcasecmp(s, names[i]) == 0)
+			return i;
+	return atoi(s);
+}
+
+static void ring_reset()
+{
+	uint64_t i;
+
+	for (i = 0; i < XLOG_RING_SIZE; i++)
+		g_ring[i].seq = i;
+	g_enqueue_pos = 0;
+	g_dequeue_pos = 0;
+}
+
+/* consumer side; returns 1 if a message was written */
+static int drain_one()
+{
+	struct xlog_slot *s = &g_ring[g_dequeue_pos & (XLOG_RING_SIZE - 1)];
+
+	if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != g_dequeue_pos + 1)
+		return 0;
+
+	fputs(s->msg, s->level <= XLOG_WARN ? stderr : stdout);
+	__atomic_store_n(&s->seq, g_dequeue_pos + XLOG_RING_SIZE, __ATOMIC_RELEASE);
+	g_dequeue_pos++;
+	return 1;
+}
+
+static void drain_all()
+{
+	static uint64_t reported = 0;
+	uint64_t dropped;
+	int n = 0;
+
+	while (drain_one())
+		n++;
+
+	dropped = __atomic_load_n(&g_dropped, __ATOMIC_RELAXED);
+	if (dropped != reported) {
+		printf("[xlog] %llu messages dropped\n",
+				(unsigned long long)(dropped - reported));
+		reported = dropped;
+		n++;
+	}
+	if (n) {
+		fflush(stdout);
+		fflush(stderr);
+	}
+}
+
+static void *drain_proc(void *arg)
+{
+	struct pollfd pfd;
+
+	pfd.fd = g_efd;
+	pfd.events = POLLIN;
+
+	while (__atomic_load_n(&g_running, __ATOMIC_ACQUIRE)) {
+		drain_all();
+
+		__atomic_store_n(&g_sleeping, 1, __ATOMIC_SEQ_CST);
+		/* recheck so a producer that missed the flag is not delayed */
+		if (__atomic_load_n(&g_ring[g_dequeue_pos & (XLOG_RING_SIZE - 1)].seq,
+					__ATOMIC_SEQ_CST) != g_dequeue_pos + 1) {
+			if (poll(&pfd, 1, XLOG_IDLE_WAIT_MS) > 0)
+				efd_clear();
+		}
+		__atomic_store_n(&g_sleeping, 0, __ATOMIC_RELAXED);
+	}
+	drain_all();
+	return NULL;
+}
+
+int xlog_init()
+{
+	const char *env;
+
+	if (g_running)
+		return 0;
+
+	env = getenv("XIUXIU_LOG_LEVEL");
+	if (env && *env)
+		xlog_set_level(parse_level(env));
+
+	ring_reset();
+	g_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (g_efd < 0)
+		return -1;
+
+	__atomic_store_n(&g_running, 1, __ATOMIC_RELEASE);
+	if (pthread_create(&g_drain_pt, NULL, drain_proc, NULL) != 0) {
+		g_running = 0;
+		close(g_efd);
+		g_efd = -1;
+		return -1;
+	}
+	atexit(xlog_shutdown);
+	return 0;
+}
+
+void xlog_shutdown()
+{
+	if (!__atomic_exchange_n(&g_running, 0, __ATOMIC_ACQ_REL))
+		return;
+
+	efd_signal();
+	pthread_join(g_drain_pt, NULL);
+	close(g_efd);
+	g_efd = -1;
+}
+
+void xlog_set_level(int level)
+{
+	if (level < XLOG_ERROR)
+		level = XLOG_ERROR;
+	if (level > XLOG_DEBUG)
+		level = XLOG_DEBUG;
+	xlog_level = level;
+}
+
+uint64_t xlog_dropped()
+{
+	return __atomic_load_n(&g_dropped, __ATOMIC_RELAXED);
+}
+
+/* claim n consecutive slots; returns the position of the first or -1 */
+static int64_t claim(unsigned int n)
+{
+	struct xlog_slot *last;
+	uint64_t pos, seq;
+	int64_t diff;
+
+	pos = __atomic_load_n(&g_enqueue_pos, __ATOMIC_RELAXED);
+	for (;;) {
+		/* the drain thread frees slots in order, so if the last one
+		 * is free the ones before it are too */
+		last = &g_ring[(pos + n - 1) & (XLOG_RING_SIZE - 1)];
+		seq = __atomic_load_n(&last->seq, __ATOMIC_ACQUIRE);
+		diff = (int64_t)(seq - (pos + n - 1));
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&g_enqueue_pos, &pos, pos + n, 1,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				return (int64_t)pos;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n(&g_enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* msg in pieces of slots claimed together, so nothing comes in between */
+static void enqueue(int level, const char *msg, size_t len)
+{
+	struct xlog_slot *s;
+	size_t piece = XLOG_MSG_LEN - 1;
+	unsigned int i, n;
+	int64_t pos;
+
+	n = len ? (len + piece - 1) / piece : 1;
+	if (n > XLOG_MAX_PIECES) {
+		n = XLOG_MAX_PIECES;
+		len = n * piece;
+	}
+	pos = claim(n);
+	if (pos < 0) {
+		/* full: never wait for the drain thread */
+		__atomic_add_fetch(&g_dropped, 1, __ATOMIC_RELAXED);
+		metric_inc(&m_dropped);
+		return;
+	}
+
+	for (i = 0; i < n; i++, msg += piece, len -= piece) {
+		s = &g_ring[(pos + i) & (XLOG_RING_SIZE - 1)];
+		s->level = level;
+		if (len < piece)
+			piece = len;
+		memcpy(s->msg, msg, piece);
+		s->msg[piece] = '\0';
+		__atomic_store_n(&s->seq, pos + i + 1, __ATOMIC_SEQ_CST);
+	}
+
+	if (__atomic_load_n(&g_sleeping, __ATOMIC_SEQ_CST))
+		efd_signal();
+}
+
+void xlog_write(int level, const char *fmt, ...)
+{
+	char buf[XLOG_MSG_LEN], *big;
+	va_list ap;
+	int len;
+
+	if (!__atomic_load_n(&g_running, __ATOMIC_ACQUIRE)) {
+		va_start(ap, fmt);
+		vfprintf(level <= XLOG_WARN ? stderr : stdout, fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (len < (int)sizeof(buf)) {
+		enqueue(level, buf, len);
+		return;
+	}
+
+	/* rare: the recognition results and the like */
+	big = (char *)malloc(len + 1);
+	if (!big) {
+		enqueue(level, buf, sizeof(buf) - 1);
+		return;
+	}
+	va_start(ap, fmt);
+	vsnprintf(big, len + 1, fmt, ap);
+	va_end(ap);
+	enqueue(level, big, len);
+	free(big);
+}
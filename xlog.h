@@ -0,0 +1,63 @@
+/*
+ * @file
+ * @brief asynchronous logger safe for the audio threads
+ *
+ * xlog() formats into a slot of a bounded lock-free MPSC ring and
+ * returns; a background thread drains the ring to stdout, or stderr
+ * for warnings and errors. A message longer than a slot is formatted
+ * on the heap and spread over consecutive slots. A full ring
+ * drops the message and counts it instead of blocking, so the capture
+ * and playback threads never wait on terminal or journald I/O.
+ *
+ * Messages below XLOG_COMPILE_LEVEL are compiled out ("make
+ * LOG_LEVEL=1" keeps errors and warnings only); the rest are filtered
+ * at runtime by xlog_set_level() or $XIUXIU_LOG_LEVEL. Before
+ * xlog_init() messages are written synchronously.
+ */
+
+#ifndef XLOG_H
+#define XLOG_H
+
+#include <stdint.h>
+
+enum {
+	XLOG_ERROR,
+	XLOG_WARN,
+	XLOG_INFO,
+	XLOG_DEBUG
+};
+
+#ifndef XLOG_COMPILE_LEVEL
+#define XLOG_COMPILE_LEVEL	XLOG_DEBUG
+#endif
+
+#define XLOG_MSG_LEN	256	/* longer messages take several slots */
+#define XLOG_MAX_PIECES	16	/* slots a message may take, the rest is cut */
+#define XLOG_RING_SIZE	1024	/* power of 2 */
+
+extern int xlog_level;
+
+#define xlog(level, ...) \
+	do { \
+		if ((level) <= XLOG_COMPILE_LEVEL && (level) <= xlog_level) \
+			xlog_write(level, __VA_ARGS__); \
+	} while (0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* start the drain thread; flushed and stopped at exit */
+int xlog_init();
+void xlog_shutdown();
+void xlog_set_level(int level);
+void xlog_write(int level, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+/* messages lost to a full ring since start */
+uint64_t xlog_dropped();
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif